@@ -0,0 +1,253 @@
+/**
+ * VarInt codec benchmark
+ *
+ * Times the VarInt functions in varnum.c against the byte-at-a-time
+ * versions they replaced, over several distributions of values: small
+ * (1 byte), medium (2 bytes), entity IDs (players, plus mobs with their
+ * negative `-2 - i` IDs, which take 5 bytes), and uniformly random 32-bit
+ * values. Writes go to the memory sink and reads come from the memory
+ * source, so no network is involved. Every value is also round-tripped
+ * and checked against the old implementation before timing.
+ * Build with `./build.sh --bench`.
+ *
+ * Usage: bench_varint [-c count] [-n passes]
+ *   -c  Amount of values per distribution (default 1048576)
+ *   -n  Number of timed passes over the values (default 5)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "globals.h"
+#include "tools.h"
+#include "varnum.h"
+
+#define DISTRIBUTION_COUNT 4
+
+const char *distribution_names[DISTRIBUTION_COUNT] = { "small", "medium", "entity ids", "random" };
+
+uint32_t *values;
+uint8_t *encoded;
+size_t encoded_length;
+
+// The implementations from before the memory codec, for comparison
+// These used to live in varnum.c, so keep them from being inlined here
+
+__attribute__((noinline)) int oldSizeVarInt (uint32_t value) {
+  int size = 1;
+  while ((value & ~SEGMENT_BITS) != 0) {
+    value >>= 7;
+    size ++;
+  }
+  return size;
+}
+
+__attribute__((noinline)) void oldWriteVarInt (int client_fd, uint32_t value) {
+  while (true) {
+    if ((value & ~SEGMENT_BITS) == 0) {
+      writeByte(client_fd, value);
+      return;
+    }
+    writeByte(client_fd, (value & SEGMENT_BITS) | CONTINUE_BIT);
+    value >>= 7;
+  }
+}
+
+__attribute__((noinline)) int32_t oldReadVarInt (int client_fd) {
+  int32_t value = 0;
+  int position = 0;
+  uint8_t byte;
+
+  while (true) {
+    byte = readByte(client_fd);
+    if (recv_count != 1) return VARNUM_ERROR;
+
+    value |= (byte & SEGMENT_BITS) << position;
+
+    if ((byte & CONTINUE_BIT) == 0) break;
+
+    position += 7;
+    if (position >= 32) return VARNUM_ERROR;
+  }
+
+  return value;
+}
+
+// Fills `values` with `count` values of the given distribution
+void fillValues (int distribution, int count) {
+  for (int i = 0; i < count; i ++) {
+    uint32_t r = fast_rand();
+    switch (distribution) {
+      case 0: values[i] = r & 0x7F; break;
+      case 1: values[i] = 0x80 + r % (0x4000 - 0x80); break;
+      // Roughly as many players as mobs, see spawnMob for the mob IDs
+      case 2: values[i] = (r & 1) ? (r >> 1) % MAX_PLAYERS : (uint32_t)(-2 - (int)((r >> 1) % MAX_MOBS)); break;
+      default: values[i] = r; break;
+    }
+  }
+}
+
+// Points the memory source at the encoded values, to be read back
+void rewindSource () {
+  memory_source = encoded;
+  memory_source_length = encoded_length;
+  memory_source_offset = 0;
+}
+
+// Checks the new codec against the old one, returns non-zero on mismatch
+int verifyValues (int count) {
+
+  memory_sink_length = 0;
+  for (int i = 0; i < count; i ++) oldWriteVarInt(MEMORY_SINK_FD, values[i]);
+  size_t old_length = memory_sink_length;
+  uint8_t *old_encoded = malloc(old_length);
+  memcpy(old_encoded, memory_sink, old_length);
+
+  memory_sink_length = 0;
+  for (int i = 0; i < count; i ++) writeVarInt(MEMORY_SINK_FD, values[i]);
+  encoded_length = memory_sink_length;
+  int failed = memory_sink_length != old_length || memcmp(memory_sink, old_encoded, old_length);
+  free(old_encoded);
+  if (failed) {
+    fprintf(stderr, "writeVarInt output differs from the old implementation\n");
+    return 1;
+  }
+
+  int offset = 0;
+  uint8_t buf[VARLONG_MAX_SIZE];
+  for (int i = 0; i < count; i ++) {
+    if (sizeVarInt(values[i]) != oldSizeVarInt(values[i])) {
+      fprintf(stderr, "sizeVarInt(%u) is %d, expected %d\n", values[i], sizeVarInt(values[i]), oldSizeVarInt(values[i]));
+      return 1;
+    }
+    if ((uint32_t)decodeVarInt(memory_sink, memory_sink_length, &offset) != values[i]) {
+      fprintf(stderr, "decodeVarInt failed on %u\n", values[i]);
+      return 1;
+    }
+    // Also round-trip VarLongs, sign-extended as for 64-bit fields
+    uint64_t wide = (int64_t)(int32_t)values[i];
+    int size = encodeVarLong(buf, wide);
+    int long_offset = 0;
+    if (size != sizeVarLong(wide) || (uint64_t)decodeVarLong(buf, size, &long_offset) != wide || long_offset != size) {
+      fprintf(stderr, "VarLong round trip failed on %lld\n", (long long)wide);
+      return 1;
+    }
+  }
+
+  rewindSource();
+  for (int i = 0; i < count; i ++) {
+    if ((uint32_t)readVarInt(0) != values[i]) {
+      fprintf(stderr, "readVarInt failed on %u\n", values[i]);
+      return 1;
+    }
+  }
+  memory_source = NULL;
+
+  return 0;
+}
+
+void printResult (const char *distribution, const char *operation, int64_t old_time, int64_t new_time, double operations) {
+  printf("%-10s %-8s %10.2f %10.2f %8.2fx\n",
+    distribution, operation,
+    old_time * 1000.0 / operations, new_time * 1000.0 / operations,
+    (double)old_time / (new_time > 0 ? new_time : 1)
+  );
+}
+
+int main (int argc, char **argv) {
+
+  int count = 1 << 20, passes = 5;
+
+  for (int i = 1; i < argc - 1; i += 2) {
+    if (!strcmp(argv[i], "-c")) count = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-n")) passes = atoi(argv[i + 1]);
+    else {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (count < 1 || passes < 1) {
+    fprintf(stderr, "Invalid arguments\n");
+    return 1;
+  }
+
+  values = malloc(count * sizeof(uint32_t));
+  encoded = malloc((size_t)count * VARINT_MAX_SIZE);
+  memory_sink = encoded;
+  memory_sink_size = (size_t)count * VARINT_MAX_SIZE;
+
+  double operations = (double)count * passes;
+  // Keeps the results of size calculations alive
+  volatile uint32_t checksum = 0;
+
+  printf("%d values, %d passes, times in ns per value\n\n", count, passes);
+  printf("%-10s %-8s %10s %10s %9s\n", "values", "op", "old", "new", "speedup");
+
+  for (int d = 0; d < DISTRIBUTION_COUNT; d ++) {
+
+    fillValues(d, count);
+    if (verifyValues(count)) return 1;
+
+    int64_t start, old_time, new_time;
+    uint32_t sum;
+
+    // sizeVarInt, as done for every packet length
+    start = get_program_time();
+    sum = 0;
+    for (int p = 0; p < passes; p ++) {
+      for (int i = 0; i < count; i ++) sum += oldSizeVarInt(values[i]);
+    }
+    old_time = get_program_time() - start;
+    checksum += sum;
+    start = get_program_time();
+    sum = 0;
+    for (int p = 0; p < passes; p ++) {
+      for (int i = 0; i < count; i ++) sum += sizeVarInt(values[i]);
+    }
+    new_time = get_program_time() - start;
+    checksum += sum;
+    printResult(distribution_names[d], "size", old_time, new_time, operations);
+
+    // writeVarInt into the memory sink
+    start = get_program_time();
+    for (int p = 0; p < passes; p ++) {
+      memory_sink_length = 0;
+      for (int i = 0; i < count; i ++) oldWriteVarInt(MEMORY_SINK_FD, values[i]);
+    }
+    old_time = get_program_time() - start;
+    start = get_program_time();
+    for (int p = 0; p < passes; p ++) {
+      memory_sink_length = 0;
+      for (int i = 0; i < count; i ++) writeVarInt(MEMORY_SINK_FD, values[i]);
+    }
+    new_time = get_program_time() - start;
+    printResult(distribution_names[d], "write", old_time, new_time, operations);
+
+    // readVarInt from the memory source, as for decompressed packets
+    start = get_program_time();
+    sum = 0;
+    for (int p = 0; p < passes; p ++) {
+      rewindSource();
+      for (int i = 0; i < count; i ++) sum += oldReadVarInt(0);
+    }
+    old_time = get_program_time() - start;
+    checksum += sum;
+    start = get_program_time();
+    sum = 0;
+    for (int p = 0; p < passes; p ++) {
+      rewindSource();
+      for (int i = 0; i < count; i ++) sum += readVarInt(0);
+    }
+    new_time = get_program_time() - start;
+    checksum += sum;
+    memory_source = NULL;
+    printResult(distribution_names[d], "read", old_time, new_time, operations);
+
+  }
+
+  free(values);
+  free(encoded);
+
+  return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ * World generation benchmark
+ *
+ * Times chunk section generation and full chunk packet serialization
+ * over a grid of chunks, for each combination of world seed and block
+ * change density. Packets are written to the memory sink, so no network
+ * is involved. Build with `./build.sh --bench`.
+ *
+ * Usage: bench_worldgen [-r radius] [-s seeds] [-d densities] [-n passes]
+ *   -r  Chunk grid radius around the origin (default 4, i.e. 9x9 chunks)
+ *   -s  Comma-separated list of world seeds (default: the configured seed)
+ *   -d  Comma-separated list of block changes per chunk (default 0,16,256)
+ *   -n  Number of timed passes over the grid (default 3)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "globals.h"
+#include "tools.h"
+#include "registries.h"
+#include "worldgen.h"
+#include "packets.h"
+
+#define MAX_LIST 16
+
+// Large enough to hold one full chunk packet
+uint8_t sink_buffer[1 << 18];
+
+// Parses a comma-separated list of integers, returns the amount parsed
+int parseList (char *str, uint32_t *out) {
+  int count = 0;
+  char *token = strtok(str, ",");
+  while (token && count < MAX_LIST) {
+    out[count ++] = strtoul(token, NULL, 0);
+    token = strtok(NULL, ",");
+  }
+  return count;
+}
+
+// Scatters `density` random block changes across every chunk in the grid
+// Returns the amount of block changes actually stored
+int fillBlockChanges (int radius, uint32_t density) {
+
+  for (int i = 0; i < MAX_BLOCK_CHANGES; i ++) {
+    block_changes[i].block = 0xFF;
+  }
+  block_changes_count = 0;
+
+  for (int cx = -radius; cx <= radius; cx ++) {
+    for (int cz = -radius; cz <= radius; cz ++) {
+      for (uint32_t i = 0; i < density; i ++) {
+        if (block_changes_count == MAX_BLOCK_CHANGES) return block_changes_count;
+        uint32_t r = fast_rand();
+        BlockChange *change = &block_changes[block_changes_count ++];
+        change->x = cx * 16 + (r & 15);
+        change->z = cz * 16 + ((r >> 4) & 15);
+        change->y = 40 + ((r >> 8) % 60);
+        change->block = B_stone;
+      }
+    }
+  }
+
+  return block_changes_count;
+}
+
+int main (int argc, char **argv) {
+
+  int radius = 4, passes = 3;
+  uint32_t seeds[MAX_LIST] = { INITIAL_WORLD_SEED }, densities[MAX_LIST] = { 0, 16, 256 };
+  int seed_count = 1, density_count = 3;
+
+  for (int i = 1; i < argc - 1; i += 2) {
+    if (!strcmp(argv[i], "-r")) radius = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-n")) passes = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-s")) seed_count = parseList(argv[i + 1], seeds);
+    else if (!strcmp(argv[i], "-d")) density_count = parseList(argv[i + 1], densities);
+    else {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (radius < 0 || passes < 1 || seed_count == 0 || density_count == 0) {
+    fprintf(stderr, "Invalid arguments\n");
+    return 1;
+  }
+
+  int side = radius * 2 + 1;
+  int chunks = side * side * passes;
+
+  memory_sink = sink_buffer;
+  memory_sink_size = sizeof(sink_buffer);
+
+  printf("Grid: %dx%d chunks, %d passes\n\n", side, side, passes);
+  printf("%-10s %8s %-9s %12s %10s %12s\n", "seed", "changes", "phase", "chunks/s", "ns/block", "bytes/chunk");
+
+  for (int s = 0; s < seed_count; s ++) {
+    for (int d = 0; d < density_count; d ++) {
+
+      // Hash the seeds the same way the server does on startup
+      world_seed = splitmix64(seeds[s]);
+      rng_seed = splitmix64(INITIAL_RNG_SEED);
+      int stored = fillBlockChanges(radius, densities[d]);
+      if (stored < side * side * (int)densities[d]) {
+        printf("(block changes capped at %d)\n", stored);
+      }
+
+      // Time generation of the 20 non-empty sections of each chunk
+      int64_t start = get_program_time();
+      for (int p = 0; p < passes; p ++) {
+        for (int cx = -radius; cx <= radius; cx ++) {
+          for (int cz = -radius; cz <= radius; cz ++) {
+            for (int y = 0; y < 320; y += 16) {
+              buildChunkSection(cx * 16, y, cz * 16);
+            }
+          }
+        }
+      }
+      int64_t generate_time = get_program_time() - start;
+
+      // Time full chunk packet serialization into the memory sink
+      uint64_t total_bytes = 0;
+      start = get_program_time();
+      for (int p = 0; p < passes; p ++) {
+        for (int cx = -radius; cx <= radius; cx ++) {
+          for (int cz = -radius; cz <= radius; cz ++) {
+            memory_sink_length = 0;
+            sc_chunkDataAndUpdateLight(MEMORY_SINK_FD, cx, cz);
+            total_bytes += memory_sink_length;
+          }
+        }
+      }
+      int64_t serialize_time = get_program_time() - start;
+
+      double blocks = (double)chunks * 20 * 4096;
+      printf("%-10X %8u %-9s %12.1f %10.2f %12s\n",
+        seeds[s], densities[d], "generate",
+        chunks / (generate_time / 1000000.0), generate_time * 1000.0 / blocks, "-"
+      );
+      printf("%-10X %8u %-9s %12.1f %10.2f %12llu\n",
+        seeds[s], densities[d], "serialize",
+        chunks / (serialize_time / 1000000.0), serialize_time * 1000.0 / blocks,
+        (unsigned long long)(total_bytes / chunks)
+      );
+
+    }
+  }
+
+  return 0;
+}
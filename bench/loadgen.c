@@ -0,0 +1,640 @@
+/**
+ * Headless load generator
+ *
+ * Connects a number of bot clients to a server on localhost, takes them
+ * through login and configuration, then has them walk around randomly,
+ * mine and place blocks, and chat. At the end of the run, prints a
+ * report of join times, chunk arrival latency, throughput and
+ * disconnects, split into kicks by the server, connections closed by the
+ * server, and failures on the bot's end.
+ *
+ * Only speaks the subset of the protocol that bareiron implements.
+ * POSIX only. Build with `./build.sh --bench`.
+ *
+ * Usage: loadgen [-n bots] [-t seconds] [-p port] [-j join_interval_ms] [-o report_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Shares the server's configuration and decompressor
+#include "compression.h"
+
+#define PROTOCOL_VERSION 772
+
+#define MAX_BOTS 1024
+#define RECV_BUFFER_SIZE 65536
+// Amount of bytes from the start of each packet kept for parsing
+// The rest of the packet (e.g. chunk data) is skipped over
+#define HEADER_SIZE 64
+// Amount of bytes from the start of compressed packets kept for
+// decompressing the first HEADER_SIZE bytes of their contents
+#define COMPRESSED_HEADER_SIZE 4096
+// Maximum amount of chunk latency samples kept for percentiles
+#define MAX_SAMPLES 65536
+
+#define BOT_CONNECTING 0
+#define BOT_LOGIN 1
+#define BOT_CONFIGURATION 2
+#define BOT_PLAY 3
+#define BOT_DEAD 4
+
+typedef struct {
+  int fd;
+  int state;
+  char name[16];
+
+  // Receive buffer and parser state
+  uint8_t buffer[RECV_BUFFER_SIZE];
+  size_t buffer_start, buffer_end;
+  uint32_t skip;
+  uint8_t compressed; // Whether the server has enabled compression
+
+  // Position and movement
+  double x, y, z;
+  double dx, dz;
+  int chunk_x, chunk_z;
+  int64_t last_move, next_turn, next_action, next_chat;
+
+  // Measurements
+  int64_t connect_time;
+  int64_t join_time; // Time from connecting to entering play state
+  int64_t chunk_wait; // Time we started waiting for new chunks, or 0
+  uint8_t center_ok; // Whether the server has moved our center chunk since
+  uint32_t chunks;
+  uint64_t bytes;
+  uint32_t packets;
+} Bot;
+
+Bot bots[MAX_BOTS];
+int bot_count = 4;
+
+int64_t chunk_latency[MAX_SAMPLES];
+int chunk_latency_count = 0;
+
+// Why a bot stopped, counted separately in the report
+#define BOT_KICKED 0 // Sent a Disconnect packet by the server
+#define BOT_CLOSED 1 // Connection closed or reset by the server
+#define BOT_FAILED 2 // Couldn't connect, or couldn't parse what it got
+uint32_t disconnects[3] = { 0 };
+
+int64_t now_us () {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+}
+
+// Closes the bot's connection and counts the disconnect by its `cause`
+void killBot (Bot *bot, int cause) {
+  if (bot->state == BOT_DEAD) return;
+  close(bot->fd);
+  bot->state = BOT_DEAD;
+  disconnects[cause] ++;
+}
+
+/* Packet encoding */
+
+typedef struct {
+  uint8_t data[512];
+  int length;
+} Packet;
+
+void putByte (Packet *p, uint8_t b) {
+  p->data[p->length ++] = b;
+}
+
+void putVarInt (Packet *p, uint32_t value) {
+  while (value & ~0x7F) {
+    putByte(p, (value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  putByte(p, value);
+}
+
+void putBytes (Packet *p, const void *data, int length) {
+  memcpy(p->data + p->length, data, length);
+  p->length += length;
+}
+
+void putString (Packet *p, const char *str) {
+  putVarInt(p, strlen(str));
+  putBytes(p, str, strlen(str));
+}
+
+void putUint64 (Packet *p, uint64_t value) {
+  for (int i = 7; i >= 0; i --) putByte(p, value >> (i * 8));
+}
+
+void putDouble (Packet *p, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, 8);
+  putUint64(p, bits);
+}
+
+void putPosition (Packet *p, int x, int y, int z) {
+  putUint64(p,
+    ((uint64_t)(x & 0x3FFFFFF) << 38) |
+    ((uint64_t)(z & 0x3FFFFFF) << 12) |
+    (uint64_t)(y & 0xFFF)
+  );
+}
+
+// Frames and sends a packet, marks the bot as dead on failure
+void sendPacket (Bot *bot, int id, Packet *p) {
+  if (bot->state == BOT_DEAD) return;
+  uint8_t frame[520];
+  Packet header = { .length = 0 };
+  putVarInt(&header, id);
+  int body_length = header.length + p->length;
+  int offset = 0;
+  // Bots only send small packets, so they're never compressed,
+  // just prefixed with a data length of 0 when compression is on
+  uint32_t value = body_length + bot->compressed;
+  while (value & ~0x7F) {
+    frame[offset ++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  frame[offset ++] = value;
+  if (bot->compressed) frame[offset ++] = 0;
+  memcpy(frame + offset, header.data, header.length);
+  memcpy(frame + offset + header.length, p->data, p->length);
+  if (send(bot->fd, frame, offset + body_length, MSG_NOSIGNAL) < 0) {
+    killBot(bot, BOT_CLOSED);
+  }
+}
+
+/* Packet decoding */
+
+// Reads a VarInt from the buffer, returns bytes read or 0 if incomplete
+int getVarInt (const uint8_t *buf, size_t available, uint32_t *out) {
+  uint32_t value = 0;
+  for (int i = 0; i < 5; i ++) {
+    if ((size_t)i >= available) return 0;
+    value |= (uint32_t)(buf[i] & 0x7F) << (7 * i);
+    if (!(buf[i] & 0x80)) {
+      *out = value;
+      return i + 1;
+    }
+  }
+  return -1;
+}
+
+double getDouble (const uint8_t *buf) {
+  uint64_t bits = 0;
+  for (int i = 0; i < 8; i ++) bits = (bits << 8) | buf[i];
+  double value;
+  memcpy(&value, &bits, 8);
+  return value;
+}
+
+/* Bot behavior */
+
+void startBot (Bot *bot, int index, int port) {
+
+  memset(bot, 0, sizeof(Bot));
+  snprintf(bot->name, sizeof(bot->name), "bot%d", index);
+  bot->state = BOT_DEAD;
+  bot->connect_time = now_us();
+
+  bot->fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (bot->fd < 0) return;
+  int opt = 1;
+  setsockopt(bot->fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+  struct sockaddr_in addr = { 0 };
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(bot->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(bot->fd);
+    disconnects[BOT_FAILED] ++;
+    return;
+  }
+  bot->state = BOT_LOGIN;
+
+  // Handshake, with intent to log in
+  Packet p = { .length = 0 };
+  putVarInt(&p, PROTOCOL_VERSION);
+  putString(&p, "localhost");
+  putByte(&p, port >> 8);
+  putByte(&p, port & 255);
+  putVarInt(&p, 2);
+  sendPacket(bot, 0x00, &p);
+
+  // Login Start, with a UUID derived from the bot index
+  p.length = 0;
+  putString(&p, bot->name);
+  uint8_t uuid[16] = { 0x10, 0xAD };
+  memcpy(uuid + 12, &index, sizeof(int));
+  putBytes(&p, uuid, 16);
+  sendPacket(bot, 0x00, &p);
+
+}
+
+void enterPlayState (Bot *bot) {
+  int64_t now = now_us();
+  bot->state = BOT_PLAY;
+  bot->join_time = now - bot->connect_time;
+  bot->chunk_wait = now;
+  bot->center_ok = 1;
+  bot->next_turn = now;
+  bot->next_action = now + 2000000 + rand() % 3000000;
+  bot->next_chat = now + 5000000 + rand() % 10000000;
+  // Acknowledge configuration finish
+  Packet p = { .length = 0 };
+  sendPacket(bot, 0x03, &p);
+  // Player Loaded
+  sendPacket(bot, 0x2B, &p);
+}
+
+// Handles one received packet, given the first bytes of its body
+void handleBotPacket (Bot *bot, uint32_t id, const uint8_t *data, size_t length) {
+
+  Packet p = { .length = 0 };
+  bot->packets ++;
+
+  if (bot->state == BOT_LOGIN) {
+    if (id == 0x02) { // Login Success
+      sendPacket(bot, 0x03, &p); // Login Acknowledged
+      // Client Information
+      putString(&p, "en_us");
+      putByte(&p, 8); // View distance
+      putVarInt(&p, 0); // Chat mode
+      putByte(&p, 1); // Chat colors
+      putByte(&p, 0x7F); // Skin parts
+      putVarInt(&p, 1); // Main hand
+      putByte(&p, 0); // Text filtering
+      putByte(&p, 1); // Allow server listings
+      putVarInt(&p, 0); // Particle status
+      sendPacket(bot, 0x00, &p);
+      bot->state = BOT_CONFIGURATION;
+    } else if (id == 0x03) { // Set Compression
+      bot->compressed = 1;
+    } else if (id == 0x00) { // Login Disconnect
+      killBot(bot, BOT_KICKED);
+    }
+    return;
+  }
+
+  if (bot->state == BOT_CONFIGURATION) {
+    if (id == 0x0E) { // Known Packs, respond with no packs
+      putVarInt(&p, 0);
+      sendPacket(bot, 0x07, &p);
+    } else if (id == 0x03) { // Finish Configuration
+      enterPlayState(bot);
+    }
+    return;
+  }
+
+  switch (id) {
+    case 0x26: // Keep Alive, echo the ID back
+      if (length < 8) break;
+      putBytes(&p, data, 8);
+      sendPacket(bot, 0x1B, &p);
+      break;
+
+    case 0x27: // Chunk Data
+      bot->chunks ++;
+      // Only count chunks sent in response to our latest chunk crossing
+      if (bot->chunk_wait && bot->center_ok) {
+        if (chunk_latency_count < MAX_SAMPLES) {
+          chunk_latency[chunk_latency_count ++] = now_us() - bot->chunk_wait;
+        }
+        bot->chunk_wait = 0;
+      }
+      break;
+
+    case 0x41: { // Synchronize Player Position
+      uint32_t teleport_id;
+      int offset = getVarInt(data, length, &teleport_id);
+      if (offset <= 0 || length < (size_t)offset + 24) break;
+      bot->x = getDouble(data + offset);
+      bot->y = getDouble(data + offset + 8);
+      bot->z = getDouble(data + offset + 16);
+      bot->chunk_x = (int)floor(bot->x) >> 4;
+      bot->chunk_z = (int)floor(bot->z) >> 4;
+      putVarInt(&p, teleport_id);
+      sendPacket(bot, 0x00, &p); // Confirm Teleportation
+      break;
+    }
+
+    case 0x57: { // Set Center Chunk
+      uint32_t x, z;
+      int offset = getVarInt(data, length, &x);
+      if (offset <= 0 || getVarInt(data + offset, length - offset, &z) <= 0) break;
+      if ((int)x == bot->chunk_x && (int)z == bot->chunk_z) bot->center_ok = 1;
+      break;
+    }
+
+    case 0x1C: // Disconnect
+      killBot(bot, BOT_KICKED);
+      break;
+
+    default: break;
+  }
+
+}
+
+// Reads and parses all available data from the bot's socket
+void receiveBot (Bot *bot) {
+
+  // Compact the buffer if it's getting full
+  if (bot->buffer_end > RECV_BUFFER_SIZE / 2) {
+    memmove(bot->buffer, bot->buffer + bot->buffer_start, bot->buffer_end - bot->buffer_start);
+    bot->buffer_end -= bot->buffer_start;
+    bot->buffer_start = 0;
+  }
+
+  ssize_t n = recv(bot->fd, bot->buffer + bot->buffer_end, RECV_BUFFER_SIZE - bot->buffer_end, MSG_DONTWAIT);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    killBot(bot, BOT_CLOSED);
+    return;
+  }
+  if (n < 0) return;
+  bot->buffer_end += n;
+  bot->bytes += n;
+
+  while (bot->state != BOT_DEAD && bot->buffer_start < bot->buffer_end) {
+    uint8_t *start = bot->buffer + bot->buffer_start;
+    size_t available = bot->buffer_end - bot->buffer_start;
+
+    // Discard the remainder of a large packet
+    if (bot->skip) {
+      size_t amount = bot->skip < available ? bot->skip : available;
+      bot->skip -= amount;
+      bot->buffer_start += amount;
+      continue;
+    }
+
+    uint32_t length, id;
+    int length_size = getVarInt(start, available, &length);
+    if (length_size == 0) break;
+    if (length_size < 0) {
+      killBot(bot, BOT_FAILED);
+      return;
+    }
+    // Wait until we have the whole header
+    size_t header_size = bot->compressed ? COMPRESSED_HEADER_SIZE : HEADER_SIZE;
+    size_t header = length < header_size ? length : header_size;
+    if (available < length_size + header) break;
+
+    const uint8_t *body = start + length_size;
+    size_t body_length = header;
+
+    // Compressed packets start with their uncompressed size, or 0 if they
+    // weren't compressed after all. Only the start of the data is needed.
+    uint8_t inflated[HEADER_SIZE];
+    if (bot->compressed) {
+      uint32_t data_length;
+      int data_length_size = getVarInt(body, body_length, &data_length);
+      if (data_length_size <= 0) {
+        killBot(bot, BOT_FAILED);
+        return;
+      }
+      body += data_length_size;
+      body_length -= data_length_size;
+      if (data_length != 0) {
+        #ifdef ENABLE_COMPRESSION
+          ssize_t n = zlibDecompress(body, body_length, inflated, data_length < HEADER_SIZE ? data_length : HEADER_SIZE);
+        #else
+          ssize_t n = -1;
+        #endif
+        if (n <= 0) {
+          killBot(bot, BOT_FAILED);
+          return;
+        }
+        body = inflated;
+        body_length = n;
+      }
+    }
+
+    int id_size = getVarInt(body, body_length, &id);
+    if (id_size <= 0) {
+      killBot(bot, BOT_FAILED);
+      return;
+    }
+    handleBotPacket(bot, id, body + id_size, body_length - id_size);
+
+    bot->buffer_start += length_size + header;
+    bot->skip = length - header;
+  }
+
+}
+
+// Sends periodic movement, block interaction and chat packets
+void updateBot (Bot *bot, int64_t now) {
+
+  if (bot->state != BOT_PLAY) return;
+  Packet p = { .length = 0 };
+
+  // Pick a new random direction every few seconds
+  if (now >= bot->next_turn) {
+    double angle = (rand() % 360) * M_PI / 180.0;
+    bot->dx = cos(angle) * 0.2;
+    bot->dz = sin(angle) * 0.2;
+    bot->next_turn = now + 1000000 + rand() % 4000000;
+  }
+
+  // Walk at roughly vanilla walking speed, 20 updates per second
+  if (now - bot->last_move >= 50000) {
+    bot->last_move = now;
+    bot->x += bot->dx;
+    bot->z += bot->dz;
+    putDouble(&p, bot->x);
+    putDouble(&p, bot->y);
+    putDouble(&p, bot->z);
+    putByte(&p, 1); // On ground
+    sendPacket(bot, 0x1D, &p);
+    // Start timing chunk arrival when crossing into a new chunk
+    int chunk_x = (int)floor(bot->x) >> 4;
+    int chunk_z = (int)floor(bot->z) >> 4;
+    if (chunk_x != bot->chunk_x || chunk_z != bot->chunk_z) {
+      bot->chunk_x = chunk_x;
+      bot->chunk_z = chunk_z;
+      bot->chunk_wait = now;
+      bot->center_ok = 0;
+    }
+  }
+
+  // Mine the block under our feet, then place something back on top
+  if (now >= bot->next_action) {
+    int x = (int)floor(bot->x), y = (int)floor(bot->y) - 1, z = (int)floor(bot->z);
+    for (int action = 0; action <= 2; action += 2) {
+      p.length = 0;
+      putVarInt(&p, action); // Start/finish digging
+      putPosition(&p, x, y, z);
+      putByte(&p, 1); // Face (top)
+      putVarInt(&p, 0); // Sequence
+      sendPacket(bot, 0x28, &p);
+    }
+    p.length = 0;
+    putVarInt(&p, 0); // Main hand
+    putPosition(&p, x, y - 1, z);
+    putByte(&p, 1); // Face (top)
+    putBytes(&p, "\x3F\0\0\0\x3F\0\0\0\x3F\0\0\0", 12); // Cursor position
+    putByte(&p, 0); // Inside block
+    putByte(&p, 0); // World border hit
+    putVarInt(&p, 0); // Sequence
+    sendPacket(bot, 0x3F, &p);
+    bot->next_action = now + 2000000 + rand() % 3000000;
+  }
+
+  // Say something every now and then
+  if (now >= bot->next_chat) {
+    p.length = 0;
+    char message[64];
+    snprintf(message, sizeof(message), "hello from %s at %.0f, %.0f", bot->name, bot->x, bot->z);
+    putString(&p, message);
+    putUint64(&p, 0); // Timestamp
+    putUint64(&p, 0); // Salt
+    putByte(&p, 0); // No signature
+    putVarInt(&p, 0); // Message count
+    putBytes(&p, "\0\0\0\0", 4); // Acknowledged bitset and checksum
+    sendPacket(bot, 0x08, &p);
+    bot->next_chat = now + 5000000 + rand() % 10000000;
+  }
+
+}
+
+/* Reporting */
+
+int compareSamples (const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+void writeReport (FILE *out, double seconds) {
+
+  int joined = 0;
+  int64_t join_min = 0, join_max = 0, join_total = 0;
+  uint64_t bytes = 0, packets = 0, chunks = 0;
+
+  for (int i = 0; i < bot_count; i ++) {
+    Bot *bot = &bots[i];
+    bytes += bot->bytes;
+    packets += bot->packets;
+    chunks += bot->chunks;
+    if (!bot->join_time) continue;
+    if (joined == 0 || bot->join_time < join_min) join_min = bot->join_time;
+    if (bot->join_time > join_max) join_max = bot->join_time;
+    join_total += bot->join_time;
+    joined ++;
+  }
+
+  qsort(chunk_latency, chunk_latency_count, sizeof(int64_t), compareSamples);
+  int64_t latency_total = 0;
+  for (int i = 0; i < chunk_latency_count; i ++) latency_total += chunk_latency[i];
+
+  fprintf(out, "Bots: %d, joined: %d\n", bot_count, joined);
+  fprintf(out, "Disconnects: %u kicked, %u closed by the server, %u client-side errors\n",
+    disconnects[BOT_KICKED], disconnects[BOT_CLOSED], disconnects[BOT_FAILED]
+  );
+  fprintf(out, "Run time: %.1f s\n", seconds);
+  if (joined) {
+    fprintf(out, "Join time (ms): min %.1f, avg %.1f, max %.1f\n",
+      join_min / 1000.0, join_total / 1000.0 / joined, join_max / 1000.0
+    );
+  }
+  fprintf(out, "Chunks received: %llu (%.1f/s)\n", (unsigned long long)chunks, chunks / seconds);
+  if (chunk_latency_count) {
+    fprintf(out, "Chunk latency (ms): avg %.1f, p50 %.1f, p95 %.1f, max %.1f (%d samples)\n",
+      latency_total / 1000.0 / chunk_latency_count,
+      chunk_latency[chunk_latency_count / 2] / 1000.0,
+      chunk_latency[chunk_latency_count * 95 / 100] / 1000.0,
+      chunk_latency[chunk_latency_count - 1] / 1000.0,
+      chunk_latency_count
+    );
+  }
+  fprintf(out, "Received: %llu bytes (%.1f KiB/s), %llu packets (%.1f/s)\n",
+    (unsigned long long)bytes, bytes / 1024.0 / seconds,
+    (unsigned long long)packets, packets / seconds
+  );
+
+}
+
+int main (int argc, char **argv) {
+
+  int port = 25565, duration = 30, join_interval = 100;
+  char *report_path = NULL;
+
+  for (int i = 1; i < argc - 1; i += 2) {
+    if (!strcmp(argv[i], "-n")) bot_count = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-t")) duration = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-p")) port = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-j")) join_interval = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "-o")) report_path = argv[i + 1];
+    else {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (bot_count < 1 || bot_count > MAX_BOTS || duration < 1) {
+    fprintf(stderr, "Invalid arguments\n");
+    return 1;
+  }
+
+  srand(time(NULL));
+
+  int64_t start = now_us();
+  int64_t end = start + (int64_t)duration * 1000000;
+  int started = 0;
+  struct pollfd fds[MAX_BOTS];
+
+  while (now_us() < end) {
+    int64_t now = now_us();
+
+    // Stagger bot joins to avoid overflowing the server's listen backlog
+    while (started < bot_count && now >= start + (int64_t)started * join_interval * 1000) {
+      startBot(&bots[started], started, port);
+      started ++;
+    }
+
+    int count = 0;
+    for (int i = 0; i < started; i ++) {
+      if (bots[i].state == BOT_DEAD) continue;
+      fds[count].fd = bots[i].fd;
+      fds[count].events = POLLIN;
+      fds[count].revents = 0;
+      count ++;
+    }
+    poll(fds, count, 10);
+
+    count = 0;
+    for (int i = 0; i < started; i ++) {
+      Bot *bot = &bots[i];
+      if (bot->state == BOT_DEAD) continue;
+      if (fds[count ++].revents) receiveBot(bot);
+      updateBot(bot, now_us());
+    }
+  }
+
+  double seconds = (now_us() - start) / 1000000.0;
+
+  writeReport(stdout, seconds);
+  if (report_path) {
+    FILE *file = fopen(report_path, "w");
+    if (!file) {
+      perror("Failed to open report file");
+      return 1;
+    }
+    writeReport(file, seconds);
+    fclose(file);
+  }
+
+  for (int i = 0; i < started; i ++) {
+    if (bots[i].state != BOT_DEAD) close(bots[i].fd);
+  }
+
+  return 0;
+}
@@ -0,0 +1,194 @@
+/**
+ * Packet trace replay
+ *
+ * Plays back a trace recorded with DEV_RECORD_TRACE through the server's
+ * own handlePacket and handleServerTick, reproducing the original session
+ * without any network. Inbound packets are fed to recv_all through the
+ * memory source, and everything the server sends goes to the memory sink.
+ * The server's clock is driven from the trace, so that anything timed,
+ * such as Keep Alive round trips and timeouts, plays out as recorded.
+ * POSIX only. Build with `./build.sh --bench`.
+ *
+ * Like the server, this loads (or creates) "world.bin" in the working
+ * directory and writes changes back to it. Run replays in a scratch
+ * directory, with a copy of the world file the trace was recorded against.
+ *
+ * Usage: replay <trace file> [-r]
+ *   -r  Replay in real time, rather than as fast as possible
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "globals.h"
+#include "tools.h"
+#include "procedures.h"
+#include "serialize.h"
+#include "trace.h"
+
+// Defined in main.c
+void handlePacket (int client_fd, int length, int packet_id, int state);
+
+// Maps file descriptors from the trace to ones opened by the replay
+#define MAX_TRACE_FD 4096
+int fd_map[MAX_TRACE_FD];
+
+uint8_t payload[TRACE_MAX_PAYLOAD];
+uint8_t sink_buffer[1 << 16];
+
+// Reads the actual clock, as get_program_time is replaced by the trace's
+int64_t getWallTime () {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+}
+
+// Reads exactly `size` bytes from the trace, returns non-zero on failure
+int readTrace (FILE *file, void *out, size_t size) {
+  return fread(out, 1, size, file) != size;
+}
+
+int main (int argc, char **argv) {
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <trace file> [-r]\n", argv[0]);
+    return 1;
+  }
+  uint8_t realtime = argc > 2 && !strcmp(argv[2], "-r");
+
+  FILE *file = fopen(argv[1], "rb");
+  if (!file) {
+    perror("Failed to open trace file");
+    return 1;
+  }
+
+  char magic[4];
+  uint32_t version;
+  int64_t trace_start_time;
+  if (
+    readTrace(file, magic, 4) || memcmp(magic, TRACE_MAGIC, 4) != 0 ||
+    readTrace(file, &version, 4) || version != TRACE_VERSION ||
+    readTrace(file, &world_seed, 4) || readTrace(file, &rng_seed, 4) ||
+    readTrace(file, &trace_start_time, 8)
+  ) {
+    fprintf(stderr, "Not a valid trace file (version %d)\n", TRACE_VERSION);
+    return 1;
+  }
+
+  // Start the server's clock where the recording started
+  program_time_override = trace_start_time;
+
+  // Set up server state the same way main() does
+  // The seeds in the trace have already been hashed
+  for (int i = 0; i < MAX_BLOCK_CHANGES; i ++) block_changes[i].block = 0xFF;
+  for (int i = 0; i < MAX_MOBS; i ++) mob_slot[i] = 0xFFFF;
+  initConnections();
+  for (int i = 0; i < MAX_PLAYERS; i ++) {
+    player_data[i].client_fd = -1;
+  }
+  for (int i = 0; i < MAX_TRACE_FD; i ++) fd_map[i] = -1;
+  if (initSerializer()) return 1;
+
+  // Discard everything the server sends
+  memory_sink = sink_buffer;
+  memory_sink_size = sizeof(sink_buffer);
+  memory_sink_all = true;
+
+  uint32_t packets = 0, ticks = 0, connections = 0, state_mismatches = 0;
+  uint64_t bytes_sent = 0;
+  int64_t start = getWallTime();
+  uint8_t finished = false;
+
+  while (!finished) {
+
+    uint8_t type;
+    int64_t time;
+    int32_t trace_fd;
+    if (readTrace(file, &type, 1)) break;
+    if (readTrace(file, &time, 8) || readTrace(file, &trace_fd, 4)) {
+      fprintf(stderr, "Trace ended mid-event\n");
+      break;
+    }
+    if (type != TRACE_EVENT_TICK && (trace_fd < 0 || trace_fd >= MAX_TRACE_FD)) {
+      fprintf(stderr, "Invalid file descriptor %d in trace\n", trace_fd);
+      return 1;
+    }
+
+    // Wait until the original time of this event
+    if (realtime) {
+      int64_t delay = start + time - getWallTime();
+      if (delay > 0) usleep(delay);
+    }
+    program_time_override = trace_start_time + time;
+
+    memory_sink_length = 0;
+
+    switch (type) {
+
+      case TRACE_EVENT_CONNECT:
+        // Each client needs a real file descriptor to close later on
+        fd_map[trace_fd] = open("/dev/null", O_RDWR);
+        openConnection(fd_map[trace_fd]);
+        client_count ++;
+        connections ++;
+        break;
+
+      case TRACE_EVENT_DISCONNECT:
+        disconnectClient(&fd_map[trace_fd], 0);
+        break;
+
+      case TRACE_EVENT_TICK:
+        handleServerTick();
+        ticks ++;
+        break;
+
+      case TRACE_EVENT_PACKET: {
+        uint8_t state;
+        int32_t length, packet_id;
+        uint32_t size;
+        if (
+          readTrace(file, &state, 1) || readTrace(file, &length, 4) ||
+          readTrace(file, &packet_id, 4) || readTrace(file, &size, 4) ||
+          size > TRACE_MAX_PAYLOAD || readTrace(file, payload, size)
+        ) {
+          fprintf(stderr, "Trace ended mid-packet\n");
+          finished = true;
+          break;
+        }
+        int client_fd = fd_map[trace_fd];
+        if (client_fd == -1) break;
+        // The client state should match if the replay is deterministic
+        if (getClientState(client_fd) != state) state_mismatches ++;
+        memory_source = payload;
+        memory_source_length = size;
+        memory_source_offset = 0;
+        handlePacket(client_fd, length, packet_id, state);
+        memory_source = NULL;
+        packets ++;
+        break;
+      }
+
+      default:
+        fprintf(stderr, "Unknown event type %d in trace\n", type);
+        return 1;
+
+    }
+
+    bytes_sent += memory_sink_length;
+
+  }
+
+  double seconds = (getWallTime() - start) / 1000000.0;
+  printf("\nReplayed %u packets, %u ticks and %u connections in %.3f s\n", packets, ticks, connections, seconds);
+  printf("%.1f packets/s, %llu bytes sent by the server\n", packets / seconds, (unsigned long long)bytes_sent);
+  if (state_mismatches) {
+    printf("WARNING: %u packets arrived in a different client state than recorded\n", state_mismatches);
+  }
+
+  fclose(file);
+  return 0;
+}
@@ -25,9 +25,15 @@ esac
 # Default compiler
 compiler="gcc"
 
-# Handle arguments for windows 9x build
+# Whether to build benchmarks instead of the server
+bench=false
+
+# Handle arguments for windows 9x build and benchmarks
 for arg in "$@"; do
   case $arg in
+    --bench)
+      bench=true
+      ;;
     --9x)
       if [[ "$unameOut" == MINGW64_NT* ]]; then
         compiler="/opt/bin/i686-w64-mingw32-gcc"
@@ -40,6 +46,25 @@ for arg in "$@"; do
   esac
 done
 
+# Build benchmark tools without running anything
+# These link all server sources except for main.c, which holds main()
+if [ "$bench" = true ]; then
+  sources=$(ls src/*.c | grep -v "src/main.c")
+  rm -f "bench_worldgen$exe" "bench_varint$exe"
+  $compiler $sources bench/bench_worldgen.c -O3 -Iinclude -o "bench_worldgen$exe" $windows_linker
+  $compiler $sources bench/bench_varint.c -O3 -Iinclude -o "bench_varint$exe" $windows_linker
+  # The load generator and replay tool are POSIX-only
+  if [ -z "$exe" ]; then
+    rm -f loadgen replay
+    $compiler bench/loadgen.c src/compression.c -O3 -Iinclude -o loadgen -lm
+    # The replay tool calls into main.c, so rename its main() out of the way
+    $compiler -c src/main.c -O3 -Iinclude -Dmain=bareiron_server_main -o replay_main.o
+    $compiler $sources bench/replay.c replay_main.o -O3 -Iinclude -o replay
+    rm -f replay_main.o
+  fi
+  exit
+fi
+
 rm -f "bareiron$exe"
 $compiler src/*.c -O3 -Iinclude -o "bareiron$exe" $windows_linker
 "./bareiron$exe"
@@ -63,6 +63,107 @@ const blockWhitelist = [
   "copper_block"
 ];
 
+// Block properties, emitted as bit flags in the block_properties table.
+// Each entry lists the C macro of the flag and the blocks that have it.
+// Fluids are any level of water or lava, which are matched separately.
+const blockProperties = [
+  {
+    // Non-solid blocks, which players and mobs can move through
+    flag: "BLOCK_PASSABLE",
+    blocks: ["air", "snow", "moss_carpet", "short_grass", "dead_bush", "torch"],
+    fluids: true
+  },
+  {
+    // Blocks that can be placed over, as if they weren't there
+    flag: "BLOCK_REPLACEABLE",
+    blocks: ["air", "short_grass", "snow"],
+    fluids: true
+  },
+  {
+    // Blocks that have to have something beneath them
+    flag: "BLOCK_COLUMN",
+    blocks: ["snow", "moss_carpet", "cactus", "short_grass", "dead_bush", "sand", "torch", "oak_sapling"]
+  },
+  {
+    flag: "BLOCK_FLUID",
+    blocks: [],
+    fluids: true
+  },
+  {
+    // Blocks that emit light. These get left out of chunk data and sent
+    // as block updates instead, as that makes the client compute light.
+    flag: "BLOCK_LIGHT_SOURCE",
+    blocks: ["torch"]
+  },
+  {
+    // Blocks that drop nothing unless mined with a pickaxe
+    flag: "BLOCK_NEEDS_PICKAXE",
+    blocks: [
+      "stone", "cobblestone", "stone_slab", "cobblestone_slab", "sandstone",
+      "furnace", "coal_ore", "iron_ore", "iron_block", "gold_block",
+      "diamond_block", "redstone_block", "coal_block",
+      "gold_ore", "redstone_ore", "diamond_ore"
+    ]
+  },
+  {
+    // Blocks that drop nothing unless mined with an iron or better pickaxe
+    flag: "BLOCK_NEEDS_IRON_PICKAXE",
+    blocks: ["gold_ore", "redstone_ore", "diamond_ore"]
+  },
+  {
+    // Blocks that drop nothing unless mined with a shovel
+    flag: "BLOCK_NEEDS_SHOVEL",
+    blocks: ["snow"]
+  }
+];
+
+// Item properties, emitted as bit flags in the item_properties table
+const itemProperties = [
+  {
+    // Items that don't stack (tools and weapons)
+    flag: "ITEM_UNSTACKABLE",
+    items: [
+      "wooden_pickaxe", "stone_pickaxe", "iron_pickaxe", "golden_pickaxe", "diamond_pickaxe", "netherite_pickaxe",
+      "wooden_axe", "stone_axe", "iron_axe", "golden_axe", "diamond_axe", "netherite_axe",
+      "wooden_shovel", "stone_shovel", "iron_shovel", "golden_shovel", "diamond_shovel", "netherite_shovel",
+      "wooden_sword", "stone_sword", "iron_sword", "golden_sword", "diamond_sword", "netherite_sword",
+      "wooden_hoe", "stone_hoe", "iron_hoe", "golden_hoe", "diamond_hoe", "netherite_hoe",
+      "shears"
+    ]
+  },
+  {
+    // Items that stack up to 16
+    flag: "ITEM_STACKS_TO_16",
+    items: ["snowball"]
+  },
+  {
+    flag: "ITEM_PICKAXE",
+    items: ["wooden_pickaxe", "stone_pickaxe", "iron_pickaxe", "golden_pickaxe", "diamond_pickaxe", "netherite_pickaxe"]
+  },
+  {
+    // Pickaxes that can mine iron tier ores (golden ones included)
+    flag: "ITEM_IRON_PICKAXE",
+    items: ["iron_pickaxe", "golden_pickaxe", "diamond_pickaxe", "netherite_pickaxe"]
+  },
+  {
+    flag: "ITEM_SHOVEL",
+    items: ["wooden_shovel", "stone_shovel", "iron_shovel", "golden_shovel", "diamond_shovel", "netherite_shovel"]
+  },
+  // Compost chance tiers, see isCompostItem
+  {
+    flag: "ITEM_COMPOST_LOW",
+    items: ["oak_leaves", "short_grass", "wheat_seeds", "oak_sapling", "moss_carpet"]
+  },
+  {
+    flag: "ITEM_COMPOST_MEDIUM",
+    items: ["cactus", "sugar_cane"]
+  },
+  {
+    flag: "ITEM_COMPOST_HIGH",
+    items: ["apple", "lily_pad"]
+  }
+];
+
 // Currently, only 4 biome types are supported, excluding "beach"
 const biomes = [
   "plains",
@@ -170,6 +271,26 @@ async function extractItemsAndBlocks () {
 
 }
 
+// Builds a table of bit flags from a list of properties, one entry per
+// name in `names`. Throws if a property refers to an unknown name, so
+// that the table can't silently fall out of sync with the registries.
+function buildPropertyTable (names, properties, key) {
+  if (properties.length > 8) throw new Error("Too many properties for 8 bit flags");
+  const table = new Array(names.length).fill(0);
+  properties.forEach((property, i) => {
+    for (const name of property[key]) {
+      const index = names.indexOf(name);
+      if (index === -1) throw new Error(`Unknown name "${name}" in ${property.flag}`);
+      table[index] |= 1 << i;
+    }
+    if (!property.fluids) return;
+    names.forEach((name, index) => {
+      if (/^(water|lava)(_[0-9])?$/.test(name)) table[index] |= 1 << i;
+    });
+  });
+  return table;
+}
+
 // Write an integer as a VarInt
 function writeVarInt (value) {
   const bytes = [];
@@ -285,6 +406,32 @@ function serializeTags (tags) {
   return Buffer.concat([lengthBuf, fullData]);
 }
 
+// Serialize the "Known Packs" packet, listing just the vanilla core pack
+function serializeKnownPacks () {
+  const parts = [];
+
+  // Packet ID for Clientbound Known Packs
+  parts.push(Buffer.from([0x0E]));
+
+  // Pack count
+  parts.push(writeVarInt(1));
+
+  // Pack namespace, ID and version
+  for (const string of ["minecraft", "core", "1.21.8"]) {
+    const stringBuf = Buffer.from(string, "utf8");
+    parts.push(writeVarInt(stringBuf.length));
+    parts.push(stringBuf);
+  }
+
+  // Combine all parts
+  const fullData = Buffer.concat(parts);
+
+  // Prepend packet length
+  const lengthBuf = writeVarInt(fullData.length);
+
+  return Buffer.concat([lengthBuf, fullData]);
+}
+
 function toVarIntBuffer (array) {
   const parts = [];
   for (const num of array) {
@@ -405,19 +552,32 @@ async function convert () {
     }
   });
 
+  // The entire configuration phase, sent as one contiguous buffer:
+  // Known Packs, Registry Data, Update Tags and Finish Configuration
+  const configurationBuffer = Buffer.concat([
+    serializeKnownPacks(),
+    fullRegistryBuffer,
+    tagBuffer,
+    Buffer.from([0x01, 0x03])
+  ]);
+
   const networkBlockPalette = toVarIntBuffer(Object.values(itemsAndBlocks.palette));
 
+  // Item names indexed by their IDs
+  const itemNames = [];
+  for (const item in itemsAndBlocks.items) itemNames[itemsAndBlocks.items[item]] = item;
+
+  const blockPropertyTable = buildPropertyTable(Object.keys(itemsAndBlocks.palette), blockProperties, "blocks");
+  const itemPropertyTable = buildPropertyTable(itemNames, itemProperties, "items");
+
   const sourceCode = `\
 #include <stdint.h>
 #include "registries.h"
 
-// Binary contents of required "Registry Data" packets
-uint8_t registries_bin[] = {
-${toCArray(fullRegistryBuffer)}
-};
-// Binary contents of "Update Tags" packets
-uint8_t tags_bin[] = {
-${toCArray(tagBuffer)}
+// Binary contents of all configuration phase packets
+// Includes "Known Packs", "Registry Data", "Update Tags" and "Finish Configuration"
+uint8_t configuration_bin[] = {
+${toCArray(configurationBuffer)}
 };
 
 // Block palette
@@ -429,6 +589,10 @@ ${toCArray(networkBlockPalette)}
 
 // Block-to-item mapping
 uint16_t B_to_I[] = { ${itemsAndBlocks.mappingWithOverrides.join(", ")} };
+// Block property flags
+uint8_t block_properties[] = { ${blockPropertyTable.join(", ")} };
+// Item property flags
+uint8_t item_properties[] = { ${itemPropertyTable.join(", ")} };
 // Item-to-block mapping
 uint8_t I_to_B (uint16_t item) {
   switch (item) {
@@ -445,14 +609,21 @@ uint8_t I_to_B (uint16_t item) {
 
 #include <stdint.h>
 
-// Binary packet data (${fullRegistryBuffer.length + tagBuffer.length} bytes total)
-extern uint8_t registries_bin[${fullRegistryBuffer.length}];
-extern uint8_t tags_bin[${tagBuffer.length}];
+// Binary packet data for the configuration phase
+extern uint8_t configuration_bin[${configurationBuffer.length}];
 
 extern uint16_t block_palette[256]; // Block palette
 extern uint8_t network_block_palette[${networkBlockPalette.length}]; // Block palette as VarInt buffer
 extern uint16_t B_to_I[256]; // Block-to-item mapping
 uint8_t I_to_B (uint16_t item); // Item-to-block mapping
+extern uint8_t block_properties[256]; // Block property flags (BLOCK_*)
+extern uint8_t item_properties[${itemPropertyTable.length}]; // Item property flags (ITEM_*)
+
+// Block property flags
+${blockProperties.map((c, i) => `#define ${c.flag} 0x${(1 << i).toString(16).padStart(2, "0")}`).join("\n")}
+
+// Item property flags
+${itemProperties.map((c, i) => `#define ${c.flag} 0x${(1 << i).toString(16).padStart(2, "0")}`).join("\n")}
 
 // Block identifiers
 ${Object.keys(itemsAndBlocks.palette).map((c, i) => `#define B_${c} ${i}`).join("\n")}
@@ -0,0 +1,73 @@
+#ifndef H_COMPRESSION
+#define H_COMPRESSION
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "globals.h"
+
+#ifdef ENABLE_COMPRESSION
+
+// Largest packet that gets compressed, bigger ones are sent uncompressed
+#define COMPRESSION_BUFFER_SIZE (1 << 18)
+// Largest compressed packet accepted from clients, both before and after
+// decompression. Clients rarely send anything over the threshold at all.
+#define COMPRESSION_INBOUND_SIZE (1 << 15)
+// Size (in bits) of the hash table used to find repeated strings
+#define DEFLATE_HASH_BITS 13
+
+// State of a compression in progress
+typedef struct {
+  uint8_t *out;
+  size_t out_size, out_length;
+  uint32_t bits;
+  int bit_count;
+  uint8_t overflow;
+} Deflater;
+
+// Canonical Huffman code, as counts of codes per length and symbols
+// sorted by code
+typedef struct {
+  uint16_t counts[16];
+  uint16_t symbols[288];
+} HuffmanTable;
+
+// State of a decompression in progress
+typedef struct {
+  const uint8_t *in;
+  size_t in_length, in_offset;
+  uint32_t bits;
+  int bit_count;
+  uint8_t *out;
+  size_t out_size, out_length;
+  uint8_t error;
+  uint8_t full;
+} Inflater;
+
+// Room for one compressed chunk packet and its block update overlays.
+// Compressed chunks tend to take up 2-4 KiB, bigger ones are not cached.
+#define CHUNK_CACHE_ENTRY_SIZE 8192
+// Chunks get compressed into a buffer of this size before being copied
+// into their entry. Anything that doesn't fit here goes out uncached.
+#define CHUNK_CACHE_SCRATCH_SIZE COMPRESSION_BUFFER_SIZE
+
+// A chunk, ready to be sent to clients with compression enabled
+typedef struct {
+  short x;
+  short z;
+  // Matches chunk_cache_generation while the entry is valid
+  uint32_t generation;
+  uint16_t length; // 0 if unused
+  // Set if the chunk turned out too large for the entry, so that it
+  // doesn't get compressed just to find that out again
+  uint8_t uncacheable;
+  uint8_t data[CHUNK_CACHE_ENTRY_SIZE];
+} ChunkCacheEntry;
+
+uint32_t adler32Checksum (const uint8_t *data, size_t length);
+size_t zlibCompress (const uint8_t *in, size_t in_length, uint8_t *out, size_t out_size);
+ssize_t zlibDecompress (const uint8_t *in, size_t in_length, uint8_t *out, size_t out_size);
+
+#endif
+
+#endif
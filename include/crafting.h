@@ -3,6 +3,19 @@
 
 #include "globals.h"
 
+// Size of the hash table used to look up crafting recipes
+// Has to be larger than the amount of recipes, and at most 256
+#define CRAFTING_HASH_SIZE 256
+
+// A shaped crafting recipe, trimmed down to the smallest grid that fits
+typedef struct {
+  uint8_t width;
+  uint8_t height;
+  uint16_t output;
+  uint8_t count;
+  uint16_t items[9]; // Row-major, width * height entries, 0 if empty
+} CraftingRecipe;
+
 void getCraftingOutput (PlayerData *player, uint8_t *count, uint16_t *item);
 void getSmeltingOutput (PlayerData *player);
 
@@ -2,6 +2,7 @@
 #define H_GLOBALS
 
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
 #ifdef ESP_PLATFORM
@@ -32,14 +33,44 @@
 #define GAMEMODE 0
 
 // Max render distance, determines how many chunks to send
+// Clients that ask for a shorter render distance get what they asked for
 #define VIEW_DISTANCE 2
 
+// Calculated from VIEW_DISTANCE, width of the area of chunks in view
+#define CHUNK_VIEW_WIDTH (VIEW_DISTANCE * 2 + 1)
+
+// Render distance that players are limited to when the server is under
+// load, either from ticks running late or from a client's socket not
+// keeping up with what's being sent to it. The distance is reduced by
+// one chunk per tick under load, and grows back by one chunk once there
+// hasn't been any load for VIEW_DISTANCE_RECOVERY_TICKS ticks.
+#define MIN_VIEW_DISTANCE 1
+#define VIEW_DISTANCE_RECOVERY_TICKS 5
+
+// Amount of bytes that may be waiting in a client's socket at the start
+// of a tick before it's considered backed up (only measured on Linux)
+#define VIEW_DISTANCE_QUEUE_LIMIT 65536
+
 // Time between server ticks in microseconds (default = 1s)
 #define TIME_BETWEEN_TICKS 1000000
 
 // Calculated from TIME_BETWEEN_TICKS
 #define TICKS_PER_SECOND ((float)1000000 / TIME_BETWEEN_TICKS)
 
+// How many ticks the scheduler may run back-to-back to catch up after
+// falling behind (e.g. due to a slow disk write or a burst of packets).
+// Anything beyond this is dropped, so that a long stall doesn't result
+// in a flood of ticks that stalls the server even further.
+#define MAX_TICK_CATCHUP 4
+
+// Minimum time in microseconds between "Can't keep up!" warnings. Ticks
+// dropped in between are added up and reported with the next warning.
+#define TICK_DROP_REPORT_INTERVAL 5000000
+
+// Number of buckets in the tick duration histogram. Bucket N counts
+// ticks that took [2^(N-1), 2^N) microseconds to process.
+#define TICK_HISTOGRAM_BUCKETS 24
+
 // Initial world generation seed, will be hashed on startup
 // Used in generating terrain and biomes
 #define INITIAL_WORLD_SEED 0xA103DE6C
@@ -66,8 +97,8 @@
 #define BIOME_RADIUS (BIOME_SIZE / 2)
 
 // How many visited chunk coordinates to "remember"
-// The server will not re-send chunks that the player has recently been in
-// Must be at least 1, otherwise chunks will be sent on each position update
+// No longer used, as loaded chunks are now tracked exactly (see PlayerView)
+// Only kept so as to not change the world file layout
 #define VISITED_HISTORY 4
 
 // How many player-made block changes to allow
@@ -102,6 +133,99 @@
 // clients from Keep Alive packets.
 #define NETWORK_TIMEOUT_TIME 15000000
 
+// Time in microseconds after which a player that hasn't responded to any
+// Keep Alive packets is considered dead and gets disconnected.
+#define KEEPALIVE_TIMEOUT 15000000
+
+// Size of each client's outbound queue, which holds whatever its socket
+// won't take right away, so that the server never has to wait on a slow
+// client. Once more than OUTBOUND_HIGH_WATERMARK bytes are queued, the
+// client stops receiving packets that can be skipped (such as entity
+// movement) until the queue drains below OUTBOUND_LOW_WATERMARK. Chunks
+// are held back whenever anything is queued. Clients that stay over the
+// high watermark for OUTBOUND_CONGESTION_TIMEOUT microseconds, or that
+// stop accepting data for NETWORK_TIMEOUT_TIME, get disconnected.
+// Queues are allocated per connection while it's open. Chunks are streamed
+// separately and never pass through them, so they only need to hold a
+// burst of regular packets, such as the player list on join.
+#ifdef ESP_PLATFORM
+  #define OUTBOUND_QUEUE_SIZE 4096
+#else
+  #define OUTBOUND_QUEUE_SIZE 65536
+#endif
+#define OUTBOUND_HIGH_WATERMARK (OUTBOUND_QUEUE_SIZE / 2)
+#define OUTBOUND_LOW_WATERMARK (OUTBOUND_QUEUE_SIZE / 8)
+#define OUTBOUND_CONGESTION_TIMEOUT 15000000
+
+// How many connections the OS may queue up before the server gets to
+// accept them. All queued connections are accepted at once, so this only
+// needs to cover a burst of clients reconnecting, such as after a network
+// outage. The OS may cap this (e.g. at net.core.somaxconn on Linux).
+#define LISTEN_BACKLOG 128
+
+// Connections turned away for lack of a free slot are kept open until the
+// client closes its end, or for REJECT_LINGER_TIME microseconds, so that
+// the "Server is full" message isn't lost to a connection reset. Up to
+// REJECT_LINGER_COUNT of them are kept, any more get closed right away.
+#define REJECT_LINGER_COUNT 16
+#define REJECT_LINGER_TIME 2000000
+
+// If defined, the server sleeps until a client sends something or a tick
+// is due, instead of checking every client for data in a busy loop. Only
+// available on Linux, falls back to the busy loop if epoll can't be set up.
+#ifdef __linux__
+  #define ENABLE_EPOLL
+#endif
+
+// If defined, network I/O goes through io_uring on kernels that support
+// it (Linux 5.19 or newer), with epoll as the fallback. Connections are
+// taken from a multishot accept, client data is received into a shared
+// pool of buffers ahead of time, and queued output is sent in batches of
+// linked requests. The whole server then makes about one system call per
+// pass of the main loop, however many players are online. Building this
+// needs kernel headers from Linux 5.19 or newer, and ENABLE_EPOLL.
+#ifdef ENABLE_EPOLL
+  #define ENABLE_IO_URING
+#endif
+
+// Size of the buffers that io_uring receives client data into. Each
+// client may hold up to IO_URING_CLIENT_BUFFERS of them before the rest
+// of its data is left waiting in the socket.
+#define IO_URING_BUFFER_SIZE 2048
+#define IO_URING_CLIENT_BUFFERS 8
+// Amount of requests that can be prepared for io_uring at once
+#define IO_URING_QUEUE_SIZE 256
+
+// How many server list pings may be handled at once. These get connection
+// slots of their own, so that they can't take any away from players.
+#define STATUS_CONNECTIONS 4
+
+// How many server list pings each IP address may make in a burst, and the
+// time in microseconds it takes to earn back one ping. Pings over the
+// limit are dropped right after the handshake.
+#define STATUS_RATE_BURST 4
+#define STATUS_RATE_INTERVAL 1000000
+
+// How many online players to list when hovering over the player count
+#define STATUS_PLAYER_SAMPLE 12
+
+// If defined, enables protocol compression. Packets of at least
+// COMPRESSION_THRESHOLD bytes get deflated before sending, which shrinks
+// chunk data and registries several times over, at some CPU cost. Worth
+// it on slow links, but the buffers take up over 600 KiB of memory,
+// hence disabled by default when targeting ESP-IDF.
+#ifndef ESP_PLATFORM
+  #define ENABLE_COMPRESSION
+#endif
+
+// Size in bytes from which packets get compressed (vanilla uses 256)
+#define COMPRESSION_THRESHOLD 256
+
+// How many compressed chunks to keep around when compression is enabled.
+// Players in the same area get sent the same chunks, which then only
+// have to be generated and compressed once. Takes up 8 KiB per chunk.
+#define CHUNK_CACHE_SIZE 64
+
 // If defined, sends the server brand to clients. Doesn't do much, but will
 // show up in the top-left of the F3/debug menu, in the Minecraft client.
 // You can change the brand string in the "brand" variable in src/globals.c
@@ -121,6 +245,12 @@
 // on low tickrates, as that might drastically decrease the update rate.
 #define SCALE_MOVEMENT_UPDATES_TO_PLAYER_COUNT
 
+// How many queued up movement packets from one client can be skipped in
+// favor of the latest one before handling it (see skipSupersededMovement
+// in main.c). Limits the time spent on a client that floods us with
+// movement. Set to 0 to handle every movement packet in full.
+#define MAX_COALESCED_MOVEMENT 32
+
 // If defined, calculates fluid flow when blocks are updated near fluids
 // Somewhat computationally expensive and potentially unstable
 #define DO_FLUID_FLOW
@@ -159,6 +289,22 @@
 // Doesn't implement authentication, hence disabled by default.
 // #define DEV_ENABLE_BEEF_DUMPS
 
+// If defined, collects profiling counters (packet handling, chunk
+// generation, tick and disk timings, etc.), which are dumped to stdout
+// periodically and can be viewed in-game with the /stats command.
+// #define DEV_ENABLE_STATS
+
+// Interval in seconds between dumps of the above stats to stdout
+#define STATS_DUMP_INTERVAL 60
+
+// If defined, records all inbound packets, connections and ticks to a
+// trace file, which can be played back with the replay tool in bench/.
+// Traces contain everything players send, including chat messages.
+// #define DEV_RECORD_TRACE
+
+// Path of the trace file recorded with the above
+#define TRACE_FILE_PATH "trace.bin"
+
 #define STATE_NONE 0
 #define STATE_STATUS 1
 #define STATE_LOGIN 2
@@ -175,6 +321,11 @@ extern uint32_t rng_seed;
 extern uint16_t world_time;
 extern uint32_t server_ticks;
 
+// Tick scheduler accounting
+extern uint32_t tick_overruns; // Ticks which started a full period late
+extern uint32_t ticks_dropped; // Ticks skipped for exceeding MAX_TICK_CATCHUP
+extern uint32_t tick_histogram[TICK_HISTOGRAM_BUCKETS];
+
 extern char motd[];
 extern uint8_t motd_len;
 
@@ -185,6 +336,28 @@ extern uint8_t motd_len;
 
 extern uint16_t client_count;
 
+// Per-player connection health, indexed the same as player_data.
+// Kept out of PlayerData so as to not change the world file layout.
+extern uint16_t player_latency[MAX_PLAYERS]; // Rolling round-trip time in ms
+extern int64_t player_keepalive_time[MAX_PLAYERS]; // Time of last Keep Alive response
+
+// Per-player render distance and loaded chunks, indexed the same as
+// player_data
+typedef struct {
+  uint8_t requested; // From Client Information, capped at VIEW_DISTANCE
+  uint8_t current; // Distance in effect, lowered under load
+  uint8_t calm_ticks; // Ticks since the last sign of load
+  uint8_t chunks_held; // Whether chunks in view were held back, see updatePlayerChunks
+  // Chunk that the client's view is centered on
+  short center_x;
+  short center_z;
+  // Bitmap of chunks that the client holds. Chunk coordinates wrap around
+  // every CHUNK_VIEW_WIDTH chunks, which makes each chunk in view map to
+  // a different bit, without having to shift bits when the center moves.
+  uint8_t loaded_chunks[(CHUNK_VIEW_WIDTH * CHUNK_VIEW_WIDTH + 7) / 8];
+} PlayerView;
+extern PlayerView player_view[MAX_PLAYERS];
+
 typedef struct {
   short x;
   short z;
@@ -233,19 +406,6 @@ typedef struct {
   uint8_t flags;
 } PlayerData;
 
-typedef struct {
-  uint8_t type;
-  short x;
-  // When the mob is dead (health is 0), the Y coordinate acts
-  // as a timer for deleting and deallocating the mob
-  uint8_t y;
-  short z;
-  // Lower 5 bits: health
-  // Middle 1 bit: sheep sheared, unused for other mobs
-  // Upper 2 bits: panic timer
-  uint8_t data;
-} MobData;
-
 #pragma pack(pop)
 
 union EntityDataValue {
@@ -267,6 +427,48 @@ extern int block_changes_count;
 extern PlayerData player_data[MAX_PLAYERS];
 extern int player_data_count;
 
-extern MobData mob_data[MAX_MOBS];
+// Players with a connection are also listed in online_players, and those
+// of them that have finished loading in are listed in loaded_players.
+// Both lists are kept dense by swap-removal, so that loops over players
+// only touch the ones that are online, regardless of MAX_PLAYERS.
+extern PlayerData *online_players[MAX_PLAYERS];
+extern int online_player_count;
+extern PlayerData *loaded_players[MAX_PLAYERS];
+extern int loaded_player_count;
+
+// Loops over a list of players, declaring `player` for the loop body.
+// Swap-removal would make the loop skip a player whenever another one
+// leaves mid-loop, so this goes over a copy of the list taken up front,
+// passing over players that have since gone offline.
+#define FOR_EACH_PLAYER(player, list, count) \
+  for (PlayerData *player##_list[MAX_PLAYERS], \
+    **player##_entry = memcpy(player##_list, list, (count) * sizeof(PlayerData *)), \
+    **player##_end = player##_entry + (count), *player; \
+    player##_entry < player##_end && (player = *player##_entry); \
+    player##_entry ++) \
+    if (player->client_fd == -1) {} else
+#define FOR_EACH_ONLINE_PLAYER(player) FOR_EACH_PLAYER(player, online_players, online_player_count)
+#define FOR_EACH_LOADED_PLAYER(player) FOR_EACH_PLAYER(player, loaded_players, loaded_player_count)
+
+// Mob data is stored as a structure of arrays. Allocated mobs always
+// occupy slots [0, mob_count), and are kept dense by swap-removal, so
+// that loops over mobs only ever touch live entries. Since slots move
+// around, clients identify mobs by a stable ID (entity ID -2 - id),
+// which is mapped to and from slots using mob_slot and mob_id.
+extern uint8_t mob_type[MAX_MOBS];
+extern short mob_x[MAX_MOBS];
+// When the mob is dead (health is 0), the Y coordinate acts
+// as a timer for deleting and deallocating the mob
+extern uint8_t mob_y[MAX_MOBS];
+extern short mob_z[MAX_MOBS];
+// Lower 5 bits: health
+// Middle 1 bit: sheep sheared, unused for other mobs
+// Upper 2 bits: panic timer
+extern uint8_t mob_data[MAX_MOBS];
+// Stable ID of the mob in each slot
+extern uint16_t mob_id[MAX_MOBS];
+// Slot of the mob with each ID, 0xFFFF if the ID is unallocated
+extern uint16_t mob_slot[MAX_MOBS];
+extern int mob_count;
 
 #endif
@@ -0,0 +1,54 @@
+#ifndef H_NETPOLL
+#define H_NETPOLL
+
+#include "globals.h"
+
+#ifdef ENABLE_EPOLL
+  // The epoll instance watching the server socket and all clients
+  // Stays at -1 if epoll couldn't be set up, or if io_uring is used instead
+  extern int netpoll_fd;
+
+  void initNetPoll (int server_fd);
+  void watchConnection (int client_fd);
+  void unwatchConnection (int client_fd);
+  void watchConnectionOutput (int client_fd, uint8_t watch);
+  void watchNewInputOnly (int client_fd, uint8_t only_new);
+  uint8_t waitForActivity (int64_t deadline);
+
+  #define isNetPollActive() (netpoll_fd != -1 || isUringActive())
+#else
+  // Define no-op placeholders for when epoll is disabled
+  #define initNetPoll(a)
+  #define watchConnection(a)
+  #define unwatchConnection(a)
+  #define watchConnectionOutput(a, b)
+  #define watchNewInputOnly(a, b)
+  #define waitForActivity(a) false
+  #define isNetPollActive() false
+#endif
+
+#ifdef ENABLE_IO_URING
+  #include <netinet/in.h>
+  #include "tools.h"
+
+  // The io_uring instance doing all network I/O
+  // Stays at -1 if io_uring isn't available, in which case epoll is used
+  extern int uring_fd;
+
+  ssize_t recvInput (int client_fd, void *buf, size_t n, int flags);
+  uint8_t isPacketReceived (int client_fd);
+  void waitForInput ();
+  int acceptQueuedClient (struct sockaddr_in *client_addr);
+  void submitSend (Connection *connection, int part, const uint8_t *data, size_t length, uint8_t link);
+  void reserveSubmissions (int count);
+
+  #define isUringActive() (uring_fd != -1)
+#else
+  // Without io_uring, input is read straight from the socket
+  #define recvInput(a, b, c, d) recv(a, b, c, d)
+  #define isPacketReceived(a) true
+  #define waitForInput()
+  #define isUringActive() false
+#endif
+
+#endif
@@ -19,6 +19,9 @@ int cs_clickContainer (int client_fd);
 int cs_closeContainer (int client_fd);
 int cs_clientStatus (int client_fd);
 int cs_chat (int client_fd);
+#ifdef DEV_ENABLE_STATS
+  int cs_chatCommand (int client_fd);
+#endif
 int cs_interact (int client_fd);
 int cs_playerInput (int client_fd);
 int cs_playerCommand (int client_fd);
@@ -26,10 +29,10 @@ int cs_playerLoaded (int client_fd);
 
 // Clientbound packets
 int sc_statusResponse (int client_fd);
+int sc_loginDisconnect (int client_fd, const char *reason);
+int sc_setCompression (int client_fd);
 int sc_loginSuccess (int client_fd, uint8_t *uuid, char *name);
-int sc_knownPacks (int client_fd);
 int sc_sendPluginMessage (int client_fd, const char *channel, const uint8_t *data, size_t data_len);
-int sc_finishConfiguration (int client_fd);
 int sc_loginPlay (int client_fd);
 int sc_synchronizePlayerPosition (int client_fd, double x, double y, double z, float yaw, float pitch);
 int sc_setDefaultSpawnPosition (int client_fd, int64_t x, int64_t y, int64_t z);
@@ -37,8 +40,11 @@ int sc_startWaitingForChunks (int client_fd);
 int sc_playerAbilities (int client_fd, uint8_t flags);
 int sc_updateTime (int client_fd, uint64_t ticks);
 int sc_setCenterChunk (int client_fd, int x, int y);
+int sc_setRenderDistance (int client_fd, int distance);
+int sc_unloadChunk (int client_fd, int x, int z);
 int sc_chunkDataAndUpdateLight (int client_fd, int _x, int _z);
-int sc_keepAlive (int client_fd);
+int sc_keepAlive (int client_fd, uint64_t id);
+int cs_keepAlive (int client_fd);
 int sc_setContainerSlot (int client_fd, int window_id, uint16_t slot, uint8_t count, uint16_t item);
 int sc_setCursorItem (int client_fd, uint16_t item, uint8_t count);
 int sc_setHeldItem (int client_fd, uint8_t slot);
@@ -46,6 +52,7 @@ int sc_blockUpdate (int client_fd, int64_t x, int64_t y, int64_t z, uint8_t bloc
 int sc_openScreen (int client_fd, uint8_t window, const char *title, uint16_t length);
 int sc_acknowledgeBlockChange (int client_fd, int sequence);
 int sc_playerInfoUpdateAddPlayer (int client_fd, PlayerData player);
+int sc_playerInfoUpdateLatency (int client_fd);
 int sc_spawnEntity (int client_fd, int id, uint8_t *uuid, int type, double x, double y, double z, uint8_t yaw, uint8_t pitch);
 int sc_spawnEntityPlayer (int client_fd, PlayerData player);
 int sc_setEntityMetadata (int client_fd, int id, EntityData *metadata, size_t length);
@@ -60,6 +67,30 @@ int sc_systemChat (int client_fd, char* message, uint16_t len);
 int sc_entityEvent (int client_fd, int entity_id, uint8_t status);
 int sc_removeEntity (int client_fd, int entity_id);
 int sc_pickupItem (int client_fd, int collected, int collector, uint8_t count);
-int sc_registries (int client_fd);
+int sc_configuration (int client_fd);
+
+// Room for the cached Status Response, see sc_statusResponse
+#define STATUS_RESPONSE_SIZE 2048
+// Space left in front of the Status Response JSON for the packet header
+#define STATUS_HEADER_SIZE 8
+
+void invalidateStatusResponse ();
+
+// Amount of pieces that the Chunk Data packet is built in, see buildChunkPiece
+#define CHUNK_PIECE_COUNT 49
+
+extern uint8_t chunk_piece[];
+extern const size_t chunk_piece_size;
+size_t buildChunkPiece (uint8_t *buf, int piece, int _x, int _z, uint8_t framed);
+
+// Cache of compressed chunk packets
+#ifdef ENABLE_COMPRESSION
+  int sendCachedChunk (int client_fd, short x, short z);
+  void invalidateChunkCache (short x, short z);
+  void clearChunkCache ();
+#else
+  #define invalidateChunkCache(a, b)
+  #define clearChunkCache()
+#endif
 
 #endif
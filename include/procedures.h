@@ -5,11 +5,41 @@
 
 #include "globals.h"
 
-extern int client_states[MAX_PLAYERS * 2];
+// Describes a named task that runs periodically from the tick handler
+typedef struct {
+  char *name;
+  uint32_t interval; // Ticks between runs
+  uint32_t phase; // Offset into the interval at which the task runs
+  void (*run)();
+} PeriodicTask;
+
+// Converts an interval in seconds to ticks, rounding up to at least 1
+#define TASK_TICKS(seconds) ((uint32_t)((seconds) * TICKS_PER_SECOND) > 0 ? (uint32_t)((seconds) * TICKS_PER_SECOND) : 1)
+// Converts a fraction of a task's interval to a phase offset in ticks
+#define TASK_PHASE(seconds, fraction) ((uint32_t)(TASK_TICKS(seconds) * (fraction)))
+
+// Recent server list pings from one IP address, see admitConnection
+typedef struct {
+  uint32_t address;
+  int64_t refill_time; // Last time a ping was earned back, 0 if unused
+  uint8_t tokens; // Pings left
+} StatusRateLimit;
+
+// How many IP addresses to keep track of for rate limiting pings
+#define STATUS_RATE_LIMIT_ENTRIES (STATUS_CONNECTIONS * 4)
+
+// Position of a chunk relative to another
+typedef struct {
+  int8_t x;
+  int8_t z;
+} ChunkOffset;
+
+extern PeriodicTask periodic_tasks[];
+extern int periodic_task_count;
 
 void setClientState (int client_fd, int new_state);
 int getClientState (int client_fd);
-int getClientIndex (int client_fd);
+uint8_t admitConnection (int client_fd, int intent);
 
 void resetPlayerData (PlayerData *player);
 int reservePlayerData (int client_fd, uint8_t *uuid, char* name);
@@ -18,6 +48,13 @@ void handlePlayerDisconnect (int client_fd);
 void handlePlayerJoin (PlayerData* player);
 void disconnectClient (int *client_fd, int cause);
 int givePlayerItem (PlayerData *player, uint16_t item, uint8_t count);
+void resetViewDistance (int player_index);
+void buildChunkSendOrder ();
+uint8_t isChunkInView (int dx, int dz, int distance);
+int getLoadedChunkBit (short x, short z);
+int updatePlayerChunks (PlayerData *player, short _x, short _z);
+void resumePlayerChunks (int client_fd);
+void setPlayerViewDistance (PlayerData *player, uint8_t distance);
 void spawnPlayer (PlayerData *player);
 
 void broadcastPlayerMetadata (PlayerData *player);
@@ -44,11 +81,34 @@ void handlePlayerUseItem (PlayerData *player, short x, short y, short z, uint8_t
 
 void checkFluidUpdate (short x, uint8_t y, short z, uint8_t block);
 
+int getMobSlot (int entity_id);
+void freeMob (int slot);
 void spawnMob (uint8_t type, short x, uint8_t y, short z, uint8_t health);
 void interactEntity (int entity_id, int interactor_id);
 void hurtEntity (int entity_id, int attacker_id, uint8_t damage_type, uint8_t damage);
-void handleServerTick (int64_t time_since_last_tick);
+void tickPlayerTimers ();
+void tickKeepAlive ();
+void tickOutboundQueues ();
+void tickViewDistance ();
+void tickPlayerListLatency ();
+void tickEnvironmentDamage ();
+void tickHealing ();
+void tickDiskSync ();
+uint8_t isPassiveMob (int slot);
+PlayerData *getClosestPlayer (int slot, uint32_t *distance);
+void tickMobDeaths ();
+void tickMobPanic ();
+void tickSunBurn ();
+void moveMob (int i, short new_x, short new_z, uint8_t yaw, PlayerData *closest_player, uint32_t r);
+void tickPassiveMobs ();
+void tickHostileMobs ();
+void handleServerTick ();
+
+#ifdef DEV_ENABLE_STATS
+  void handleChatCommand (PlayerData *player, char *command);
+#endif
 
+uint8_t hasChestOpen (PlayerData *player, void *context);
 void broadcastChestUpdate (int origin_fd, uint8_t *storage_ptr, uint16_t item, uint8_t count, uint8_t slot);
 
 ssize_t writeEntityData (int client_fd, EntityData *data);
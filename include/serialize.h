@@ -8,13 +8,13 @@
   void writeBlockChangesToDisk (int from, int to);
   void writeChestChangesToDisk (uint8_t *storage_ptr, uint8_t slot);
   void writePlayerDataToDisk ();
-  void writeDataToDiskOnInterval ();
+  void writeDataToDisk ();
 #else
   // Define no-op placeholders for when disk syncing isn't enabled
   #define writeBlockChangesToDisk(a, b)
   #define writeChestChangesToDisk(a, b)
   #define writePlayerDataToDisk()
-  #define writeDataToDiskOnInterval()
+  #define writeDataToDisk()
   #define initSerializer() 0
 #endif
 
@@ -0,0 +1,55 @@
+#ifndef H_STATS
+#define H_STATS
+
+#include "globals.h"
+
+#ifdef DEV_ENABLE_STATS
+  typedef struct {
+    // Per-packet-ID handler counters, shared across connection states
+    // IDs above 127 aren't tracked
+    uint32_t packet_count[128];
+    int64_t packet_time[128];
+    // Chunk generation (and transmission) timings
+    uint32_t chunk_count;
+    int64_t chunk_time;
+    int64_t chunk_time_max;
+    // Number of entries scanned per getBlockChange call
+    uint32_t block_change_lookups;
+    uint64_t block_change_scanned;
+    uint32_t block_change_scan_max;
+    // Server tick durations
+    uint32_t tick_count;
+    int64_t tick_time;
+    int64_t tick_time_min;
+    int64_t tick_time_max;
+    // Disk/flash write latency
+    uint32_t disk_writes;
+    int64_t disk_time;
+    int64_t disk_time_max;
+    // Total bytes written to sockets
+    uint64_t bytes_sent;
+  } ServerStats;
+
+  extern ServerStats server_stats;
+
+  void statsRecordPacket (int packet_id, int64_t duration);
+  void statsRecordChunk (int64_t duration);
+  void statsRecordBlockChangeScan (uint32_t length);
+  void statsRecordTick (int64_t duration);
+  void statsRecordDiskWrite (int64_t duration);
+  #define statsRecordBytesSent(n) (server_stats.bytes_sent += (n))
+  long long statsAverage (int64_t total, uint64_t count);
+  int formatStatsLine (int line, char *output, size_t size);
+  void printStats ();
+  void sendStats (int client_fd);
+#else
+  // Define no-op placeholders for when stats are disabled
+  #define statsRecordPacket(a, b)
+  #define statsRecordChunk(a)
+  #define statsRecordBlockChangeScan(a)
+  #define statsRecordTick(a)
+  #define statsRecordDiskWrite(a)
+  #define statsRecordBytesSent(a)
+#endif
+
+#endif
@@ -15,6 +15,165 @@ static inline int div_floor (int a, int b) {
 extern uint64_t total_bytes_received;
 ssize_t recv_all (int client_fd, void *buf, size_t n, uint8_t require_first);
 ssize_t send_all (int client_fd, const void *buf, ssize_t len);
+ssize_t send_raw (int client_fd, const void *buf, ssize_t len);
+
+// Output that a client's socket hasn't accepted yet, sent over later
+// iterations of the main loop. Large static buffers (see queueOutput) are
+// referenced, and chunks (see queueChunk) are built one piece at a time,
+// once the socket has taken the previous piece. Anything else is copied
+// into a ring buffer, which always goes out last.
+typedef struct {
+  const uint8_t *data;
+  size_t remaining; // Bytes left of `data`, 0 if none
+  // Chunk being sent, which goes out after `data`
+  uint8_t chunk_active;
+  uint8_t chunk_framed; // See buildChunkPiece
+  uint8_t chunk_piece; // Piece being sent
+  uint8_t *chunk_buffer; // Holds that piece, allocated on first use
+  uint16_t chunk_piece_length; // Size of that piece, 0 until it's built
+  uint16_t chunk_piece_sent; // Bytes of that piece already sent
+  short chunk_x;
+  short chunk_z;
+  uint8_t *queue; // Ring buffer of OUTBOUND_QUEUE_SIZE bytes
+  size_t queue_start;
+  size_t queue_length;
+  uint8_t active; // Whether anything is queued at all
+  int64_t last_update_time; // When the socket last took any of this
+  // Set above OUTBOUND_HIGH_WATERMARK, cleared below the low watermark
+  uint8_t congested;
+  int64_t congested_since;
+} PendingOutput;
+
+// State of a client connection, from accept to disconnect
+typedef struct {
+  int client_fd; // -1 if the slot is unused
+  uint32_t address; // IPv4 address, in network byte order
+  int state;
+  PlayerData *player; // NULL until the client logs in
+  PendingOutput pending;
+  uint8_t bulk_depth; // Nesting of beginBulkOutput calls
+  uint8_t ready; // Whether epoll has reported anything to do, see netpoll.c
+  uint8_t closing; // Set once output has failed, see abortConnection
+  #ifdef ENABLE_EPOLL
+  uint32_t poll_events; // Watched for on top of EPOLLIN, see netpoll.c
+  #endif
+  #ifdef ENABLE_IO_URING
+  // Data received through io_uring that hasn't been read yet, kept as a
+  // list of buffers from the shared pool, see recvInput
+  uint16_t input_first, input_last;
+  uint16_t input_offset; // Bytes of the first buffer already read
+  uint8_t input_buffers; // Amount of buffers in the list
+  uint32_t input_length; // Unread bytes in total
+  uint8_t input_closed; // Set once receiving has stopped for good
+  int input_error; // Why it stopped, 0 if the client closed its end
+  uint8_t recv_armed; // Whether a receive request is underway
+  uint8_t sends_underway; // Send requests that haven't completed yet
+  #endif
+  #ifdef ENABLE_COMPRESSION
+  uint8_t compression; // Whether the client has been sent Set Compression
+  #endif
+} Connection;
+
+// Players and server list pings each get their own share of connections
+#define MAX_CONNECTIONS (MAX_PLAYERS + STATUS_CONNECTIONS)
+
+// Size of the hash table that maps file descriptors to connections
+// Kept well above MAX_CONNECTIONS, so that lookups rarely have to probe
+#define CONNECTION_LOOKUP_SIZE (MAX_CONNECTIONS * 4)
+
+extern Connection connections[MAX_CONNECTIONS];
+void initConnections ();
+Connection *openConnection (int client_fd);
+void closeConnection (int client_fd);
+Connection *getConnection (int client_fd);
+
+// Size of the buffer that small writes are collected in before sending
+#define OUTPUT_BUFFER_SIZE 4096
+
+ssize_t flushOutput ();
+void discardOutput (int client_fd);
+void beginBulkOutput (int client_fd);
+void endBulkOutput (int client_fd);
+
+extern int pending_output_count;
+void queueOutput (int client_fd, const uint8_t *buf, size_t len);
+uint8_t queueChunk (int client_fd, short x, short z, uint8_t framed);
+size_t getOutputRoom (int client_fd);
+int flushPendingOutput (int client_fd);
+void dropPendingOutput (int client_fd);
+void abortConnection (int client_fd);
+uint8_t isOutputQueued (int client_fd);
+uint8_t isOutputCongested (int client_fd);
+uint8_t isOutputStalled (Connection *connection, int64_t now);
+size_t getSendQueueDepth (int client_fd);
+
+#ifdef ENABLE_IO_URING
+  // Parts of a client's pending output that io_uring sends, in this order
+  #define OUTPUT_DATA 0 // Referenced data
+  #define OUTPUT_CHUNK 1 // Current chunk piece
+  #define OUTPUT_QUEUE 2 // Ring buffer
+
+  int submitPendingOutput (Connection *connection);
+  void completeOutput (Connection *connection, int part, int result);
+#endif
+
+#ifdef ENABLE_COMPRESSION
+  // State of the outgoing packet currently being reframed for compression
+  typedef struct {
+    uint8_t active; // false when between packets
+    int client_fd;
+    uint32_t length;
+    uint8_t in_header;
+    uint8_t header_shift;
+    uint32_t remaining;
+    uint8_t buffering;
+  } PacketFramer;
+
+  // Largest header of a packet in the compressed format (two VarInts)
+  #define FRAME_HEADER_SIZE 10
+
+  extern int compression_client_count;
+  extern uint8_t memory_sink_compressed;
+  uint8_t isCompressionEnabled (int client_fd);
+  void enableCompression (int client_fd);
+  void disableCompression (int client_fd);
+  void reframeToMemorySink (const uint8_t *data, size_t length);
+  int recvCompressed (int client_fd, int length, int data_length);
+#else
+  #define disableCompression(a)
+#endif
+
+// Writes to this file descriptor go to the memory sink instead of a socket.
+// Bytes that don't fit in the sink are counted, but otherwise dropped.
+#define MEMORY_SINK_FD -2
+extern uint8_t *memory_sink;
+extern size_t memory_sink_size;
+extern size_t memory_sink_length;
+// If set, writes to any file descriptor go to the memory sink
+extern uint8_t memory_sink_all;
+
+// Size of the buffer that broadcast packets are encoded into. Broadcasts
+// started while another is being sent out are stacked on top of it.
+#define BROADCAST_BUFFER_SIZE 4096
+
+// Which players a broadcast goes to, see endBroadcast
+#define BROADCAST_ONLINE 0 // Everyone, including players still loading in
+#define BROADCAST_LOADED 1 // Players that have finished loading in
+// Loaded players, except those whose clients are falling behind on what's
+// been sent to them. For packets that can be skipped, such as entity
+// movement, which the next update corrects anyway.
+#define BROADCAST_KEEPING_UP 2
+
+// Decides whether a player should receive a broadcast
+typedef uint8_t (*BroadcastFilter) (PlayerData *player, void *context);
+
+void beginBroadcast ();
+void endBroadcast (int exclude_fd, uint8_t recipients, BroadcastFilter filter, void *context);
+
+// If set, recv_all reads from this buffer instead of a socket
+extern uint8_t *memory_source;
+extern size_t memory_source_length;
+extern size_t memory_source_offset;
 
 ssize_t writeByte (int client_fd, uint8_t byte);
 ssize_t writeUint16 (int client_fd, uint16_t num);
@@ -41,6 +200,7 @@ uint64_t splitmix64 (uint64_t state);
   #include "esp_timer.h"
   #define get_program_time esp_timer_get_time
 #else
+  extern int64_t program_time_override;
   int64_t get_program_time ();
 #endif
 
@@ -0,0 +1,49 @@
+#ifndef H_TRACE
+#define H_TRACE
+
+#include "globals.h"
+
+/**
+ * Trace file format, all values in host byte order:
+ *
+ * Header: "BTRC" magic, uint32 version, uint32 world_seed, uint32 rng_seed,
+ * int64 server clock (get_program_time) at the start of the recording
+ *
+ * Followed by events, each starting with a uint8 type, an int64 timestamp
+ * (microseconds since the start of the recording), and an int32 client
+ * file descriptor (-1 for ticks). Packet events are followed by a uint8
+ * connection state, int32 length and int32 packet ID (as passed to
+ * handlePacket), and a uint32 payload size with the payload bytes.
+ */
+#define TRACE_MAGIC "BTRC"
+#define TRACE_VERSION 2
+
+#define TRACE_EVENT_PACKET 0
+#define TRACE_EVENT_CONNECT 1
+#define TRACE_EVENT_DISCONNECT 2
+#define TRACE_EVENT_TICK 3
+
+// Largest payload recorded per packet, anything past this is dropped
+#define TRACE_MAX_PAYLOAD 65536
+
+#ifdef DEV_RECORD_TRACE
+  int traceOpen ();
+  void traceEventHeader (uint8_t type, int32_t client_fd, int64_t time);
+  void traceConnect (int client_fd);
+  void traceDisconnect (int client_fd);
+  void traceTick ();
+  void tracePacketBegin (int client_fd, int length, int packet_id, int state);
+  void tracePacketEnd ();
+  void traceCapture (const void *data, size_t length);
+#else
+  // Define no-op placeholders for when recording is disabled
+  #define traceOpen() 0
+  #define traceConnect(a)
+  #define traceDisconnect(a)
+  #define traceTick()
+  #define tracePacketBegin(a, b, c, d)
+  #define tracePacketEnd()
+  #define traceCapture(a, b)
+#endif
+
+#endif
@@ -7,8 +7,17 @@
 #define CONTINUE_BIT 0x80
 #define VARNUM_ERROR 0xFFFFFFFF
 
+// Largest encoded sizes, for sizing buffers passed to encodeVarInt/Long
+#define VARINT_MAX_SIZE 5
+#define VARLONG_MAX_SIZE 10
+
 int32_t readVarInt (int client_fd);
+int32_t decodeVarInt (const uint8_t *buf, int length, int *offset);
+int64_t decodeVarLong (const uint8_t *buf, int length, int *offset);
 int sizeVarInt (uint32_t value);
+int sizeVarLong (uint64_t value);
+int encodeVarInt (uint8_t *buf, uint32_t value);
+int encodeVarLong (uint8_t *buf, uint64_t value);
 void writeVarInt (int client_fd, uint32_t value);
 
 #endif
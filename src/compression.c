@@ -0,0 +1,429 @@
+#include <string.h>
+
+#include "globals.h"
+
+#ifdef ENABLE_COMPRESSION
+
+#include "compression.h"
+
+/**
+ * A small, self-contained implementation of zlib streams (RFC 1950/1951).
+ *
+ * The compressor looks for repeated strings with a single-entry hash
+ * table and writes one block with the fixed Huffman codes. That's a far
+ * cry from what zlib itself can do, but chunk data is so repetitive that
+ * it still gets most of the benefit, at very little CPU and memory cost.
+ *
+ * The decompressor is complete, as the vanilla client uses zlib proper,
+ * including dynamic Huffman codes. It decodes one bit at a time, which
+ * is slow, but clients don't send much compressed data anyway.
+ */
+
+// Base values and extra bits for the length and distance codes
+uint16_t deflate_length_base[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+uint8_t deflate_length_extra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+uint16_t deflate_distance_base[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577
+};
+uint8_t deflate_distance_extra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Order in which code length code lengths are stored in dynamic blocks
+uint8_t inflate_code_length_order[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// Most recent position of each hashed 3-byte string. Positions are stored
+// offset by deflate_hash_base, which grows with every call, so that the
+// table doesn't have to be cleared between calls. Entries at or below the
+// base are left over from previous calls, and are treated as empty.
+uint32_t deflate_hash_table[1 << DEFLATE_HASH_BITS];
+uint32_t deflate_hash_base = 0;
+
+uint32_t adler32Checksum (const uint8_t *data, size_t length) {
+  uint32_t a = 1, b = 0;
+  while (length > 0) {
+    // 5552 is the most bytes we can sum before the modulo has to be
+    // applied to avoid overflowing
+    size_t n = length < 5552 ? length : 5552;
+    length -= n;
+    while (n --) {
+      a += *data ++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+/* Compression */
+
+// Writes the given amount of bits, least significant bit first
+void deflatePutBits (Deflater *d, uint32_t value, int count) {
+  d->bits |= value << d->bit_count;
+  d->bit_count += count;
+  while (d->bit_count >= 8) {
+    if (d->out_length < d->out_size) d->out[d->out_length ++] = d->bits;
+    else d->overflow = true;
+    d->bits >>= 8;
+    d->bit_count -= 8;
+  }
+}
+
+// Writes a Huffman code, which are stored most significant bit first
+void deflatePutCode (Deflater *d, uint32_t code, int length) {
+  uint32_t reversed = 0;
+  for (int i = 0; i < length; i ++) {
+    reversed = (reversed << 1) | (code & 1);
+    code >>= 1;
+  }
+  deflatePutBits(d, reversed, length);
+}
+
+// Writes a literal/length symbol using the fixed Huffman code
+void deflatePutSymbol (Deflater *d, int symbol) {
+  if (symbol < 144) deflatePutCode(d, 0x30 + symbol, 8);
+  else if (symbol < 256) deflatePutCode(d, 0x190 + symbol - 144, 9);
+  else if (symbol < 280) deflatePutCode(d, symbol - 256, 7);
+  else deflatePutCode(d, 0xC0 + symbol - 280, 8);
+}
+
+// Writes a back-reference of the given length and distance
+void deflatePutMatch (Deflater *d, int length, int distance) {
+  int i = 28;
+  while (deflate_length_base[i] > length) i --;
+  deflatePutSymbol(d, 257 + i);
+  deflatePutBits(d, length - deflate_length_base[i], deflate_length_extra[i]);
+  i = 29;
+  while (deflate_distance_base[i] > distance) i --;
+  deflatePutCode(d, i, 5);
+  deflatePutBits(d, distance - deflate_distance_base[i], deflate_distance_extra[i]);
+}
+
+uint32_t deflateHash (const uint8_t *data) {
+  uint32_t value = data[0] | (data[1] << 8) | (data[2] << 16);
+  return (value * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+// Compresses `in` into a zlib stream in `out`
+// Returns the compressed size, or 0 if it doesn't fit in `out_size` bytes
+size_t zlibCompress (const uint8_t *in, size_t in_length, uint8_t *out, size_t out_size) {
+
+  // Reserve this call's range of hash table positions, and clear the
+  // table only once the positions are about to overflow
+  if (deflate_hash_base > UINT32_MAX - in_length - 1) {
+    memset(deflate_hash_table, 0, sizeof(deflate_hash_table));
+    deflate_hash_base = 0;
+  }
+  uint32_t base = deflate_hash_base + 1;
+  deflate_hash_base += in_length + 1;
+
+  Deflater d = { .out = out, .out_size = out_size };
+
+  // zlib header: deflate with a 32 KiB window, fastest compression
+  deflatePutBits(&d, 0x78, 8);
+  deflatePutBits(&d, 0x01, 8);
+  // One final block, compressed with fixed Huffman codes
+  deflatePutBits(&d, 1, 1);
+  deflatePutBits(&d, 1, 2);
+
+  size_t i = 0;
+  while (i < in_length) {
+
+    // Look for an earlier occurrence of the next 3 bytes
+    size_t length = 0, distance = 0;
+    if (i + 2 < in_length) {
+      uint32_t hash = deflateHash(in + i);
+      uint32_t entry = deflate_hash_table[hash];
+      deflate_hash_table[hash] = base + i;
+      if (entry >= base && i - (entry - base) <= 32768) {
+        size_t candidate = entry - base;
+        size_t max_length = in_length - i < 258 ? in_length - i : 258;
+        while (length < max_length && in[candidate + length] == in[i + length]) length ++;
+        distance = i - candidate;
+      }
+    }
+
+    if (length >= 3) {
+      deflatePutMatch(&d, length, distance);
+      // Hash the strings within the match too, for the sake of later matches
+      for (size_t j = i + 1; j < i + length && j + 2 < in_length; j ++) {
+        deflate_hash_table[deflateHash(in + j)] = base + j;
+      }
+      i += length;
+    } else {
+      deflatePutSymbol(&d, in[i]);
+      i ++;
+    }
+
+    if (d.overflow) return 0;
+  }
+
+  // End of block, then pad to a full byte
+  deflatePutSymbol(&d, 256);
+  if (d.bit_count > 0) deflatePutBits(&d, 0, 8 - d.bit_count);
+
+  // zlib trailer: big-endian Adler-32 of the uncompressed data
+  uint32_t checksum = adler32Checksum(in, in_length);
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    deflatePutBits(&d, (checksum >> shift) & 255, 8);
+  }
+
+  if (d.overflow) return 0;
+  return d.out_length;
+
+}
+
+/* Decompression */
+
+// Reads the given amount of bits, least significant bit first
+uint32_t inflateGetBits (Inflater *s, int count) {
+  while (s->bit_count < count) {
+    if (s->in_offset == s->in_length) {
+      s->error = true;
+      return 0;
+    }
+    s->bits |= (uint32_t)s->in[s->in_offset ++] << s->bit_count;
+    s->bit_count += 8;
+  }
+  uint32_t value = s->bits & ((1u << count) - 1);
+  s->bits >>= count;
+  s->bit_count -= count;
+  return value;
+}
+
+// Builds a Huffman table from a list of code lengths
+// Returns non-zero if the lengths don't describe a valid code
+int inflateBuildTable (HuffmanTable *h, const uint8_t *lengths, int count) {
+
+  memset(h->counts, 0, sizeof(h->counts));
+  for (int i = 0; i < count; i ++) h->counts[lengths[i]] ++;
+  h->counts[0] = 0;
+
+  // Reject codes with more codes of some length than there's room for
+  int left = 1;
+  for (int i = 1; i < 16; i ++) {
+    left = (left << 1) - h->counts[i];
+    if (left < 0) return 1;
+  }
+
+  // Sort symbols by code length, then by value
+  uint16_t offsets[16];
+  offsets[1] = 0;
+  for (int i = 1; i < 15; i ++) offsets[i + 1] = offsets[i] + h->counts[i];
+  for (int i = 0; i < count; i ++) {
+    if (lengths[i] != 0) h->symbols[offsets[lengths[i]] ++] = i;
+  }
+
+  return 0;
+}
+
+// Decodes one symbol, reading the code one bit at a time
+int inflateDecodeSymbol (Inflater *s, HuffmanTable *h) {
+  int code = 0, first = 0, index = 0;
+  for (int length = 1; length < 16; length ++) {
+    code |= inflateGetBits(s, 1);
+    int count = h->counts[length];
+    if (code - count < first) return h->symbols[index + (code - first)];
+    index += count;
+    first = (first + count) << 1;
+    code <<= 1;
+  }
+  s->error = true;
+  return -1;
+}
+
+// Decodes the contents of a Huffman-compressed block
+void inflateBlock (Inflater *s, HuffmanTable *literals, HuffmanTable *distances) {
+  while (!s->error) {
+
+    int symbol = inflateDecodeSymbol(s, literals);
+    if (s->error || symbol == 256) return;
+
+    if (symbol < 256) {
+      if (s->out_length == s->out_size) {
+        s->full = true;
+        return;
+      }
+      s->out[s->out_length ++] = symbol;
+      continue;
+    }
+
+    symbol -= 257;
+    if (symbol >= 29) break;
+    int length = deflate_length_base[symbol] + inflateGetBits(s, deflate_length_extra[symbol]);
+
+    symbol = inflateDecodeSymbol(s, distances);
+    if (symbol < 0 || symbol >= 30) break;
+    size_t distance = deflate_distance_base[symbol] + inflateGetBits(s, deflate_distance_extra[symbol]);
+    if (s->error || distance > s->out_length) break;
+
+    while (length --) {
+      if (s->out_length == s->out_size) {
+        s->full = true;
+        return;
+      }
+      s->out[s->out_length] = s->out[s->out_length - distance];
+      s->out_length ++;
+    }
+
+  }
+  s->error = true;
+}
+
+// Copies the contents of an uncompressed block
+void inflateStored (Inflater *s) {
+  // Stored blocks start on a byte boundary
+  s->bits = 0;
+  s->bit_count = 0;
+  if (s->in_length - s->in_offset < 4) {
+    s->error = true;
+    return;
+  }
+  const uint8_t *header = s->in + s->in_offset;
+  size_t length = header[0] | (header[1] << 8);
+  size_t length_complement = header[2] | (header[3] << 8);
+  s->in_offset += 4;
+  if (length != (~length_complement & 0xFFFF) || length > s->in_length - s->in_offset) {
+    s->error = true;
+    return;
+  }
+  if (length > s->out_size - s->out_length) {
+    length = s->out_size - s->out_length;
+    s->full = true;
+  }
+  memcpy(s->out + s->out_length, s->in + s->in_offset, length);
+  s->out_length += length;
+  s->in_offset += length;
+}
+
+// Builds the fixed Huffman tables
+void inflateFixedTables (HuffmanTable *literals, HuffmanTable *distances) {
+  uint8_t lengths[288];
+  memset(lengths, 8, 144);
+  memset(lengths + 144, 9, 112);
+  memset(lengths + 256, 7, 24);
+  memset(lengths + 280, 8, 8);
+  inflateBuildTable(literals, lengths, 288);
+  memset(lengths, 5, 30);
+  inflateBuildTable(distances, lengths, 30);
+}
+
+// Reads the Huffman tables at the start of a dynamic block
+void inflateDynamicTables (Inflater *s, HuffmanTable *literals, HuffmanTable *distances) {
+
+  int literal_count = inflateGetBits(s, 5) + 257;
+  int distance_count = inflateGetBits(s, 5) + 1;
+  int code_length_count = inflateGetBits(s, 4) + 4;
+  if (s->error || literal_count > 286 || distance_count > 30) {
+    s->error = true;
+    return;
+  }
+
+  // The code lengths are themselves Huffman-coded
+  uint8_t lengths[286 + 30];
+  memset(lengths, 0, 19);
+  for (int i = 0; i < code_length_count; i ++) {
+    lengths[inflate_code_length_order[i]] = inflateGetBits(s, 3);
+  }
+  HuffmanTable code_lengths;
+  if (s->error || inflateBuildTable(&code_lengths, lengths, 19)) {
+    s->error = true;
+    return;
+  }
+
+  int total = literal_count + distance_count;
+  int index = 0;
+  while (index < total) {
+    int symbol = inflateDecodeSymbol(s, &code_lengths);
+    if (s->error) return;
+    if (symbol < 16) {
+      lengths[index ++] = symbol;
+      continue;
+    }
+    // Symbols 16 to 18 repeat the previous length, or zeros
+    uint8_t value = 0;
+    int repeat;
+    if (symbol == 16) {
+      if (index == 0) {
+        s->error = true;
+        return;
+      }
+      value = lengths[index - 1];
+      repeat = 3 + inflateGetBits(s, 2);
+    } else if (symbol == 17) {
+      repeat = 3 + inflateGetBits(s, 3);
+    } else {
+      repeat = 11 + inflateGetBits(s, 7);
+    }
+    if (index + repeat > total) {
+      s->error = true;
+      return;
+    }
+    while (repeat --) lengths[index ++] = value;
+  }
+
+  // The end of block code has to be present
+  if (
+    lengths[256] == 0 ||
+    inflateBuildTable(literals, lengths, literal_count) ||
+    inflateBuildTable(distances, lengths + literal_count, distance_count)
+  ) s->error = true;
+
+}
+
+// Decompresses a zlib stream from `in` into `out`. Stops early if `out`
+// fills up, in which case the rest of the stream isn't validated.
+// Returns the decompressed size, or -1 if the stream is invalid.
+ssize_t zlibDecompress (const uint8_t *in, size_t in_length, uint8_t *out, size_t out_size) {
+
+  // zlib header: deflate compression, no preset dictionary
+  if (in_length < 2) return -1;
+  if ((in[0] & 0x0F) != 8 || ((in[0] << 8) | in[1]) % 31 != 0 || (in[1] & 0x20)) return -1;
+
+  Inflater s = {
+    .in = in, .in_length = in_length, .in_offset = 2,
+    .out = out, .out_size = out_size
+  };
+  HuffmanTable literals, distances;
+
+  uint8_t final;
+  do {
+    final = inflateGetBits(&s, 1);
+    uint8_t type = inflateGetBits(&s, 2);
+    if (s.error) return -1;
+    if (type == 0) {
+      inflateStored(&s);
+    } else if (type == 1) {
+      inflateFixedTables(&literals, &distances);
+      inflateBlock(&s, &literals, &distances);
+    } else if (type == 2) {
+      inflateDynamicTables(&s, &literals, &distances);
+      if (!s.error) inflateBlock(&s, &literals, &distances);
+    } else return -1;
+    if (s.error) return -1;
+    if (s.full) return s.out_length;
+  } while (!final);
+
+  // zlib trailer: the leftover bits are padding, then the checksum
+  if (s.in_length - s.in_offset < 4) return -1;
+  const uint8_t *trailer = s.in + s.in_offset;
+  uint32_t checksum = ((uint32_t)trailer[0] << 24) | (trailer[1] << 16) | (trailer[2] << 8) | trailer[3];
+  if (checksum != adler32Checksum(out, s.out_length)) return -1;
+
+  return s.out_length;
+
+}
+
+#endif
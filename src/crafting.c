@@ -6,336 +6,153 @@
 #include "tools.h"
 #include "crafting.h"
 
-void getCraftingOutput (PlayerData *player, uint8_t *count, uint16_t *item) {
+// Shorthands for writing out recipe shapes below
+#define _ 0
+#define S I_stick
+#define RECIPE(width, height, output, count, ...) \
+  { width, height, output, count, { __VA_ARGS__ } }
+
+// Tools, in all supported materials
+#define TOOL_RECIPES(X, tier) \
+  RECIPE(3, 3, I_##tier##_pickaxe, 1, X, X, X, _, S, _, _, S, _), \
+  RECIPE(2, 3, I_##tier##_axe, 1, X, X, X, S, _, S), \
+  RECIPE(2, 3, I_##tier##_axe, 1, X, X, S, X, S, _), \
+  RECIPE(1, 3, I_##tier##_shovel, 1, X, S, S), \
+  RECIPE(1, 3, I_##tier##_sword, 1, X, X, S)
+
+// Armor, in all supported materials
+#define ARMOR_RECIPES(X, tier) \
+  RECIPE(3, 2, I_##tier##_helmet, 1, X, X, X, X, _, X), \
+  RECIPE(3, 3, I_##tier##_chestplate, 1, X, _, X, X, X, X, X, X, X), \
+  RECIPE(3, 3, I_##tier##_leggings, 1, X, X, X, X, _, X, X, _, X), \
+  RECIPE(3, 2, I_##tier##_boots, 1, X, _, X, X, _, X)
+
+// Single item, crafted into many of another
+#define UNPACK_RECIPE(input, output, count) RECIPE(1, 1, output, count, input)
+// 3x3 of one item, crafted into one block
+#define PACK_RECIPE(X, output) RECIPE(3, 3, output, 1, X, X, X, X, X, X, X, X, X)
+
+// All crafting recipes, with shapes trimmed down to the filled area.
+// Recipes match anywhere in the grid, as long as the shape fits.
+const CraftingRecipe crafting_recipes[] = {
+  UNPACK_RECIPE(I_oak_log, I_oak_planks, 4),
+  UNPACK_RECIPE(I_oak_planks, I_oak_button, 1),
+  UNPACK_RECIPE(I_iron_block, I_iron_ingot, 9),
+  UNPACK_RECIPE(I_gold_block, I_gold_ingot, 9),
+  UNPACK_RECIPE(I_diamond_block, I_diamond, 9),
+  UNPACK_RECIPE(I_redstone_block, I_redstone, 9),
+  UNPACK_RECIPE(I_coal_block, I_coal, 9),
+  UNPACK_RECIPE(I_copper_block, I_copper_ingot, 9),
+
+  PACK_RECIPE(I_iron_ingot, I_iron_block),
+  PACK_RECIPE(I_gold_ingot, I_gold_block),
+  PACK_RECIPE(I_diamond, I_diamond_block),
+  PACK_RECIPE(I_redstone, I_redstone_block),
+  PACK_RECIPE(I_coal, I_coal_block),
+  PACK_RECIPE(I_copper_ingot, I_copper_block),
+
+  RECIPE(2, 1, I_oak_pressure_plate, 1, I_oak_planks, I_oak_planks),
+  RECIPE(1, 2, I_stick, 4, I_oak_planks, I_oak_planks),
+  RECIPE(1, 2, I_torch, 4, I_coal, S),
+  RECIPE(1, 2, I_torch, 4, I_charcoal, S),
+  RECIPE(2, 2, I_shears, 1, I_iron_ingot, _, _, I_iron_ingot),
+  RECIPE(2, 2, I_shears, 1, _, I_iron_ingot, I_iron_ingot, _),
+
+  RECIPE(3, 1, I_oak_slab, 6, I_oak_planks, I_oak_planks, I_oak_planks),
+  RECIPE(3, 1, I_cobblestone_slab, 6, I_cobblestone, I_cobblestone, I_cobblestone),
+  RECIPE(3, 1, I_stone_slab, 6, I_stone, I_stone, I_stone),
+  RECIPE(3, 1, I_snow, 6, I_snow_block, I_snow_block, I_snow_block),
+
+  RECIPE(2, 2, I_crafting_table, 1, I_oak_planks, I_oak_planks, I_oak_planks, I_oak_planks),
+  RECIPE(2, 2, I_oak_wood, 3, I_oak_log, I_oak_log, I_oak_log, I_oak_log),
+  RECIPE(2, 2, I_snow_block, 3, I_snowball, I_snowball, I_snowball, I_snowball),
+
+  RECIPE(3, 3, I_furnace, 1, I_cobblestone, I_cobblestone, I_cobblestone, I_cobblestone, _, I_cobblestone, I_cobblestone, I_cobblestone, I_cobblestone),
+  #ifdef ALLOW_CHESTS
+  RECIPE(3, 3, I_chest, 1, I_oak_planks, I_oak_planks, I_oak_planks, I_oak_planks, _, I_oak_planks, I_oak_planks, I_oak_planks, I_oak_planks),
+  #endif
+  RECIPE(3, 3, I_composter, 1, I_oak_slab, _, I_oak_slab, I_oak_slab, _, I_oak_slab, I_oak_slab, I_oak_slab, I_oak_slab),
+
+  TOOL_RECIPES(I_oak_planks, wooden),
+  TOOL_RECIPES(I_cobblestone, stone),
+  TOOL_RECIPES(I_iron_ingot, iron),
+  TOOL_RECIPES(I_gold_ingot, golden),
+  TOOL_RECIPES(I_diamond, diamond),
+  TOOL_RECIPES(I_netherite_ingot, netherite),
+
+  ARMOR_RECIPES(I_leather, leather),
+  ARMOR_RECIPES(I_iron_ingot, iron),
+  ARMOR_RECIPES(I_gold_ingot, golden),
+  ARMOR_RECIPES(I_diamond, diamond),
+  ARMOR_RECIPES(I_netherite_ingot, netherite)
+};
+#define CRAFTING_RECIPE_COUNT (sizeof(crafting_recipes) / sizeof(CraftingRecipe))
+
+#undef _
+#undef S
+
+// Hash table of indices into crafting_recipes (offset by 1, 0 is empty)
+uint8_t crafting_hash_table[CRAFTING_HASH_SIZE];
+uint8_t crafting_hash_table_ready = false;
+
+// Hashes a trimmed crafting grid
+uint32_t hashCraftingGrid (uint8_t width, uint8_t height, const uint16_t *items) {
+  uint32_t hash = 2166136261u ^ (width | height << 4);
+  for (int i = 0; i < width * height; i ++) {
+    hash = (hash ^ items[i]) * 16777619u;
+  }
+  return hash ^ (hash >> 16);
+}
 
-  uint8_t i, filled = 0, first = 10, identical = true;
-  for (i = 0; i < 9; i ++) {
-    if (player->craft_items[i]) {
-      filled ++;
-      if (first == 10) first = i;
-      else if (player->craft_items[i] != player->craft_items[first]) {
-        identical = false;
-      }
-    }
+// Fills crafting_hash_table, done once on first use
+void buildCraftingHashTable () {
+  for (uint8_t i = 0; i < CRAFTING_RECIPE_COUNT; i ++) {
+    const CraftingRecipe *recipe = &crafting_recipes[i];
+    uint32_t slot = hashCraftingGrid(recipe->width, recipe->height, recipe->items);
+    while (crafting_hash_table[slot % CRAFTING_HASH_SIZE] != 0) slot ++;
+    crafting_hash_table[slot % CRAFTING_HASH_SIZE] = i + 1;
   }
+  crafting_hash_table_ready = true;
+}
+
+void getCraftingOutput (PlayerData *player, uint8_t *count, uint16_t *item) {
 
-  uint16_t first_item = player->craft_items[first];
-  uint8_t first_col = first % 3, first_row = first / 3;
-
-  switch (filled) {
-
-    case 0:
-      *item = 0;
-      *count = 0;
-      return;
-
-    case 1:
-      switch (first_item) {
-        case I_oak_log: *item = I_oak_planks; *count = 4; return;
-        case I_oak_planks: *item = I_oak_button; *count = 1; return;
-        case I_iron_block: *item = I_iron_ingot; *count = 9; return;
-        case I_gold_block: *item = I_gold_ingot; *count = 9; return;
-        case I_diamond_block: *item = I_diamond; *count = 9; return;
-        case I_redstone_block: *item = I_redstone; *count = 9; return;
-        case I_coal_block: *item = I_coal; *count = 9; return;
-        case I_copper_block: *item = I_copper_ingot; *count = 9; return;
-
-        default: break;
-      }
-      break;
-
-    case 2:
-      switch (first_item) {
-        case I_oak_planks:
-          if (first_col != 2 && player->craft_items[first + 1] == I_oak_planks) {
-            *item = I_oak_pressure_plate;
-            *count = 1;
-            return;
-          } else if (first_row != 2 && player->craft_items[first + 3] == I_oak_planks) {
-            *item = I_stick;
-            *count = 4;
-            return;
-          }
-          break;
-        case I_charcoal:
-        case I_coal:
-          if (first_row != 2 && player->craft_items[first + 3] == I_stick) {
-            *item = I_torch;
-            *count = 4;
-            return;
-          }
-          break;
-        case I_iron_ingot:
-          if (
-            (
-              first_row != 2 && first_col != 2 &&
-              player->craft_items[first + 4] == I_iron_ingot
-            ) || (
-              first_row != 2 && first_col != 0 &&
-              player->craft_items[first + 2] == I_iron_ingot
-            )
-          ) {
-            *item = I_shears;
-            *count = 1;
-            return;
-          }
-          break;
-
-        default: break;
-      }
-      break;
-
-    case 3:
-      switch (first_item) {
-        case I_oak_planks:
-        case I_cobblestone:
-        case I_stone:
-        case I_snow_block:
-          // Slab recipes
-          if (
-            first_col == 0 &&
-            player->craft_items[first + 1] == first_item &&
-            player->craft_items[first + 2] == first_item
-          ) {
-            if (first_item == I_oak_planks) *item = I_oak_slab;
-            else if (first_item == I_cobblestone) *item = I_cobblestone_slab;
-            else if (first_item == I_stone) *item = I_stone_slab;
-            else if (first_item == I_snow_block) *item = I_snow;
-            *count = 6;
-            return;
-          }
-        case I_iron_ingot:
-        case I_gold_ingot:
-        case I_diamond:
-        case I_netherite_ingot:
-          // Shovel recipes
-          if (
-            first_row == 0 &&
-            player->craft_items[first + 3] == I_stick &&
-            player->craft_items[first + 6] == I_stick
-          ) {
-            if (first_item == I_oak_planks) *item = I_wooden_shovel;
-            else if (first_item == I_cobblestone) *item = I_stone_shovel;
-            else if (first_item == I_iron_ingot) *item = I_iron_shovel;
-            else if (first_item == I_gold_ingot) *item = I_golden_shovel;
-            else if (first_item == I_diamond) *item = I_diamond_shovel;
-            else if (first_item == I_netherite_ingot) *item = I_netherite_shovel;
-            *count = 1;
-            return;
-          }
-          // Sword recipes
-          if (
-            first_row == 0 &&
-            player->craft_items[first + 3] == first_item &&
-            player->craft_items[first + 6] == I_stick
-          ) {
-            if (first_item == I_oak_planks) *item = I_wooden_sword;
-            else if (first_item == I_cobblestone) *item = I_stone_sword;
-            else if (first_item == I_iron_ingot) *item = I_iron_sword;
-            else if (first_item == I_gold_ingot) *item = I_golden_sword;
-            else if (first_item == I_diamond) *item = I_diamond_sword;
-            else if (first_item == I_netherite_ingot) *item = I_netherite_sword;
-            *count = 1;
-            return;
-          }
-          break;
-
-        default: break;
-      }
-      break;
-
-    case 4:
-      switch (first_item) {
-        case I_oak_planks:
-        case I_oak_log:
-        case I_snowball:
-          // Uniform 2x2 shaped recipes
-          if (
-            first_col != 2 && first_row != 2 &&
-            player->craft_items[first + 1] == first_item &&
-            player->craft_items[first + 3] == first_item &&
-            player->craft_items[first + 4] == first_item
-          ) {
-            if (first_item == I_oak_planks) { *item = I_crafting_table; *count = 1; }
-            else if (first_item == I_oak_log) { *item = I_oak_wood; *count = 3; }
-            else if (first_item == I_snowball) { *item = I_snow_block; *count = 3; }
-            return;
-          }
-          break;
-        // Boot recipes
-        case I_leather:
-        case I_iron_ingot:
-        case I_gold_ingot:
-        case I_diamond:
-        case I_netherite_ingot:
-          if (
-            first_col == 0 && first_row < 2 &&
-            player->craft_items[first + 2] == first_item &&
-            player->craft_items[first + 3] == first_item &&
-            player->craft_items[first + 5] == first_item
-          ) {
-            if (first_item == I_leather) *item = I_leather_boots;
-            else if (first_item == I_iron_ingot) *item = I_iron_boots;
-            else if (first_item == I_gold_ingot) *item = I_golden_boots;
-            else if (first_item == I_diamond) *item = I_diamond_boots;
-            else if (first_item == I_netherite_ingot) *item = I_netherite_boots;
-            *count = 1;
-            return;
-          }
-          break;
-
-        default: break;
-      }
-      break;
-
-    case 5:
-    switch (first_item) {
-        case I_oak_planks:
-        case I_cobblestone:
-        case I_iron_ingot:
-        case I_gold_ingot:
-        case I_diamond:
-        case I_netherite_ingot:
-          // Pickaxe recipes
-          if (
-            first == 0 &&
-            player->craft_items[first + 1] == first_item &&
-            player->craft_items[first + 2] == first_item &&
-            player->craft_items[first + 4] == I_stick &&
-            player->craft_items[first + 7] == I_stick
-          ) {
-            if (first_item == I_oak_planks) *item = I_wooden_pickaxe;
-            else if (first_item == I_cobblestone) *item = I_stone_pickaxe;
-            else if (first_item == I_iron_ingot) *item = I_iron_pickaxe;
-            else if (first_item == I_gold_ingot) *item = I_golden_pickaxe;
-            else if (first_item == I_diamond) *item = I_diamond_pickaxe;
-            else if (first_item == I_netherite_ingot) *item = I_netherite_pickaxe;
-            *count = 1;
-            return;
-          }
-          // Axe recipes
-          if (
-            first < 2 &&
-            player->craft_items[first + 1] == first_item &&
-            ((
-              player->craft_items[first + 3] == first_item &&
-              player->craft_items[first + 4] == I_stick &&
-              player->craft_items[first + 7] == I_stick
-            ) || (
-              player->craft_items[first + 4] == first_item &&
-              player->craft_items[first + 3] == I_stick &&
-              player->craft_items[first + 6] == I_stick
-            ))
-          ) {
-            if (first_item == I_oak_planks) *item = I_wooden_axe;
-            else if (first_item == I_cobblestone) *item = I_stone_axe;
-            else if (first_item == I_iron_ingot) *item = I_iron_axe;
-            else if (first_item == I_gold_ingot) *item = I_golden_axe;
-            else if (first_item == I_diamond) *item = I_diamond_axe;
-            else if (first_item == I_netherite_ingot) *item = I_netherite_axe;
-            *count = 1;
-            return;
-          }
-          if (
-            first_item == I_oak_planks ||
-            first_item == I_cobblestone
-          ) break;
-        case I_leather:
-          // Helmet recipes
-          if (
-            first_col == 0 && first_row < 2 &&
-            player->craft_items[first + 1] == first_item &&
-            player->craft_items[first + 2] == first_item &&
-            player->craft_items[first + 3] == first_item &&
-            player->craft_items[first + 5] == first_item
-          ) {
-            if (first_item == I_leather) *item = I_leather_helmet;
-            else if (first_item == I_iron_ingot) *item = I_iron_helmet;
-            else if (first_item == I_gold_ingot) *item = I_golden_helmet;
-            else if (first_item == I_diamond) *item = I_diamond_helmet;
-            else if (first_item == I_netherite_ingot) *item = I_netherite_helmet;
-            *count = 1;
-            return;
-          }
-          break;
-
-        default: break;
-      }
-      break;
-
-    case 7:
-      // Legging recipes
-      if (identical && player->craft_items[4] == 0 && player->craft_items[7] == 0) {
-        switch (first_item) {
-          case I_leather: *item = I_leather_leggings; *count = 1; return;
-          case I_iron_ingot: *item = I_iron_leggings; *count = 1; return;
-          case I_gold_ingot: *item = I_golden_leggings; *count = 1; return;
-          case I_diamond: *item = I_diamond_leggings; *count = 1; return;
-          case I_netherite_ingot: *item = I_netherite_leggings; *count = 1; return;
-          default: break;
-        }
-      }
-      switch (first_item) {
-        case I_oak_slab:
-          if (
-            identical &&
-            player->craft_items[1] == 0 &&
-            player->craft_items[4] == 0
-          ) {
-            *item = I_composter;
-            *count = 1;
-            return;
-          }
-          break;
-
-        default: break;
-      }
-      break;
-
-    case 8:
-      if (identical) {
-        if (player->craft_items[4] == 0) {
-          // Center slot clear
-          switch (first_item) {
-            case I_cobblestone: *item = I_furnace; *count = 1; return;
-            #ifdef ALLOW_CHESTS
-            case I_oak_planks: *item = I_chest; *count = 1; return;
-            #endif
-            default: break;
-          }
-        } else if (player->craft_items[1] == 0) {
-          // Top-middle slot clear (chestplate recipes)
-          switch (first_item) {
-            case I_leather: *item = I_leather_chestplate; *count = 1; return;
-            case I_iron_ingot: *item = I_iron_chestplate; *count = 1; return;
-            case I_gold_ingot: *item = I_golden_chestplate; *count = 1; return;
-            case I_diamond: *item = I_diamond_chestplate; *count = 1; return;
-            case I_netherite_ingot: *item = I_netherite_chestplate; *count = 1; return;
-            default: break;
-          }
-        }
-      }
-      break;
-
-    case 9:
-      // Uniform 3x3 shaped recipes
-      if (identical) switch (first_item) {
-        case I_iron_ingot: *item = I_iron_block; *count = 1; return;
-        case I_gold_ingot: *item = I_gold_block; *count = 1; return;
-        case I_diamond: *item = I_diamond_block; *count = 1; return;
-        case I_redstone: *item = I_redstone_block; *count = 1; return;
-        case I_coal: *item = I_coal_block; *count = 1; return;
-        case I_copper_ingot: *item = I_copper_block; *count = 1; return;
-        default: break;
-      }
-      break;
-
-    default: break;
+  *item = 0;
+  *count = 0;
 
+  // Find the area of the grid that has items in it
+  uint8_t min_col = 3, max_col = 0, min_row = 3, max_row = 0;
+  for (uint8_t i = 0; i < 9; i ++) {
+    if (player->craft_items[i] == 0) continue;
+    uint8_t col = i % 3, row = i / 3;
+    if (col < min_col) min_col = col;
+    if (col > max_col) max_col = col;
+    if (row < min_row) min_row = row;
+    if (row > max_row) max_row = row;
+  }
+  if (min_col == 3) return;
+
+  // Trim the grid down to that area, so that recipes match in any position
+  uint8_t width = max_col - min_col + 1, height = max_row - min_row + 1;
+  uint16_t items[9];
+  for (uint8_t row = 0; row < height; row ++) {
+    for (uint8_t col = 0; col < width; col ++) {
+      items[row * width + col] = player->craft_items[(min_row + row) * 3 + min_col + col];
+    }
   }
 
-  *count = 0;
-  *item = 0;
+  if (!crafting_hash_table_ready) buildCraftingHashTable();
+
+  uint32_t slot = hashCraftingGrid(width, height, items);
+  while (crafting_hash_table[slot % CRAFTING_HASH_SIZE] != 0) {
+    const CraftingRecipe *recipe = &crafting_recipes[crafting_hash_table[slot % CRAFTING_HASH_SIZE] - 1];
+    slot ++;
+    if (recipe->width != width || recipe->height != height) continue;
+    if (memcmp(recipe->items, items, width * height * sizeof(uint16_t)) != 0) continue;
+    *item = recipe->output;
+    *count = recipe->count;
+    return;
+  }
 
 }
 
@@ -37,6 +37,10 @@ uint32_t rng_seed = INITIAL_RNG_SEED;
 uint16_t world_time = 0;
 uint32_t server_ticks = 0;
 
+uint32_t tick_overruns = 0;
+uint32_t ticks_dropped = 0;
+uint32_t tick_histogram[TICK_HISTOGRAM_BUCKETS] = {0};
+
 char motd[] = { "A bareiron server" };
 uint8_t motd_len = sizeof(motd) - 1;
 
@@ -47,10 +51,26 @@ uint8_t motd_len = sizeof(motd) - 1;
 
 uint16_t client_count;
 
+uint16_t player_latency[MAX_PLAYERS];
+int64_t player_keepalive_time[MAX_PLAYERS];
+PlayerView player_view[MAX_PLAYERS];
+
 BlockChange block_changes[MAX_BLOCK_CHANGES];
 int block_changes_count = 0;
 
 PlayerData player_data[MAX_PLAYERS];
 int player_data_count = 0;
 
-MobData mob_data[MAX_MOBS];
+PlayerData *online_players[MAX_PLAYERS];
+int online_player_count = 0;
+PlayerData *loaded_players[MAX_PLAYERS];
+int loaded_player_count = 0;
+
+uint8_t mob_type[MAX_MOBS];
+short mob_x[MAX_MOBS];
+uint8_t mob_y[MAX_MOBS];
+short mob_z[MAX_MOBS];
+uint8_t mob_data[MAX_MOBS];
+uint16_t mob_id[MAX_MOBS];
+uint16_t mob_slot[MAX_MOBS];
+int mob_count = 0;
@@ -1,3 +1,8 @@
+// Needed for accept4 on glibc
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,6 +30,7 @@
   #else
     #include <sys/socket.h>
     #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <arpa/inet.h>
   #endif
   #include <unistd.h>
@@ -38,7 +44,10 @@
 #include "worldgen.h"
 #include "registries.h"
 #include "procedures.h"
+#include "netpoll.h"
 #include "serialize.h"
+#include "stats.h"
+#include "trace.h"
 
 /**
  * Routes an incoming packet to its packet handler or procedure.
@@ -85,15 +94,26 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
           recv_count = 0;
           return;
         }
+        #ifdef ENABLE_COMPRESSION
+        if (sc_setCompression(client_fd)) break;
+        #endif
         if (sc_loginSuccess(client_fd, uuid, name)) break;
       } else if (state == STATE_CONFIGURATION) {
         if (cs_clientInformation(client_fd)) break;
-        if (sc_knownPacks(client_fd)) break;
-        if (sc_registries(client_fd)) break;
 
+        // Registries are bulk data, send them in full-sized segments
+        beginBulkOutput(client_fd);
         #ifdef SEND_BRAND
-        if (sc_sendPluginMessage(client_fd, "minecraft:brand", (uint8_t *)brand, brand_len)) break;
+        if (sc_sendPluginMessage(client_fd, "minecraft:brand", (uint8_t *)brand, brand_len)) {
+          endBulkOutput(client_fd);
+          break;
+        }
         #endif
+        if (sc_configuration(client_fd)) {
+          endBulkOutput(client_fd);
+          break;
+        }
+        endBulkOutput(client_fd);
       }
       break;
 
@@ -128,16 +148,17 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
         PlayerData *player;
         if (getPlayerData(client_fd, &player)) break;
 
+        // Everything from here on is one burst, mostly of chunks
+        beginBulkOutput(client_fd);
+
         // Send full client spawn sequence
         spawnPlayer(player);
 
         // Register all existing players and spawn their entities
-        for (int i = 0; i < MAX_PLAYERS; i ++) {
-          if (player_data[i].client_fd == -1) continue;
-          // Note that this will also filter out the joining player
-          if (player_data[i].flags & 0x20) continue;
-          sc_playerInfoUpdateAddPlayer(client_fd, player_data[i]);
-          sc_spawnEntityPlayer(client_fd, player_data[i]);
+        // Note that the joining player isn't loaded yet, so it's left out
+        FOR_EACH_LOADED_PLAYER(other) {
+          sc_playerInfoUpdateAddPlayer(client_fd, *other);
+          sc_spawnEntityPlayer(client_fd, *other);
         }
 
         // Send information about all other entities (mobs):
@@ -146,30 +167,37 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
         uint32_t r = fast_rand();
         memcpy(uuid, &r, 4);
         // Send allocated living mobs, use ID for second half of UUID
-        for (int i = 0; i < MAX_MOBS; i ++) {
-          if (mob_data[i].type == 0) continue;
-          if ((mob_data[i].data & 31) == 0) continue;
-          memcpy(uuid + 4, &i, 4);
+        for (int i = 0; i < mob_count; i ++) {
+          if ((mob_data[i] & 31) == 0) continue;
+          int id = mob_id[i];
+          memcpy(uuid + 4, &id, 4);
           // For more info on the arguments here, see the spawnMob function
           sc_spawnEntity(
-            client_fd, -2 - i, uuid,
-            mob_data[i].type, mob_data[i].x, mob_data[i].y, mob_data[i].z,
+            client_fd, -2 - id, uuid,
+            mob_type[i], mob_x[i], mob_y[i], mob_z[i],
             0, 0
           );
-          broadcastMobMetadata(client_fd, -2 - i);
+          broadcastMobMetadata(client_fd, -2 - id);
         }
 
+        endBulkOutput(client_fd);
+
       }
       break;
 
     case 0x07:
       if (state == STATE_CONFIGURATION) {
-        printf("Received Client's Known Packs\n");
-        printf("  Finishing configuration\n\n");
-        sc_finishConfiguration(client_fd);
+        // Configuration is finished as part of sc_configuration
+        printf("Received Client's Known Packs\n\n");
       }
       break;
 
+    #ifdef DEV_ENABLE_STATS
+    case 0x06:
+      if (state == STATE_PLAY) cs_chatCommand(client_fd);
+      break;
+    #endif
+
     case 0x08:
       if (state == STATE_PLAY) cs_chat(client_fd);
       break;
@@ -181,6 +209,10 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
     case 0x0C: // Client tick (ignored)
       break;
 
+    case 0x0D:
+      if (state == STATE_PLAY) cs_clientInformation(client_fd);
+      break;
+
     case 0x11:
       if (state == STATE_PLAY) cs_clickContainer(client_fd);
       break;
@@ -190,10 +222,7 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
       break;
 
     case 0x1B:
-      if (state == STATE_PLAY) {
-        // Serverbound keep-alive (ignored)
-        recv_all(client_fd, recv_buffer, length, false);
-      }
+      if (state == STATE_PLAY) cs_keepAlive(client_fd);
       break;
 
     case 0x19:
@@ -274,17 +303,14 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
             pitch = player->pitch * 90 / 127;
           }
           // Send current position data to all connected players
-          for (int i = 0; i < MAX_PLAYERS; i ++) {
-            if (player_data[i].client_fd == -1) continue;
-            if (player_data[i].flags & 0x20) continue;
-            if (player_data[i].client_fd == client_fd) continue;
-            if (packet_id == 0x1F) {
-              sc_updateEntityRotation(player_data[i].client_fd, client_fd, player->yaw, player->pitch);
-            } else {
-              sc_teleportEntity(player_data[i].client_fd, client_fd, x, y, z, yaw, pitch);
-            }
-            sc_setHeadRotation(player_data[i].client_fd, client_fd, player->yaw);
+          beginBroadcast();
+          if (packet_id == 0x1F) {
+            sc_updateEntityRotation(MEMORY_SINK_FD, client_fd, player->yaw, player->pitch);
+          } else {
+            sc_teleportEntity(MEMORY_SINK_FD, client_fd, x, y, z, yaw, pitch);
           }
+          sc_setHeadRotation(MEMORY_SINK_FD, client_fd, player->yaw);
+          endBroadcast(client_fd, BROADCAST_KEEPING_UP, NULL, NULL);
         }
 
         // Don't continue if all we got was rotation data
@@ -332,31 +358,34 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
         // Exit early if no chunk borders were crossed
         if (dx == 0 && dz == 0) break;
 
-        // Check if the player has recently been in this chunk
-        int found = false;
-        for (int i = 0; i < VISITED_HISTORY; i ++) {
-          if (player->visited_x[i] == _x && player->visited_z[i] == _z) {
-            found = true;
-            break;
-          }
-        }
-        if (found) break;
+        #ifdef DEV_LOG_CHUNK_GENERATION
+          printf("Sending new chunks (%d, %d)\n", _x, _z);
+          clock_t start, end;
+          start = clock();
+        #endif
 
-        // Update player's recently visited chunks
-        for (int i = 0; i < VISITED_HISTORY - 1; i ++) {
-          player->visited_x[i] = player->visited_x[i + 1];
-          player->visited_z[i] = player->visited_z[i + 1];
-        }
-        player->visited_x[VISITED_HISTORY - 1] = _x;
-        player->visited_z[VISITED_HISTORY - 1] = _z;
+        // Send chunks that came into view, and unload ones that left it
+        int count = updatePlayerChunks(player, _x, _z);
+
+        #ifdef DEV_LOG_CHUNK_GENERATION
+          end = clock();
+          double total_ms = (double)(end - start) / CLOCKS_PER_SEC * 1000;
+          if (count > 0) printf("Generated %d chunks in %.0f ms (%.2f ms per chunk)\n", count, total_ms, total_ms / (double)count);
+        #endif
+
+        // Only move on to spawning mobs if new chunks were actually sent
+        if (count == 0) break;
+
+        // Mobs are placed at the edge of this player's view distance
+        int view_distance = player_view[player - player_data].current;
 
         uint32_t r = fast_rand();
         // One in every 4 new chunks spawns a mob
         if ((r & 3) == 0) {
           // The mob is placed in the middle of the new chunk row,
           // at a random position within the chunk
-          short mob_x = (_x + dx * VIEW_DISTANCE) * 16 + ((r >> 4) & 15);
-          short mob_z = (_z + dz * VIEW_DISTANCE) * 16 + ((r >> 8) & 15);
+          short mob_x = (_x + dx * view_distance) * 16 + ((r >> 4) & 15);
+          short mob_z = (_z + dz * view_distance) * 16 + ((r >> 8) & 15);
           // Start at the Y coordinate of the spawning player and move upward
           // until a valid space is found
           uint8_t mob_y = cy - 8;
@@ -389,42 +418,6 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
           }
         }
 
-        int count = 0;
-        #ifdef DEV_LOG_CHUNK_GENERATION
-          printf("Sending new chunks (%d, %d)\n", _x, _z);
-          clock_t start, end;
-          start = clock();
-        #endif
-
-        sc_setCenterChunk(client_fd, _x, _z);
-
-        while (dx != 0) {
-          sc_chunkDataAndUpdateLight(client_fd, _x + dx * VIEW_DISTANCE, _z);
-          count ++;
-          for (int i = 1; i <= VIEW_DISTANCE; i ++) {
-            sc_chunkDataAndUpdateLight(client_fd, _x + dx * VIEW_DISTANCE, _z - i);
-            sc_chunkDataAndUpdateLight(client_fd, _x + dx * VIEW_DISTANCE, _z + i);
-            count += 2;
-          }
-          dx += dx > 0 ? -1 : 1;
-        }
-        while (dz != 0) {
-          sc_chunkDataAndUpdateLight(client_fd, _x, _z + dz * VIEW_DISTANCE);
-          count ++;
-          for (int i = 1; i <= VIEW_DISTANCE; i ++) {
-            sc_chunkDataAndUpdateLight(client_fd, _x - i, _z + dz * VIEW_DISTANCE);
-            sc_chunkDataAndUpdateLight(client_fd, _x + i, _z + dz * VIEW_DISTANCE);
-            count += 2;
-          }
-          dz += dz > 0 ? -1 : 1;
-        }
-
-        #ifdef DEV_LOG_CHUNK_GENERATION
-          end = clock();
-          double total_ms = (double)(end - start) / CLOCKS_PER_SEC * 1000;
-          printf("Generated %d chunks in %.0f ms (%.2f ms per chunk)\n", count, total_ms, total_ms / (double)count);
-        #endif
-
       }
       break;
 
@@ -496,6 +489,263 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
 
 }
 
+// Ticks dropped since the last "Can't keep up!" warning, and when that was
+uint32_t unreported_ticks_dropped = 0;
+int64_t last_tick_drop_report = 0;
+
+/**
+ * Runs any server ticks that have come due, advancing the deadline in
+ * fixed steps of TIME_BETWEEN_TICKS. Since the deadline is advanced by
+ * the period rather than reset to the current time, ticks don't drift,
+ * and a late tick is followed by up to MAX_TICK_CATCHUP extra ticks to
+ * make up for the lost time. Returns the new deadline.
+ */
+int64_t runDueTicks (int64_t next_tick_time) {
+
+  int64_t now = get_program_time();
+  if (now < next_tick_time) return next_tick_time;
+
+  // The first due tick being a full period late means we've overrun
+  if (now - next_tick_time >= TIME_BETWEEN_TICKS) tick_overruns ++;
+
+  for (int i = 0; i < MAX_TICK_CATCHUP && now >= next_tick_time; i ++) {
+    traceTick();
+    handleServerTick();
+    next_tick_time += TIME_BETWEEN_TICKS;
+    // Record how long the tick took in a log2 histogram
+    int64_t tick_end = get_program_time();
+    uint64_t duration = tick_end - now;
+    statsRecordTick(duration);
+    int bucket = 0;
+    while (duration && bucket < TICK_HISTOGRAM_BUCKETS - 1) {
+      duration >>= 1;
+      bucket ++;
+    }
+    tick_histogram[bucket] ++;
+    now = tick_end;
+  }
+
+  // If we're still behind, give up on the missed ticks
+  if (now >= next_tick_time) {
+    uint32_t missed = (now - next_tick_time) / TIME_BETWEEN_TICKS + 1;
+    next_tick_time += (int64_t)missed * TIME_BETWEEN_TICKS;
+    ticks_dropped += missed;
+    // Warn at most once per interval, a struggling server would otherwise
+    // spend even more time printing
+    unreported_ticks_dropped += missed;
+    if (now - last_tick_drop_report >= TICK_DROP_REPORT_INTERVAL) {
+      printf("Can't keep up! Skipped %u ticks\n", unreported_ticks_dropped);
+      unreported_ticks_dropped = 0;
+      last_tick_drop_report = now;
+    }
+  }
+
+  return next_tick_time;
+}
+
+/**
+ * Accepts one pending connection and makes it non-blocking, since the
+ * main loop must never wait on a single client. Where accept4 exists,
+ * this is done in the same call. Returns -1 if nothing was pending.
+ */
+int acceptClient (int server_fd, struct sockaddr_in *client_addr) {
+
+  #ifdef ENABLE_IO_URING
+  // io_uring accepts connections on its own, see waitForUring
+  if (isUringActive()) return acceptQueuedClient(client_addr);
+  #endif
+
+  socklen_t addr_len = sizeof(*client_addr);
+
+#if defined(__linux__) && defined(SOCK_NONBLOCK)
+  return accept4(server_fd, (struct sockaddr *)client_addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+  int client_fd = accept(server_fd, (struct sockaddr *)client_addr, &addr_len);
+  if (client_fd == -1) return -1;
+  #ifdef _WIN32
+    u_long mode = 1;
+    ioctlsocket(client_fd, FIONBIO, &mode);
+  #else
+    int flags = fcntl(client_fd, F_GETFL, 0);
+    fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
+  #endif
+  return client_fd;
+#endif
+
+}
+
+// Rejected connections waiting for the client to close its end
+int lingering_fds[REJECT_LINGER_COUNT];
+int64_t lingering_deadlines[REJECT_LINGER_COUNT];
+int lingering_count = 0;
+
+void closeRejectedClient (int client_fd) {
+#ifdef _WIN32
+  closesocket(client_fd);
+#else
+  close(client_fd);
+#endif
+}
+
+/**
+ * Reads off whatever rejected clients have sent since, and closes their
+ * connections once they've closed their end (having seen the disconnect
+ * packet) or taken too long to. Closing with unread data would reset the
+ * connection, which might throw away the packet before the client sees it.
+ * Only one read is made per client and pass, so that a client that keeps
+ * sending can't hold up the main loop, and instead runs into its deadline.
+ */
+void drainRejectedClients () {
+
+  uint8_t discard[256];
+  int64_t time = get_program_time();
+
+  for (int i = 0; i < lingering_count; i ++) {
+    ssize_t n = recv(lingering_fds[i], discard, sizeof(discard), 0);
+
+    #ifdef _WIN32
+    uint8_t waiting = n > 0 || (n == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK);
+    #else
+    uint8_t waiting = n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+    #endif
+    if (waiting && time < lingering_deadlines[i]) continue;
+
+    closeRejectedClient(lingering_fds[i]);
+    lingering_count --;
+    lingering_fds[i] = lingering_fds[lingering_count];
+    lingering_deadlines[i] = lingering_deadlines[lingering_count];
+    i --;
+  }
+
+}
+
+/**
+ * Turns away a connection for which there's no free slot. Assumes that
+ * the client is trying to join, as that's what most clients in a
+ * reconnect storm are doing, and tells it that the server is full.
+ * Server list pings get the same packet, which they just show as an
+ * error. The connection is then left to drainRejectedClients to close.
+ */
+void rejectClient (int client_fd) {
+
+  sc_loginDisconnect(client_fd, "Server is full");
+  flushOutput();
+
+#ifdef _WIN32
+  shutdown(client_fd, SD_SEND);
+#else
+  shutdown(client_fd, SHUT_WR);
+#endif
+
+  if (lingering_count == REJECT_LINGER_COUNT) {
+    closeRejectedClient(client_fd);
+    return;
+  }
+  lingering_fds[lingering_count] = client_fd;
+  lingering_deadlines[lingering_count] = get_program_time() + REJECT_LINGER_TIME;
+  lingering_count ++;
+
+}
+
+/**
+ * Accepts connections until the listen backlog is empty (or until
+ * LISTEN_BACKLOG of them have been handled, so that a flood of them
+ * can't stall ticks). Taking only one per loop iteration lets the
+ * backlog overflow when many clients reconnect at once, after which
+ * their connection attempts time out instead of getting through.
+ */
+void acceptPendingClients (int server_fd) {
+
+  struct sockaddr_in client_addr;
+
+  for (int i = 0; i < LISTEN_BACKLOG; i ++) {
+    int new_fd = acceptClient(server_fd, &client_addr);
+    if (new_fd == -1) break;
+
+    if (client_count >= MAX_CONNECTIONS) {
+      printf("Server is full, rejecting fd: %d\n\n", new_fd);
+      rejectClient(new_fd);
+      continue;
+    }
+
+    Connection *connection = openConnection(new_fd);
+    if (connection == NULL) {
+      printf("Out of memory, rejecting fd: %d\n\n", new_fd);
+      rejectClient(new_fd);
+      continue;
+    }
+
+    printf("New client, fd: %d\n", new_fd);
+    traceConnect(new_fd);
+    // Output is buffered and flushed explicitly, bulk data gets corked (see
+    // beginBulkOutput). Nagle's algorithm would only hold back the small
+    // packets that need to arrive quickly, such as movement and combat.
+    int nodelay = 1;
+    setsockopt(new_fd, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(nodelay));
+    connection->address = client_addr.sin_addr.s_addr;
+    watchConnection(new_fd);
+    client_count ++;
+  }
+
+}
+
+/**
+ * Called with the header of a movement packet already read. While the
+ * rest of it is followed by another fully received movement packet that
+ * carries the same kind of data (or more), skips ahead to that packet,
+ * so that only the latest state gets handled. Clients send movement
+ * faster than we can read it whenever the server falls behind, and each
+ * packet would otherwise go through fall damage, collision, broadcasts
+ * and chunk border checks. Packets that change whether the player is on
+ * the ground are never skipped, as fall damage is calculated from them.
+ */
+void skipSupersededMovement (int client_fd, int *length, int *packet_id) {
+
+  uint8_t peek[128];
+
+  for (int i = 0; i < MAX_COALESCED_MOVEMENT; i ++) {
+
+    // Only consider position and rotation packets, not flags alone
+    if (*packet_id < 0x1D || *packet_id > 0x1F) return;
+    int payload_length = *length - sizeVarInt(*packet_id);
+    if (payload_length < 1 || payload_length >= (int)sizeof(peek)) return;
+
+    // Look at the rest of this packet and whatever comes after it
+    ssize_t available = recvInput(client_fd, peek, sizeof(peek), MSG_PEEK);
+    if (available <= payload_length) return;
+
+    // Parse the header of the next packet, which has to be all there
+    int offset = payload_length;
+    int next_length = decodeVarInt(peek, available, &offset);
+    if (next_length == VARNUM_ERROR || next_length < 1) return;
+    int end = offset + next_length;
+    if (end > available) return;
+    #ifdef ENABLE_COMPRESSION
+    if (isCompressionEnabled(client_fd)) {
+      // We can't look into compressed packets, but movement is too small
+      // to get compressed anyway
+      if (decodeVarInt(peek, end, &offset) != 0) return;
+      next_length = end - offset;
+    }
+    #endif
+    int next_id = decodeVarInt(peek, end, &offset);
+    if (next_id == VARNUM_ERROR || offset >= end) return;
+
+    // Packets with both position and rotation supersede any other,
+    // otherwise the next packet has to be of the same kind
+    if (next_id != 0x1E && next_id != *packet_id) return;
+    // The on-ground flag is in the last byte of both packets
+    if ((peek[payload_length - 1] & 0x01) != (peek[end - 1] & 0x01)) return;
+
+    // Drop the rest of this packet, and read the header of the next one
+    recv_all(client_fd, recv_buffer, offset, false);
+    *length = next_length;
+    *packet_id = next_id;
+
+  }
+
+}
+
 int main () {
   #ifdef _WIN32 //initialize windows socket
     WSADATA wsa;
@@ -515,26 +765,32 @@ int main () {
   for (int i = 3; i >= 0; i --) printf("%X", (unsigned int)((rng_seed >> (8 * i)) & 255));
   printf("\n\n");
 
+  // Start recording a packet trace (if applicable)
+  if (traceOpen()) exit(EXIT_FAILURE);
+
   // Initialize block changes entries as unallocated
   for (int i = 0; i < MAX_BLOCK_CHANGES; i ++) {
     block_changes[i].block = 0xFF;
   }
 
+  // Initialize mob ID map entries as unallocated
+  for (int i = 0; i < MAX_MOBS; i ++) {
+    mob_slot[i] = 0xFFFF;
+  }
+
   // Start the disk/flash serializer (if applicable)
   if (initSerializer()) exit(EXIT_FAILURE);
 
   // Initialize all file descriptor references to -1 (unallocated)
-  int clients[MAX_PLAYERS], client_index = 0;
+  int client_index = 0;
+  initConnections();
   for (int i = 0; i < MAX_PLAYERS; i ++) {
-    clients[i] = -1;
-    client_states[i * 2] = -1;
     player_data[i].client_fd = -1;
   }
 
   // Create server TCP socket
   int server_fd, opt = 1;
-  struct sockaddr_in server_addr, client_addr;
-  socklen_t addr_len = sizeof(client_addr);
+  struct sockaddr_in server_addr;
 
   server_fd = socket(AF_INET, SOCK_STREAM, 0);
   if (server_fd == -1) {
@@ -563,7 +819,7 @@ int main () {
   }
 
   // Listen for incoming connections
-  if (listen(server_fd, 5) < 0) {
+  if (listen(server_fd, LISTEN_BACKLOG) < 0) {
     perror("listen failed");
     close(server_fd);
     exit(EXIT_FAILURE);
@@ -583,57 +839,67 @@ int main () {
   fcntl(server_fd, F_SETFL, flags | O_NONBLOCK);
   #endif
 
-  // Track time of last server tick (in microseconds)
-  int64_t last_tick_time = get_program_time();
+  // Have epoll tell us which clients to look at, where available
+  initNetPoll(server_fd);
+
+  // Track deadline of next server tick (in microseconds)
+  int64_t next_tick_time = get_program_time() + TIME_BETWEEN_TICKS;
 
   /**
    * Cycles through all connected clients, handling one packet at a time
-   * from each player. With every iteration, attempts to accept a new
-   * client connection.
+   * from each player. With every iteration, accepts any new client
+   * connections. With epoll, the server instead sleeps after each round
+   * until something happens, and only visits clients with data to read.
    */
   while (true) {
     // Check if it's time to yield to the idle task
     task_yield();
 
-    // Attempt to accept a new connection
-    for (int i = 0; i < MAX_PLAYERS; i ++) {
-      if (clients[i] != -1) continue;
-      clients[i] = accept(server_fd, (struct sockaddr *)&client_addr, &addr_len);
-      // If the accept was successful, make the client non-blocking too
-      if (clients[i] != -1) {
-        printf("New client, fd: %d\n", clients[i]);
-      #ifdef _WIN32
-        u_long mode = 1;
-        ioctlsocket(clients[i], FIONBIO, &mode);
-      #else
-        int flags = fcntl(clients[i], F_GETFL, 0);
-        fcntl(clients[i], F_SETFL, flags | O_NONBLOCK);
-      #endif
-        client_count ++;
-      }
-      break;
-    }
+    // Handle periodic events (server ticks)
+    // This runs regardless of client activity, even with no players online
+    next_tick_time = runDueTicks(next_tick_time);
+    flushOutput();
+
+    // Accept any new connections waiting in the backlog
+    if (!isNetPollActive()) acceptPendingClients(server_fd);
 
     // Look for valid connected clients
     client_index ++;
-    if (client_index == MAX_PLAYERS) client_index = 0;
-    if (clients[client_index] == -1) continue;
-
-    // Handle periodic events (server ticks)
-    int64_t time_since_last_tick = get_program_time() - last_tick_time;
-    if (time_since_last_tick > TIME_BETWEEN_TICKS) {
-      handleServerTick(time_since_last_tick);
-      last_tick_time = get_program_time();
+    if (client_index == MAX_CONNECTIONS) {
+      client_index = 0;
+      if (lingering_count > 0) drainRejectedClients();
+      // Every client has had its turn, wait for more work
+      if (isNetPollActive() && waitForActivity(next_tick_time)) {
+        acceptPendingClients(server_fd);
+      }
     }
+    if (connections[client_index].client_fd == -1) continue;
+
+    // Skip clients that have nothing to read or send
+    if (isNetPollActive() && !connections[client_index].ready) continue;
+    connections[client_index].ready = false;
 
     // Handle this individual client
-    int client_fd = clients[client_index];
+    int client_fd = connections[client_index].client_fd;
+
+    // Finish off clients whose output failed, see abortConnection
+    if (connections[client_index].closing) {
+      disconnectClient(&client_fd, 8);
+      continue;
+    }
+    // Continue sending any output queued up for this client
+    if (pending_output_count > 0 && flushPendingOutput(client_fd) == -1) {
+      disconnectClient(&client_fd, 8);
+      continue;
+    }
+    // Follow up with any chunks held back while output was queued
+    resumePlayerChunks(client_fd);
 
     // Check if at least 2 bytes are available for reading
     #ifdef _WIN32
     recv_count = recv(client_fd, recv_buffer, 2, MSG_PEEK);
     if (recv_count == 0) {
-      disconnectClient(&clients[client_index], 1);
+      disconnectClient(&client_fd, 1);
       continue;
     }
     if (recv_count == SOCKET_ERROR) {
@@ -641,19 +907,28 @@ int main () {
       if (err == WSAEWOULDBLOCK) {
         continue; // no data yet, keep client alive
       } else {
-        disconnectClient(&clients[client_index], 1);
+        disconnectClient(&client_fd, 1);
         continue;
       }
     }
     #else
-    recv_count = recv(client_fd, &recv_buffer, 2, MSG_PEEK);
+    recv_count = recvInput(client_fd, &recv_buffer, 2, MSG_PEEK);
     if (recv_count < 2) {
       if (recv_count == 0 || (recv_count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
-        disconnectClient(&clients[client_index], 1);
+        disconnectClient(&client_fd, 1);
+      } else if (recv_count == 1) {
+        // Only part of the packet header is here, wait for the rest of it,
+        // unless io_uring has already seen the client close its end
+        if (isUringActive() && isPacketReceived(client_fd)) disconnectClient(&client_fd, 1);
+        else watchNewInputOnly(client_fd, true);
       }
       continue;
     }
     #endif
+    watchNewInputOnly(client_fd, false);
+    // With io_uring, wait until the whole packet is in, so that reading it
+    // doesn't have to wait on the kernel mid-packet
+    if (!isPacketReceived(client_fd)) continue;
     // Handle 0xBEEF and 0xFEED packets for dumping/uploading world data
     #ifdef DEV_ENABLE_BEEF_DUMPS
     // Received BEEF packet, dump world data and disconnect
@@ -662,11 +937,12 @@ int main () {
       // The client is expected to know (or calculate) the size of these buffers
       send_all(client_fd, block_changes, sizeof(block_changes));
       send_all(client_fd, player_data, sizeof(player_data));
+      flushOutput();
       // Flush the socket and receive everything left on the wire
       shutdown(client_fd, SHUT_WR);
       recv_all(client_fd, recv_buffer, sizeof(recv_buffer), false);
       // Kick the client
-      disconnectClient(&clients[client_index], 6);
+      disconnectClient(&client_fd, 6);
       continue;
     }
     // Received FEED packet, load world data from socket and disconnect
@@ -682,11 +958,13 @@ int main () {
         if (block_changes[i].block == B_chest) i += 14;
         if (i >= block_changes_count) block_changes_count = i + 1;
       }
+      // Any chunks sent from here on have to include the new data
+      clearChunkCache();
       // Update data on disk
       writeBlockChangesToDisk(0, block_changes_count);
       writePlayerDataToDisk();
       // Kick the client
-      disconnectClient(&clients[client_index], 7);
+      disconnectClient(&client_fd, 7);
       continue;
     }
     #endif
@@ -694,26 +972,63 @@ int main () {
     // Read packet length
     int length = readVarInt(client_fd);
     if (length == VARNUM_ERROR) {
-      disconnectClient(&clients[client_index], 2);
+      disconnectClient(&client_fd, 2);
       continue;
     }
+    #ifdef ENABLE_COMPRESSION
+    // With compression enabled, the length is followed by the size of the
+    // uncompressed data, or 0 if the packet was sent uncompressed.
+    // Compressed packets are decompressed into memory, and read from there.
+    if (isCompressionEnabled(client_fd)) {
+      int data_length = readVarInt(client_fd);
+      if (data_length == VARNUM_ERROR) {
+        disconnectClient(&client_fd, 2);
+        continue;
+      }
+      length -= sizeVarInt(data_length);
+      if (data_length != 0) {
+        if (recvCompressed(client_fd, length, data_length)) {
+          disconnectClient(&client_fd, 9);
+          continue;
+        }
+        length = data_length;
+      }
+    }
+    #endif
     // Read packet ID
     int packet_id = readVarInt(client_fd);
     if (packet_id == VARNUM_ERROR) {
-      disconnectClient(&clients[client_index], 3);
+      memory_source = NULL;
+      disconnectClient(&client_fd, 3);
       continue;
     }
     // Get client connection state
     int state = getClientState(client_fd);
     // Disconnect on legacy server list ping
     if (state == STATE_NONE && length == 254 && packet_id == 122) {
-      disconnectClient(&clients[client_index], 5);
+      disconnectClient(&client_fd, 5);
       continue;
     }
+    // Skip ahead to the latest of several movement packets, if queued up
+    if (state == STATE_PLAY && memory_source == NULL) {
+      skipSupersededMovement(client_fd, &length, &packet_id);
+    }
     // Handle packet data
+    #ifdef DEV_ENABLE_STATS
+      int64_t packet_start = get_program_time();
+    #endif
+    tracePacketBegin(client_fd, length - sizeVarInt(packet_id), packet_id, state);
     handlePacket(client_fd, length - sizeVarInt(packet_id), packet_id, state);
+    tracePacketEnd();
+    // Whatever the packet caused to be sent should arrive right away
+    flushOutput();
+    // Stop reading from the decompressed packet, if there was one
+    memory_source = NULL;
+    #ifdef DEV_ENABLE_STATS
+      statsRecordPacket(packet_id, get_program_time() - packet_start);
+    #endif
     if (recv_count == 0 || (recv_count == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
-      disconnectClient(&clients[client_index], 4);
+      disconnectClient(&client_fd, 4);
       continue;
     }
 
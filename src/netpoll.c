@@ -0,0 +1,656 @@
+#include <stdio.h>
+
+#include "globals.h"
+
+#ifdef ENABLE_EPOLL
+
+#include <string.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#ifdef ENABLE_IO_URING
+  #include <stdlib.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <linux/io_uring.h>
+#endif
+
+#include "tools.h"
+#include "varnum.h"
+#include "stats.h"
+#include "netpoll.h"
+
+int netpoll_fd = -1;
+int netpoll_server_fd = -1;
+
+#ifdef ENABLE_IO_URING
+
+int uring_fd = -1;
+
+// Submission and completion rings, shared with the kernel
+uint32_t *sq_head, *sq_tail, *sq_mask, *sq_array;
+uint32_t *cq_head, *cq_tail, *cq_mask;
+struct io_uring_sqe *sqes;
+struct io_uring_cqe *cqes;
+uint32_t sq_entries;
+// Tail of the submission ring as far as we've filled it, and how many of
+// those entries the kernel hasn't been handed yet
+uint32_t sq_local_tail = 0;
+uint32_t sq_unsubmitted = 0;
+// The mapped regions, kept for cleaning up after a failed setup
+void *sq_ring_map = MAP_FAILED, *cq_ring_map = MAP_FAILED, *sqes_map = MAP_FAILED;
+size_t sq_ring_size, cq_ring_size, sqes_size;
+
+// Buffers that clients' data is received into. Their IDs are handed to
+// the kernel through a buffer ring, which it picks one from for each
+// receive. Buffers holding unread data are chained into a list for each
+// client through uring_buffer_next.
+struct io_uring_buf_ring *uring_buffer_ring = MAP_FAILED;
+size_t uring_buffer_ring_size;
+uint16_t uring_buffer_tail = 0;
+uint32_t uring_buffer_count;
+uint8_t *uring_buffers = NULL;
+uint16_t *uring_buffer_next = NULL;
+uint16_t *uring_buffer_length = NULL;
+
+// Connections accepted by the kernel, waiting for acceptPendingClients
+int accepted_fds[LISTEN_BACKLOG];
+int accepted_count = 0;
+uint8_t accept_armed = false;
+
+// Kinds of requests, kept in the low byte of their user_data. Requests
+// made for a connection carry its slot in the next byte.
+#define URING_ACCEPT 0
+#define URING_RECV 1
+#define URING_CANCEL 2
+#define URING_SEND 3 // Plus the part of output sent, see OUTPUT_DATA
+
+// Hands prepared requests to the kernel, and waits until at least
+// `min_complete` of them have completed, or for `timeout` microseconds
+// Returns the result of io_uring_enter
+int enterUring (uint32_t min_complete, int64_t timeout) {
+
+  if (timeout < 0) timeout = 0;
+  struct __kernel_timespec ts = {
+    .tv_sec = timeout / 1000000,
+    .tv_nsec = (timeout % 1000000) * 1000
+  };
+  struct io_uring_getevents_arg arg = { .ts = (uint64_t)(uintptr_t)&ts };
+
+  __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+  int result = syscall(
+    __NR_io_uring_enter, uring_fd, sq_unsubmitted, min_complete,
+    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)
+  );
+  if (result > 0) sq_unsubmitted -= (uint32_t)result < sq_unsubmitted ? (uint32_t)result : sq_unsubmitted;
+  return result;
+
+}
+
+void reapCompletions ();
+
+// Makes sure that `count` requests can be prepared, handing the ones
+// waiting over to the kernel if there isn't room. Requests linked to one
+// another have to be prepared in one go, as links end at a submission.
+void reserveSubmissions (int count) {
+  while (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) + count > sq_entries) {
+    enterUring(0, 0);
+    // The kernel refuses new requests while completions overflow
+    reapCompletions();
+  }
+}
+
+// Returns a cleared submission queue entry to prepare a request in
+struct io_uring_sqe *getSubmission () {
+  reserveSubmissions(1);
+  uint32_t index = sq_local_tail & *sq_mask;
+  struct io_uring_sqe *sqe = &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array[index] = index;
+  sq_local_tail ++;
+  sq_unsubmitted ++;
+  return sqe;
+}
+
+// Returns a receive buffer to the kernel
+void recycleBuffer (uint16_t id) {
+  struct io_uring_buf *buf = &uring_buffer_ring->bufs[uring_buffer_tail & (uring_buffer_count - 1)];
+  buf->addr = (uint64_t)(uintptr_t)(uring_buffers + (size_t)id * IO_URING_BUFFER_SIZE);
+  buf->len = IO_URING_BUFFER_SIZE;
+  buf->bid = id;
+  uring_buffer_tail ++;
+  __atomic_store_n(&uring_buffer_ring->tail, uring_buffer_tail, __ATOMIC_RELEASE);
+}
+
+// Starts accepting connections, as many as arrive, with a single request
+void armAccept () {
+  if (accept_armed) return;
+  struct io_uring_sqe *sqe = getSubmission();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = netpoll_server_fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = URING_ACCEPT;
+  accept_armed = true;
+}
+
+// Starts receiving from a client into a buffer of the kernel's choosing,
+// unless the client already holds as many buffers as it may
+void armRecv (Connection *connection) {
+  if (connection->recv_armed || connection->input_closed) return;
+  if (connection->input_buffers >= IO_URING_CLIENT_BUFFERS) return;
+  struct io_uring_sqe *sqe = getSubmission();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = connection->client_fd;
+  sqe->len = IO_URING_BUFFER_SIZE;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  sqe->user_data = URING_RECV | (connection - connections) << 8;
+  connection->recv_armed = true;
+}
+
+// Prepares a request to send part of a client's pending output. Sends
+// wait for all of their data to be taken, so that if `link` is set, the
+// next request only runs once this one has completed in full.
+void submitSend (Connection *connection, int part, const uint8_t *data, size_t length, uint8_t link) {
+  struct io_uring_sqe *sqe = getSubmission();
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = connection->client_fd;
+  sqe->addr = (uint64_t)(uintptr_t)data;
+  sqe->len = length;
+  sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+  sqe->flags = link ? IOSQE_IO_LINK : 0;
+  sqe->user_data = (URING_SEND + part) | (connection - connections) << 8;
+  connection->sends_underway ++;
+}
+
+// Adds whatever a receive brought in to its client's list of buffers
+void completeRecv (Connection *connection, int result, uint32_t flags) {
+
+  connection->recv_armed = false;
+  uint8_t has_buffer = (flags & IORING_CQE_F_BUFFER) != 0;
+  uint16_t id = flags >> IORING_CQE_BUFFER_SHIFT;
+
+  if (result > 0 && has_buffer && !connection->input_closed) {
+    uring_buffer_length[id] = result;
+    if (connection->input_buffers == 0) connection->input_first = id;
+    else uring_buffer_next[connection->input_last] = id;
+    connection->input_last = id;
+    connection->input_buffers ++;
+    connection->input_length += result;
+    connection->ready = true;
+    armRecv(connection);
+    return;
+  }
+
+  if (has_buffer) recycleBuffer(id);
+  // Out of buffers, try again on the next wait once some are free
+  if (result == -ENOBUFS) return;
+  // Cancelled while the connection is being closed
+  if (result == -ECANCELED || connection->input_closed) return;
+
+  connection->input_closed = true;
+  connection->input_error = result < 0 ? -result : 0;
+  connection->ready = true;
+
+}
+
+// Handles a single completed request
+void handleCompletion (uint64_t user_data, int result, uint32_t flags) {
+
+  int kind = user_data & 0xFF;
+
+  if (kind == URING_ACCEPT) {
+    if (!(flags & IORING_CQE_F_MORE)) accept_armed = false;
+    if (result < 0) return;
+    if (accepted_count == LISTEN_BACKLOG) {
+      // Like a full listen backlog, but the connection already exists
+      printf("Too many connections at once, closing fd: %d\n\n", result);
+      close(result);
+      return;
+    }
+    accepted_fds[accepted_count ++] = result;
+    return;
+  }
+  if (kind == URING_CANCEL) return;
+
+  Connection *connection = &connections[user_data >> 8];
+
+  if (kind == URING_RECV) {
+    // Connections are only closed once their requests have completed, so
+    // this shouldn't happen, but the buffer has to go back either way
+    if (connection->client_fd == -1) {
+      if (flags & IORING_CQE_F_BUFFER) recycleBuffer(flags >> IORING_CQE_BUFFER_SHIFT);
+      return;
+    }
+    completeRecv(connection, result, flags);
+    return;
+  }
+
+  if (connection->client_fd == -1) return;
+  connection->sends_underway --;
+  completeOutput(connection, kind - URING_SEND, result);
+  // Have the main loop follow up with more output, or with held chunks
+  connection->ready = true;
+
+}
+
+// Handles all completed requests, without waiting for any
+void reapCompletions () {
+  uint32_t head = *cq_head;
+  while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+    uint64_t user_data = cqe->user_data;
+    int result = cqe->res;
+    uint32_t flags = cqe->flags;
+    // Free up the entry first, as handling it might reap more
+    head ++;
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    handleCompletion(user_data, result, flags);
+  }
+}
+
+// Undoes whatever part of initUring succeeded
+void closeUring () {
+  if (sq_ring_map != MAP_FAILED) munmap(sq_ring_map, sq_ring_size);
+  if (cq_ring_map != MAP_FAILED && cq_ring_map != sq_ring_map) munmap(cq_ring_map, cq_ring_size);
+  if (sqes_map != MAP_FAILED) munmap(sqes_map, sqes_size);
+  if (uring_buffer_ring != MAP_FAILED) munmap(uring_buffer_ring, uring_buffer_ring_size);
+  free(uring_buffers);
+  free(uring_buffer_next);
+  free(uring_buffer_length);
+  sq_ring_map = cq_ring_map = sqes_map = MAP_FAILED;
+  uring_buffer_ring = MAP_FAILED;
+  uring_buffers = NULL;
+  uring_buffer_next = uring_buffer_length = NULL;
+  close(uring_fd);
+  uring_fd = -1;
+}
+
+/**
+ * Sets up io_uring for the given server socket, without liburing, through
+ * the raw system calls. Returns non-zero if the kernel lacks anything the
+ * server needs, in which case epoll is used instead. Provided buffer rings
+ * are the newest feature used, from Linux 5.19, which also brought
+ * multishot accept, MSG_WAITALL sends and cancelling by file descriptor.
+ */
+int initUring (int server_fd) {
+
+  #ifdef DEV_ENABLE_BEEF_DUMPS
+  // World dumps are read from and written to the socket directly
+  return 1;
+  #endif
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = IO_URING_QUEUE_SIZE * 4;
+
+  uring_fd = syscall(__NR_io_uring_setup, IO_URING_QUEUE_SIZE, &params);
+  if (uring_fd == -1) {
+    perror("io_uring_setup failed, using epoll instead");
+    return 1;
+  }
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+    printf("io_uring is too old, using epoll instead\n");
+    closeUring();
+    return 1;
+  }
+
+  // Map the rings, which share a single mapping on any kernel this new
+  sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (cq_ring_size > sq_ring_size) sq_ring_size = cq_ring_size;
+  cq_ring_size = sq_ring_size;
+  sq_ring_map = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring_fd, IORING_OFF_SQ_RING);
+  cq_ring_map = sq_ring_map;
+  sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_map = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring_fd, IORING_OFF_SQES);
+  if (sq_ring_map == MAP_FAILED || sqes_map == MAP_FAILED) {
+    perror("Mapping io_uring failed, using epoll instead");
+    closeUring();
+    return 1;
+  }
+
+  uint8_t *sq = sq_ring_map, *cq = cq_ring_map;
+  sq_head = (uint32_t *)(sq + params.sq_off.head);
+  sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+  sq_mask = (uint32_t *)(sq + params.sq_off.ring_mask);
+  sq_array = (uint32_t *)(sq + params.sq_off.array);
+  cq_head = (uint32_t *)(cq + params.cq_off.head);
+  cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+  cq_mask = (uint32_t *)(cq + params.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  sqes = sqes_map;
+  sq_entries = params.sq_entries;
+  sq_local_tail = *sq_tail;
+
+  // Enough receive buffers for every client to fill its share, rounded
+  // up to a power of two, as the buffer ring has to be
+  uring_buffer_count = 1;
+  while (uring_buffer_count < MAX_CONNECTIONS * IO_URING_CLIENT_BUFFERS) uring_buffer_count <<= 1;
+
+  uring_buffer_ring_size = uring_buffer_count * sizeof(struct io_uring_buf);
+  uring_buffer_ring = mmap(NULL, uring_buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  uring_buffers = malloc((size_t)uring_buffer_count * IO_URING_BUFFER_SIZE);
+  uring_buffer_next = malloc(uring_buffer_count * sizeof(uint16_t));
+  uring_buffer_length = malloc(uring_buffer_count * sizeof(uint16_t));
+  if (uring_buffer_ring == MAP_FAILED || uring_buffers == NULL || uring_buffer_next == NULL || uring_buffer_length == NULL) {
+    printf("Out of memory for io_uring buffers, using epoll instead\n");
+    closeUring();
+    return 1;
+  }
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)uring_buffer_ring;
+  reg.ring_entries = uring_buffer_count;
+  reg.bgid = 0;
+  if (syscall(__NR_io_uring_register, uring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    perror("io_uring has no provided buffer rings, using epoll instead");
+    closeUring();
+    return 1;
+  }
+
+  uring_buffer_tail = 0;
+  for (uint32_t i = 0; i < uring_buffer_count; i ++) recycleBuffer(i);
+
+  netpoll_server_fd = server_fd;
+  armAccept();
+  printf("Using io_uring for network I/O\n");
+  return 0;
+
+}
+
+// Reads from a client like recv() does, but from data that io_uring has
+// already received. Supports MSG_PEEK, and fails with EAGAIN when there's
+// nothing to read. Sockets without a connection are read directly.
+ssize_t recvInput (int client_fd, void *buf, size_t n, int flags) {
+
+  Connection *connection = isUringActive() ? getConnection(client_fd) : NULL;
+  if (connection == NULL) return recv(client_fd, buf, n, flags);
+
+  if (connection->input_length == 0) {
+    if (!connection->input_closed) {
+      errno = EAGAIN;
+      return -1;
+    }
+    if (connection->input_error == 0) return 0;
+    errno = connection->input_error;
+    return -1;
+  }
+
+  uint8_t peek = (flags & MSG_PEEK) != 0;
+  uint8_t *p = buf;
+  size_t total = 0;
+  uint16_t id = connection->input_first;
+  size_t offset = connection->input_offset;
+  int buffers = connection->input_buffers;
+
+  while (total < n && buffers > 0) {
+    size_t count = uring_buffer_length[id] - offset;
+    if (count > n - total) count = n - total;
+    memcpy(p + total, uring_buffers + (size_t)id * IO_URING_BUFFER_SIZE + offset, count);
+    total += count;
+    offset += count;
+    if (offset < uring_buffer_length[id]) break;
+    // Move on to the next buffer, giving this one back unless peeking
+    uint16_t next = uring_buffer_next[id];
+    if (!peek) recycleBuffer(id);
+    buffers --;
+    id = next;
+    offset = 0;
+  }
+
+  if (!peek) {
+    connection->input_first = id;
+    connection->input_offset = offset;
+    connection->input_buffers = buffers;
+    connection->input_length -= total;
+    // Having freed up buffers, the client may have more to receive
+    armRecv(connection);
+  }
+
+  return total;
+
+}
+
+// Returns whether a whole packet (or anything that can't be waited out,
+// such as the end of the connection) has been received from a client.
+// Packets too large to be held in the client's buffers are let through
+// as soon as those are full, and get read as the rest comes in.
+uint8_t isPacketReceived (int client_fd) {
+
+  Connection *connection = isUringActive() ? getConnection(client_fd) : NULL;
+  if (connection == NULL) return true;
+  if (connection->input_closed) return true;
+  if (connection->input_buffers >= IO_URING_CLIENT_BUFFERS) return true;
+
+  uint8_t header[VARINT_MAX_SIZE];
+  ssize_t available = recvInput(client_fd, header, sizeof(header), MSG_PEEK);
+  if (available <= 0) return false;
+  int offset = 0;
+  int32_t length = decodeVarInt(header, available, &offset);
+  // An invalid length can only get worse with more data
+  if (length == VARNUM_ERROR) return available == sizeof(header);
+
+  return connection->input_length >= (uint32_t)offset + (uint32_t)length;
+
+}
+
+// Waits briefly for more data to come in, for reads that have run out of
+// it mid-packet. Completions of any other requests are handled as well.
+void waitForInput () {
+  if (!isUringActive()) return;
+  enterUring(1, 1000);
+  reapCompletions();
+}
+
+// Takes a connection accepted through io_uring, as accept() would
+// Returns -1 if there are none left
+int acceptQueuedClient (struct sockaddr_in *client_addr) {
+
+  if (accepted_count == 0) return -1;
+  int client_fd = accepted_fds[0];
+  accepted_count --;
+  memmove(accepted_fds, accepted_fds + 1, accepted_count * sizeof(int));
+
+  // Multishot accepts can't report addresses, so ask for it separately
+  socklen_t addr_len = sizeof(*client_addr);
+  if (getpeername(client_fd, (struct sockaddr *)client_addr, &addr_len) == -1) {
+    memset(client_addr, 0, sizeof(*client_addr));
+  }
+  return client_fd;
+
+}
+
+/**
+ * Sleeps until something has completed, or the given deadline (in program
+ * time) has passed. Before going to sleep, hands the kernel everything
+ * prepared since the last wait, such as output queued during this pass of
+ * the main loop, all in one system call. Connections that got data, had
+ * output sent, or still hold a whole packet get their `ready` flag set.
+ * Returns whether a connection can be accepted.
+ */
+uint8_t waitForUring (int64_t deadline) {
+
+  uint8_t busy = accepted_count > 0;
+  armAccept();
+
+  for (int i = 0; i < MAX_CONNECTIONS; i ++) {
+    Connection *connection = &connections[i];
+    if (connection->client_fd == -1) continue;
+    // Retry receives that had run out of buffers
+    armRecv(connection);
+    // Send whatever was queued up since the last wait
+    if (connection->pending.active && connection->sends_underway == 0 && !connection->closing) {
+      submitPendingOutput(connection);
+    }
+    // As with level-triggered epoll, stay on clients that have more to do,
+    // and on those that are to be disconnected, see abortConnection
+    if (connection->closing) connection->ready = true;
+    if (!connection->ready && connection->input_length > 0 && isPacketReceived(connection->client_fd)) {
+      connection->ready = true;
+    }
+    if (connection->ready) busy = true;
+  }
+
+  enterUring(busy ? 0 : 1, busy ? 0 : deadline - get_program_time());
+  reapCompletions();
+
+  return accepted_count > 0;
+
+}
+
+/**
+ * Stops all io_uring requests for a client before its connection slot is
+ * freed, as they reference the slot's buffers. Output that was about to
+ * be sent, such as a kick message, is handed to the kernel first, which
+ * sends whatever the socket can take right away. Unread input is dropped.
+ */
+void unwatchUring (Connection *connection) {
+
+  connection->input_closed = true;
+
+  struct io_uring_sqe *sqe = getSubmission();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = connection->client_fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe->user_data = URING_CANCEL;
+
+  // Cancelling requests that wait on the socket completes them right away,
+  // but in case one can't be, shutting the socket down fails it instead
+  for (int i = 0; connection->recv_armed || connection->sends_underway > 0; i ++) {
+    if (i == 1) shutdown(connection->client_fd, SHUT_RDWR);
+    enterUring(1, 1000);
+    reapCompletions();
+  }
+
+  int buffers = connection->input_buffers;
+  uint16_t id = connection->input_first;
+  for (int i = 0; i < buffers; i ++) {
+    uint16_t next = uring_buffer_next[id];
+    recycleBuffer(id);
+    id = next;
+  }
+  connection->input_buffers = 0;
+  connection->input_length = 0;
+
+}
+
+#endif
+
+// Sets up io_uring or epoll for the given server socket. On failure, the
+// main loop goes back to checking every client on every iteration.
+void initNetPoll (int server_fd) {
+
+  #ifdef ENABLE_IO_URING
+  if (initUring(server_fd) == 0) return;
+  #endif
+
+  netpoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (netpoll_fd == -1) {
+    perror("epoll_create1 failed, checking clients in a loop instead");
+    return;
+  }
+
+  struct epoll_event event = { .events = EPOLLIN, .data.fd = server_fd };
+  if (epoll_ctl(netpoll_fd, EPOLL_CTL_ADD, server_fd, &event) == -1) {
+    perror("epoll_ctl failed, checking clients in a loop instead");
+    close(netpoll_fd);
+    netpoll_fd = -1;
+    return;
+  }
+  netpoll_server_fd = server_fd;
+
+}
+
+// Starts watching a newly accepted client for incoming data
+// Clients are removed from epoll automatically when their socket closes
+void watchConnection (int client_fd) {
+  #ifdef ENABLE_IO_URING
+  if (isUringActive()) {
+    Connection *connection = getConnection(client_fd);
+    if (connection != NULL) armRecv(connection);
+    return;
+  }
+  #endif
+  if (netpoll_fd == -1) return;
+  struct epoll_event event = { .events = EPOLLIN, .data.fd = client_fd };
+  epoll_ctl(netpoll_fd, EPOLL_CTL_ADD, client_fd, &event);
+}
+
+// Stops watching a client, right before its connection slot is freed
+void unwatchConnection (int client_fd) {
+  #ifdef ENABLE_IO_URING
+  if (isUringActive()) {
+    Connection *connection = getConnection(client_fd);
+    if (connection != NULL) unwatchUring(connection);
+  }
+  #endif
+}
+
+// Adds or removes events that epoll watches a client for, besides EPOLLIN
+void setConnectionEvents (int client_fd, uint32_t events, uint8_t set) {
+  if (netpoll_fd == -1) return;
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL) return;
+  uint32_t updated = set ? connection->poll_events | events : connection->poll_events & ~events;
+  if (updated == connection->poll_events) return;
+  connection->poll_events = updated;
+  struct epoll_event event = { .events = EPOLLIN | updated, .data.fd = client_fd };
+  epoll_ctl(netpoll_fd, EPOLL_CTL_MOD, client_fd, &event);
+}
+
+// Sets whether to also wake up once a client's socket can take more
+// output, for as long as it has output queued. With io_uring, completed
+// sends wake us up anyway.
+void watchConnectionOutput (int client_fd, uint8_t watch) {
+  setConnectionEvents(client_fd, EPOLLOUT, watch);
+}
+
+// Sets whether a client only gets reported once it sends more data, as
+// opposed to whenever it has any unread data at all. Used while only
+// part of a packet header has arrived, which can't be read yet, and
+// would otherwise have the main loop wake up for it again and again.
+// With io_uring, clients are only ever reported for new data.
+void watchNewInputOnly (int client_fd, uint8_t only_new) {
+  setConnectionEvents(client_fd, EPOLLET, only_new);
+}
+
+/**
+ * Sleeps until a client has sent something, a client with queued output
+ * can take more of it, a connection is waiting to be accepted, or the
+ * given deadline (in program time) has passed. Connections with anything
+ * to do get their `ready` flag set. Since epoll is level-triggered, a
+ * client with several packets waiting is reported again on the next call.
+ * Returns whether a connection can be accepted.
+ */
+uint8_t waitForActivity (int64_t deadline) {
+
+  #ifdef ENABLE_IO_URING
+  if (isUringActive()) return waitForUring(deadline);
+  #endif
+
+  int64_t wait = deadline - get_program_time();
+  int timeout = wait <= 0 ? 0 : (int)((wait + 999) / 1000);
+
+  struct epoll_event events[MAX_CONNECTIONS + 1];
+  int count = epoll_wait(netpoll_fd, events, MAX_CONNECTIONS + 1, timeout);
+
+  uint8_t can_accept = false;
+  for (int i = 0; i < count; i ++) {
+    if (events[i].data.fd == netpoll_server_fd) {
+      can_accept = true;
+      continue;
+    }
+    Connection *connection = getConnection(events[i].data.fd);
+    if (connection != NULL) connection->ready = true;
+  }
+
+  return can_accept;
+
+}
+
+#endif
@@ -23,25 +23,109 @@
 #include "crafting.h"
 #include "procedures.h"
 #include "packets.h"
+#include "stats.h"
+#include "compression.h"
+
+// The Status Response packet, with the JSON at STATUS_HEADER_SIZE and its
+// header right in front of it, starting at status_response_start
+uint8_t status_response[STATUS_RESPONSE_SIZE];
+size_t status_response_start = 0;
+size_t status_response_length = 0; // 0 if outdated
+
+// Marks the cached Status Response as outdated, call this whenever
+// anything listed in it changes
+void invalidateStatusResponse () {
+  status_response_length = 0;
+}
 
-// S->C Status Response (server list ping)
-int sc_statusResponse (int client_fd) {
+// Copies a string into the Status Response JSON, replacing anything that
+// would need escaping. Returns the new end of the JSON.
+char *appendStatusString (char *json, const char *end, const char *string, size_t length) {
+  for (size_t i = 0; i < length && json < end; i ++) {
+    char c = string[i];
+    *json ++ = (c < 0x20 || c > 0x7E || c == '"' || c == '\\') ? '?' : c;
+  }
+  return json;
+}
 
-  char header[] = "{"
-    "\"version\":{\"name\":\"1.21.8\",\"protocol\":772},"
-    "\"description\":{\"text\":\"";
-  char footer[] = "\"}}";
+// Moves past what snprintf wrote to the Status Response JSON. It returns
+// the length it would have written without truncation, which can be past
+// the end of the buffer. Returns the new end of the JSON.
+char *advanceStatusJson (char *json, const char *end, int written) {
+  if (written <= 0 || json >= end) return json;
+  // On truncation, the last byte of the buffer holds the null terminator
+  if (written >= end - json) return (char *)end - 1;
+  return json + written;
+}
 
-  uint16_t string_len = sizeof(header) + sizeof(footer) + motd_len - 2;
+// Fixed parts of the JSON that come after the player sample
+#define STATUS_JSON_DESCRIPTION "]},\"description\":{\"text\":\""
+#define STATUS_JSON_END "\"}}"
+
+// Serializes the Status Response packet into status_response
+void buildStatusResponse () {
+
+  char *start = (char *)status_response + STATUS_HEADER_SIZE;
+  char *end = (char *)status_response + STATUS_RESPONSE_SIZE;
+  char *json = start;
+  // Always leave room to close off the JSON after the player sample
+  const char *sample_end = end - sizeof(STATUS_JSON_DESCRIPTION) - sizeof(STATUS_JSON_END);
+
+  json = advanceStatusJson(json, end, snprintf(json, end - json,
+    "{\"version\":{\"name\":\"1.21.8\",\"protocol\":772},"
+    "\"players\":{\"max\":%d,\"online\":%d,\"sample\":[",
+    MAX_PLAYERS, online_player_count
+  ));
+
+  // Each entry takes up to 91 bytes, stop listing players once out of room
+  int listed = 0;
+  FOR_EACH_ONLINE_PLAYER(player) {
+    if (listed == STATUS_PLAYER_SAMPLE) break;
+    if (sample_end - json < 96) break;
+    if (listed ++ > 0) *json ++ = ',';
+    json = advanceStatusJson(json, end, snprintf(json, end - json, "{\"name\":\""));
+    json = appendStatusString(json, end, player->name, strnlen(player->name, 16));
+    uint8_t *uuid = player->uuid;
+    json = advanceStatusJson(json, end, snprintf(json, end - json,
+      "\",\"id\":\"%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x\"}",
+      uuid[0], uuid[1], uuid[2], uuid[3], uuid[4], uuid[5], uuid[6], uuid[7],
+      uuid[8], uuid[9], uuid[10], uuid[11], uuid[12], uuid[13], uuid[14], uuid[15]
+    ));
+  }
 
-  writeVarInt(client_fd, 1 + string_len + sizeVarInt(string_len));
-  writeByte(client_fd, 0x00);
+  json = advanceStatusJson(json, end, snprintf(json, end - json, STATUS_JSON_DESCRIPTION));
+  // The MOTD gets whatever room is left, minus the closing characters
+  json = appendStatusString(json, end - sizeof(STATUS_JSON_END), motd, motd_len);
+  json = advanceStatusJson(json, end, snprintf(json, end - json, STATUS_JSON_END));
+
+  // Write the packet header into the space left in front of the JSON
+  uint32_t json_length = json - start;
+  uint8_t *sink = memory_sink;
+  size_t sink_size = memory_sink_size, sink_length = memory_sink_length;
+  status_response_start = STATUS_HEADER_SIZE - (
+    sizeVarInt(1 + sizeVarInt(json_length) + json_length) + 1 + sizeVarInt(json_length)
+  );
+  memory_sink = status_response + status_response_start;
+  memory_sink_size = STATUS_HEADER_SIZE - status_response_start;
+  memory_sink_length = 0;
+
+  writeVarInt(MEMORY_SINK_FD, 1 + sizeVarInt(json_length) + json_length);
+  writeByte(MEMORY_SINK_FD, 0x00);
+  writeVarInt(MEMORY_SINK_FD, json_length);
+
+  memory_sink = sink;
+  memory_sink_size = sink_size;
+  memory_sink_length = sink_length;
 
-  writeVarInt(client_fd, string_len);
-  send_all(client_fd, header, sizeof(header) - 1);
-  send_all(client_fd, motd, motd_len);
-  send_all(client_fd, footer, sizeof(footer) - 1);
+  status_response_length = STATUS_HEADER_SIZE - status_response_start + json_length;
 
+}
+
+// S->C Status Response (server list ping)
+// The packet is cached, and only rebuilt once the player list changes
+int sc_statusResponse (int client_fd) {
+  if (status_response_length == 0) buildStatusResponse();
+  send_all(client_fd, status_response + status_response_start, status_response_length);
   return 0;
 }
 
@@ -57,6 +141,16 @@ int cs_handshake (int client_fd) {
   int intent = readVarInt(client_fd);
   if (intent == VARNUM_ERROR) return 1;
   printf("  Intent: %d\n\n", intent);
+
+  // Drop the connection if there's no room for it
+  if (!admitConnection(client_fd, intent)) {
+    printf("No room for this connection, dropping it\n\n");
+    // Players get told why, pings just see the server as unreachable
+    if (intent != STATE_STATUS) sc_loginDisconnect(client_fd, "Server is full");
+    recv_count = 0;
+    return 1;
+  }
+
   setClientState(client_fd, intent);
 
   return 0;
@@ -81,6 +175,38 @@ int cs_loginStart (int client_fd, uint8_t *uuid, char *name) {
   return 0;
 }
 
+// S->C Disconnect (login)
+// The reason is sent as a JSON text component, so it must not contain
+// any characters that would need escaping.
+int sc_loginDisconnect (int client_fd, const char *reason) {
+  char json[128];
+  int length = snprintf(json, sizeof(json), "{\"text\":\"%s\"}", reason);
+  if (length >= (int)sizeof(json)) length = sizeof(json) - 1;
+
+  writeVarInt(client_fd, 1 + sizeVarInt(length) + length);
+  writeByte(client_fd, 0x00);
+  writeVarInt(client_fd, length);
+  send_all(client_fd, json, length);
+
+  return 0;
+}
+
+#ifdef ENABLE_COMPRESSION
+// S->C Set Compression
+int sc_setCompression (int client_fd) {
+  printf("Sending Set Compression...\n\n");
+
+  writeVarInt(client_fd, 1 + sizeVarInt(COMPRESSION_THRESHOLD));
+  writeVarInt(client_fd, 0x03);
+  writeVarInt(client_fd, COMPRESSION_THRESHOLD);
+
+  // All packets after this one use the compressed packet format
+  enableCompression(client_fd);
+
+  return 0;
+}
+#endif
+
 // S->C Login Success
 int sc_loginSuccess (int client_fd, uint8_t *uuid, char *name) {
   printf("Sending Login Success...\n\n");
@@ -105,6 +231,16 @@ int cs_clientInformation (int client_fd) {
   tmp = readByte(client_fd);
   if (recv_count == -1) return 1;
   printf("  View distance: %d\n", tmp);
+  // Honor the requested view distance, within the server's limits
+  PlayerData *player;
+  if (getPlayerData(client_fd, &player) == 0) {
+    PlayerView *view = &player_view[player - player_data];
+    if (tmp > VIEW_DISTANCE) tmp = VIEW_DISTANCE;
+    if (tmp < MIN_VIEW_DISTANCE) tmp = MIN_VIEW_DISTANCE;
+    view->requested = tmp;
+    // In-game, tickViewDistance takes care of the transition
+    if (getClientState(client_fd) != STATE_PLAY) view->current = tmp;
+  }
   tmp = readVarInt(client_fd);
   if (recv_count == -1) return 1;
   printf("  Chat mode: %d\n", tmp);
@@ -133,20 +269,6 @@ int cs_clientInformation (int client_fd) {
   return 0;
 }
 
-// S->C Clientbound Known Packs
-int sc_knownPacks (int client_fd) {
-  printf("Sending Server's Known Packs\n\n");
-  char known_packs[] = {
-    0x0e, 0x01, 0x09, 0x6d, 0x69, 0x6e,
-    0x65, 0x63, 0x72, 0x61, 0x66, 0x74, 0x04, 0x63,
-    0x6f, 0x72, 0x65, 0x06, 0x31, 0x2e, 0x32, 0x31,
-    0x2e, 0x38
-  };
-  writeVarInt(client_fd, 24);
-  send_all(client_fd, &known_packs, 24);
-  return 0;
-}
-
 // C->S Serverbound Plugin Message
 int cs_pluginMessage (int client_fd) {
   printf("Received Plugin Message:\n");
@@ -179,17 +301,16 @@ int sc_sendPluginMessage (int client_fd, const char *channel, const uint8_t *dat
   return 0;
 }
 
-// S->C Finish Configuration
-int sc_finishConfiguration (int client_fd) {
-  writeVarInt(client_fd, 1);
-  writeVarInt(client_fd, 0x03);
-  return 0;
-}
-
 // S->C Login (play)
 int sc_loginPlay (int client_fd) {
 
-  writeVarInt(client_fd, 47 + sizeVarInt(MAX_PLAYERS) + sizeVarInt(VIEW_DISTANCE) * 2);
+  uint8_t view_distance = VIEW_DISTANCE;
+  PlayerData *player;
+  if (getPlayerData(client_fd, &player) == 0) {
+    view_distance = player_view[player - player_data].current;
+  }
+
+  writeVarInt(client_fd, 47 + sizeVarInt(MAX_PLAYERS) + sizeVarInt(view_distance) * 2);
   writeByte(client_fd, 0x2B);
   // entity id
   writeUint32(client_fd, client_fd);
@@ -203,9 +324,9 @@ int sc_loginPlay (int client_fd) {
   // maxplayers
   writeVarInt(client_fd, MAX_PLAYERS);
   // view distance
-  writeVarInt(client_fd, VIEW_DISTANCE);
+  writeVarInt(client_fd, view_distance);
   // sim distance
-  writeVarInt(client_fd, VIEW_DISTANCE);
+  writeVarInt(client_fd, view_distance);
   // reduced debug info
   writeByte(client_fd, 0);
   // respawn screen
@@ -327,87 +448,171 @@ int sc_setCenterChunk (int client_fd, int x, int y) {
   return 0;
 }
 
-// S->C Chunk Data and Update Light
-int sc_chunkDataAndUpdateLight (int client_fd, int _x, int _z) {
+// S->C Unload Chunk
+int sc_unloadChunk (int client_fd, int x, int z) {
+  writeVarInt(client_fd, 9);
+  writeByte(client_fd, 0x21);
+  writeUint32(client_fd, z);
+  writeUint32(client_fd, x);
+  return 0;
+}
+
+// S->C Set Render Distance
+int sc_setRenderDistance (int client_fd, int distance) {
+  writeVarInt(client_fd, 1 + sizeVarInt(distance));
+  writeByte(client_fd, 0x58);
+  writeVarInt(client_fd, distance);
+  return 0;
+}
+
+// The Chunk Data packet is built in pieces, one chunk section or light
+// array at a time, into this buffer. A chunk section is the largest.
+uint8_t chunk_piece[4103 + 2 + sizeof(network_block_palette)];
+const size_t chunk_piece_size = sizeof(chunk_piece);
+
+// Big-endian writes into a buffer, returning the end of what was written
+uint8_t *putUint16 (uint8_t *p, uint16_t value) {
+  p[0] = value >> 8;
+  p[1] = value;
+  return p + 2;
+}
+uint8_t *putUint32 (uint8_t *p, uint32_t value) {
+  return putUint16(putUint16(p, value >> 16), value);
+}
+uint8_t *putUint64 (uint8_t *p, uint64_t value) {
+  return putUint32(putUint32(p, value >> 32), value);
+}
+
+// Writes `count` chunk sections with no blocks, filled with the given block
+uint8_t *putEmptySections (uint8_t *p, int count, int block) {
+  for (int i = 0; i < count; i ++) {
+    p = putUint16(p, 4096); // block count
+    *p ++ = 0; // block bits
+    p += encodeVarInt(p, block); // block palette
+    *p ++ = 0; // biome bits
+    *p ++ = 0; // biome palette
+  }
+  return p;
+}
+
+// Builds the given piece (0 to CHUNK_PIECE_COUNT - 1) of the Chunk Data
+// packet for a chunk into `buf`, which needs room for chunk_piece_size
+// bytes, and returns the length of the piece. Pieces are
+// built independently of each other, so that queueChunk can send a chunk
+// bit by bit as the client's socket takes it. If `framed` is set, the
+// packet gets the header of an uncompressed packet in the compressed format.
+size_t buildChunkPiece (uint8_t *buf, int piece, int _x, int _z, uint8_t framed) {
 
   const int chunk_data_size = (4101 + sizeVarInt(256) + sizeof(network_block_palette)) * 20 + 6 * 12;
   const int light_data_size = 14 + (sizeVarInt(2048) + 2048) * 26;
 
-  writeVarInt(client_fd, 11 + sizeVarInt(chunk_data_size) + chunk_data_size + light_data_size);
-  writeByte(client_fd, 0x27);
+  uint8_t *p = buf;
 
-  writeUint32(client_fd, _x);
-  writeUint32(client_fd, _z);
+  if (piece == 0) {
 
-  writeVarInt(client_fd, 0); // omit heightmaps
+    int length = 11 + sizeVarInt(chunk_data_size) + chunk_data_size + light_data_size;
+    if (framed) {
+      p += encodeVarInt(p, length + 1);
+      *p ++ = 0; // data length, 0 as not compressed
+    } else p += encodeVarInt(p, length);
+    *p ++ = 0x27;
 
-  writeVarInt(client_fd, chunk_data_size);
+    p = putUint32(p, _x);
+    p = putUint32(p, _z);
 
-  int x = _x * 16, z = _z * 16, y;
+    p += encodeVarInt(p, 0); // omit heightmaps
 
-  // send 4 chunk sections (up to Y=0) with no blocks
-  for (int i = 0; i < 4; i ++) {
-    writeUint16(client_fd, 4096); // block count
-    writeByte(client_fd, 0); // block bits
-    writeVarInt(client_fd, 85); // block palette (bedrock)
-    writeByte(client_fd, 0); // biome bits
-    writeByte(client_fd, 0); // biome palette
-  }
-  // yield to idle task
-  task_yield();
-
-  // send chunk sections
-  for (int i = 0; i < 20; i ++) {
-    y = i * 16;
-    writeUint16(client_fd, 4096); // block count
-    writeByte(client_fd, 8); // bits per entry
-    writeVarInt(client_fd, 256); // block palette length
+    p += encodeVarInt(p, chunk_data_size);
+
+    // send 4 chunk sections (up to Y=0) with no blocks
+    p = putEmptySections(p, 4, 85); // bedrock
+
+  } else if (piece <= 20) {
+
+    // send chunk sections
+    p = putUint16(p, 4096); // block count
+    *p ++ = 8; // bits per entry
+    p += encodeVarInt(p, 256); // block palette length
     // block palette as varint buffer
-    send_all(client_fd, network_block_palette, sizeof(network_block_palette));
+    memcpy(p, network_block_palette, sizeof(network_block_palette));
+    p += sizeof(network_block_palette);
     // chunk section buffer
-    uint8_t biome = buildChunkSection(x, y, z);
-    send_all(client_fd, chunk_section, 4096);
+    uint8_t biome = buildChunkSection(_x * 16, (piece - 1) * 16, _z * 16);
+    memcpy(p, chunk_section, 4096);
+    p += 4096;
     // biome data
-    writeByte(client_fd, 0); // bits per entry
-    writeByte(client_fd, biome); // biome palette
-    // yield to idle task
-    task_yield();
-  }
+    *p ++ = 0; // bits per entry
+    *p ++ = biome; // biome palette
+
+  } else if (piece == 21) {
+
+    // send 8 chunk sections (up to Y=192) with no blocks
+    p = putEmptySections(p, 8, 0); // air
+
+    p += encodeVarInt(p, 0); // omit block entities
+
+    // light data
+    p += encodeVarInt(p, 1);
+    p = putUint64(p, 0b11111111111111111111111111);
+    p += encodeVarInt(p, 0);
+    p += encodeVarInt(p, 0);
+    p += encodeVarInt(p, 0);
+
+    // sky light array
+    p += encodeVarInt(p, 26);
+
+  } else if (piece < CHUNK_PIECE_COUNT - 1) {
+
+    // sky light sections, dark for the bottom 8, fully lit above
+    p += encodeVarInt(p, 2048);
+    memset(p, piece - 22 < 8 ? 0 : 0xFF, 2048);
+    p += 2048;
+
+  } else {
+
+    // don't send block light
+    p += encodeVarInt(p, 0);
 
-  // send 8 chunk sections (up to Y=192) with no blocks
-  for (int i = 0; i < 8; i ++) {
-    writeUint16(client_fd, 4096); // block count
-    writeByte(client_fd, 0); // block bits
-    writeVarInt(client_fd, 0); // block palette (air)
-    writeByte(client_fd, 0); // biome bits
-    writeByte(client_fd, 0); // biome palette
   }
-  // yield to idle task
-  task_yield();
 
-  writeVarInt(client_fd, 0); // omit block entities
+  return p - buf;
 
-  // light data
-  writeVarInt(client_fd, 1);
-  writeUint64(client_fd, 0b11111111111111111111111111);
-  writeVarInt(client_fd, 0);
-  writeVarInt(client_fd, 0);
-  writeVarInt(client_fd, 0);
+}
 
-  // sky light array
-  writeVarInt(client_fd, 26);
-  for (int i = 0; i < 2048; i ++) chunk_section[i] = 0xFF;
-  for (int i = 2048; i < 4096; i ++) chunk_section[i] = 0;
-  for (int i = 0; i < 8; i ++) {
-    writeVarInt(client_fd, 2048);
-    send_all(client_fd, chunk_section + 2048, 2048);
+// S->C Chunk Data and Update Light
+// Returns 1 if the chunk can't be sent until the client's queued output
+// has drained, in which case nothing was sent
+int sc_chunkDataAndUpdateLight (int client_fd, int _x, int _z) {
+
+  uint8_t framed = false;
+  #ifdef ENABLE_COMPRESSION
+  // Compressed chunks get sent from the cache where possible
+  if (isCompressionEnabled(client_fd)) {
+    int result = sendCachedChunk(client_fd, _x, _z);
+    if (result != 1) return result;
+    // Otherwise, send the chunk without compressing it
+    framed = true;
   }
-  for (int i = 0; i < 18; i ++) {
-    writeVarInt(client_fd, 2048);
-    send_all(client_fd, chunk_section, 2048);
+  #endif
+
+  #ifdef DEV_ENABLE_STATS
+    int64_t start = get_program_time();
+  #endif
+
+  if (client_fd == MEMORY_SINK_FD || memory_sink_all || getConnection(client_fd) == NULL) {
+    // Written out as usual, so send_all takes care of framing
+    for (int i = 0; i < CHUNK_PIECE_COUNT; i ++) {
+      send_all(client_fd, chunk_piece, buildChunkPiece(chunk_piece, i, _x, _z, false));
+      // yield to idle task
+      task_yield();
+    }
+  } else {
+    // Uncompressed chunks are larger than the outbound queue, and so get
+    // sent piece by piece as the client's socket takes them
+    if (!queueChunk(client_fd, _x, _z, framed)) return 1;
   }
-  // don't send block light
-  writeVarInt(client_fd, 0);
+
+  int x = _x * 16, z = _z * 16;
 
   // Sending block updates changes light prediciton on the client.
   // Light-emitting blocks are omitted from chunk data so that they can
@@ -415,26 +620,134 @@ int sc_chunkDataAndUpdateLight (int client_fd, int _x, int _z) {
   // block light data.
   for (int i = 0; i < block_changes_count; i ++) {
     #ifdef ALLOW_CHESTS
-      if (block_changes[i].block != B_torch && block_changes[i].block != B_chest) continue;
+      if (!(block_properties[block_changes[i].block] & BLOCK_LIGHT_SOURCE) && block_changes[i].block != B_chest) continue;
     #else
-      if (block_changes[i].block != B_torch) continue;
+      if (!(block_properties[block_changes[i].block] & BLOCK_LIGHT_SOURCE)) continue;
     #endif
     if (block_changes[i].x < x || block_changes[i].x >= x + 16) continue;
     if (block_changes[i].z < z || block_changes[i].z >= z + 16) continue;
     sc_blockUpdate(client_fd, block_changes[i].x, block_changes[i].y, block_changes[i].z, block_changes[i].block);
   }
 
+  #ifdef DEV_ENABLE_STATS
+    statsRecordChunk(get_program_time() - start);
+  #endif
+
   return 0;
 
 }
 
+#ifdef ENABLE_COMPRESSION
+ChunkCacheEntry chunk_cache[CHUNK_CACHE_SIZE];
+// Incremented to invalidate all entries at once
+uint32_t chunk_cache_generation = 1;
+// Where chunks are built before being copied into the cache
+uint8_t chunk_cache_scratch[CHUNK_CACHE_SCRATCH_SIZE];
+
+// Neighboring chunks map to neighboring entries, so that (by default)
+// any 8x8 area of chunks fits in the cache without collisions
+ChunkCacheEntry *getChunkCacheEntry (short x, short z) {
+  return &chunk_cache[mod_abs(x + z * 8, CHUNK_CACHE_SIZE)];
+}
+
+// Sends the compressed form of a chunk, compressing it first if it isn't
+// cached yet. Returns 1 if the chunk is known to be too large to cache, or
+// doesn't fit in the client's outbound queue, in which case nothing was
+// sent, and -1 if sending failed.
+int sendCachedChunk (int client_fd, short x, short z) {
+
+  ChunkCacheEntry *entry = getChunkCacheEntry(x, z);
+
+  if (entry->x == x && entry->z == z && entry->generation == chunk_cache_generation) {
+    if (entry->uncacheable) return 1;
+    if (entry->length != 0) {
+      if (entry->length > getOutputRoom(client_fd)) return 1;
+      if (send_raw(client_fd, entry->data, entry->length) == -1) return -1;
+      return 0;
+    }
+  }
+
+  // Borrow the memory sink to build the chunk
+  uint8_t *sink = memory_sink;
+  size_t sink_size = memory_sink_size, sink_length = memory_sink_length;
+  memory_sink = chunk_cache_scratch;
+  memory_sink_size = CHUNK_CACHE_SCRATCH_SIZE;
+  memory_sink_length = 0;
+
+  memory_sink_compressed = true;
+  sc_chunkDataAndUpdateLight(MEMORY_SINK_FD, x, z);
+  memory_sink_compressed = false;
+
+  size_t length = memory_sink_length;
+  memory_sink = sink;
+  memory_sink_size = sink_size;
+  memory_sink_length = sink_length;
+
+  entry->x = x;
+  entry->z = z;
+  entry->generation = chunk_cache_generation;
+  entry->uncacheable = length > CHUNK_CACHE_ENTRY_SIZE;
+  entry->length = entry->uncacheable ? 0 : length;
+  if (!entry->uncacheable) memcpy(entry->data, chunk_cache_scratch, length);
+
+  // The scratch buffer only holds part of chunks larger than itself
+  if (length > CHUNK_CACHE_SCRATCH_SIZE || length > getOutputRoom(client_fd)) return 1;
+
+  if (send_raw(client_fd, chunk_cache_scratch, length) == -1) return -1;
+  return 0;
+
+}
+
+// Drops the cached copy of the given chunk, if any
+void invalidateChunkCache (short x, short z) {
+  ChunkCacheEntry *entry = getChunkCacheEntry(x, z);
+  if (entry->x == x && entry->z == z) {
+    entry->length = 0;
+    entry->uncacheable = false;
+  }
+}
+
+// Drops all cached chunks
+void clearChunkCache () {
+  chunk_cache_generation ++;
+}
+#endif
+
 // S->C Clientbound Keep Alive (play)
-int sc_keepAlive (int client_fd) {
+// The ID is echoed back by the client, we use it to measure latency
+int sc_keepAlive (int client_fd, uint64_t id) {
 
   writeVarInt(client_fd, 9);
   writeByte(client_fd, 0x26);
 
-  writeUint64(client_fd, 0);
+  writeUint64(client_fd, id);
+
+  return 0;
+}
+
+// C->S Serverbound Keep Alive (play)
+int cs_keepAlive (int client_fd) {
+
+  // Keep Alive IDs are the timestamps at which they were sent
+  int64_t sent_time = (int64_t)readUint64(client_fd);
+
+  PlayerData *player;
+  if (getPlayerData(client_fd, &player)) return 1;
+  int player_index = player - player_data;
+
+  // Ignore IDs from the future, or from before the timeout window
+  int64_t now = get_program_time();
+  int64_t round_trip = now - sent_time;
+  if (round_trip < 0 || round_trip > KEEPALIVE_TIMEOUT) return 1;
+
+  player_keepalive_time[player_index] = now;
+
+  // Smooth out latency with an exponential moving average
+  uint32_t sample = round_trip / 1000;
+  if (sample > 65535) sample = 65535;
+  uint16_t *latency = &player_latency[player_index];
+  if (*latency == 0) *latency = sample;
+  else *latency = (*latency * 3 + sample) / 4;
 
   return 0;
 }
@@ -795,15 +1108,9 @@ int cs_swingArm (int client_fd) {
     return 1;
 
   // Forward animation to all connected players
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    PlayerData* other_player = &player_data[i];
-
-    if (other_player->client_fd == -1) continue;
-    if (other_player->client_fd == player->client_fd) continue;
-    if (other_player->flags & 0x20) continue;
-
-    sc_entityAnimation(other_player->client_fd, player->client_fd, animation);
-  }
+  beginBroadcast();
+  sc_entityAnimation(MEMORY_SINK_FD, player->client_fd, animation);
+  endBroadcast(player->client_fd, BROADCAST_KEEPING_UP, NULL, NULL);
 
   return 0;
 }
@@ -878,6 +1185,31 @@ int sc_playerInfoUpdateAddPlayer (int client_fd, PlayerData player) {
   return 0;
 }
 
+// S->C Player Info Update, "Update Latency" action
+// Sends the latency of every loaded player in one packet
+int sc_playerInfoUpdateLatency (int client_fd) {
+
+  int count = loaded_player_count, length = 0;
+  FOR_EACH_LOADED_PLAYER(player) {
+    length += 16 + sizeVarInt(player_latency[player - player_data]);
+  }
+  if (count == 0) return 0;
+  length += 2 + sizeVarInt(count);
+
+  writeVarInt(client_fd, length); // Packet length
+  writeByte(client_fd, 0x3F); // Packet ID
+
+  writeByte(client_fd, 0x10); // EnumSet: Update Latency
+  writeVarInt(client_fd, count); // Player count
+
+  FOR_EACH_LOADED_PLAYER(player) {
+    send_all(client_fd, player->uuid, 16);
+    writeVarInt(client_fd, player_latency[player - player_data]);
+  }
+
+  return 0;
+}
+
 // S->C Spawn Entity
 int sc_spawnEntity (
   int client_fd,
@@ -1125,6 +1457,18 @@ int cs_chat (int client_fd) {
   size_t message_len = strlen((char *)recv_buffer);
   uint8_t name_len = strlen(player->name);
 
+  // Older clients send commands as regular chat messages. The rest of
+  // the packet overwrites recv_buffer, so save the command for later.
+  // Without any commands compiled in, these are just chat messages.
+  char command[32] = {0};
+  #ifdef DEV_ENABLE_STATS
+  if (recv_buffer[0] == '/') {
+    size_t command_len = message_len - 1;
+    if (command_len > sizeof(command) - 1) command_len = sizeof(command) - 1;
+    memcpy(command, recv_buffer + 1, command_len);
+  }
+  #endif
+
   // To be safe, cap messages to 32 bytes before the buffer length
   if (message_len > 224) {
     recv_buffer[224] = '\0';
@@ -1140,11 +1484,11 @@ int cs_chat (int client_fd) {
   recv_buffer[name_len + 1] = '>';
   recv_buffer[name_len + 2] = ' ';
 
-  // Forward message to all connected players
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    if (player_data[i].client_fd == -1) continue;
-    if (player_data[i].flags & 0x20) continue;
-    sc_systemChat(player_data[i].client_fd, (char *)recv_buffer, message_len + name_len + 3);
+  // Forward message to all connected players, unless it's a command
+  if (command[0] == '\0') {
+    beginBroadcast();
+    sc_systemChat(MEMORY_SINK_FD, (char *)recv_buffer, message_len + name_len + 3);
+    endBroadcast(-1, BROADCAST_LOADED, NULL, NULL);
   }
 
   readUint64(client_fd); // Ignore timestamp
@@ -1158,9 +1502,28 @@ int cs_chat (int client_fd) {
   // Ignore acknowledgement bitmask and checksum
   recv_all(client_fd, recv_buffer, 4, false);
 
+  #ifdef DEV_ENABLE_STATS
+  if (command[0] != '\0') handleChatCommand(player, command);
+  #endif
+
   return 0;
 }
 
+#ifdef DEV_ENABLE_STATS
+// C->S Chat Command
+int cs_chatCommand (int client_fd) {
+
+  readString(client_fd);
+
+  PlayerData *player;
+  if (getPlayerData(client_fd, &player)) return 1;
+
+  handleChatCommand(player, (char *)recv_buffer);
+
+  return 0;
+}
+#endif
+
 // C->S Interact
 int cs_interact (int client_fd) {
 
@@ -1273,14 +1636,54 @@ int cs_playerLoaded (int client_fd) {
   return 0;
 }
 
-// S->C Registry Data (multiple packets) and Update Tags (configuration, multiple packets)
-int sc_registries (int client_fd) {
+#ifdef ENABLE_COMPRESSION
+// Copy of configuration_bin in the compressed packet format. Uncompressed
+// packets grow by at most 2 bytes in this format, and no packet is shorter
+// than 2 bytes to begin with, so this can't overflow.
+uint8_t configuration_compressed[sizeof(configuration_bin) * 2];
+size_t configuration_compressed_length = 0;
+
+// Builds the above, done once on first use
+void compressConfiguration () {
+
+  // Borrow the memory sink to collect the output
+  uint8_t *sink = memory_sink;
+  size_t sink_size = memory_sink_size, sink_length = memory_sink_length;
+  memory_sink = configuration_compressed;
+  memory_sink_size = sizeof(configuration_compressed);
+  memory_sink_length = 0;
+
+  reframeToMemorySink(configuration_bin, sizeof(configuration_bin));
+  configuration_compressed_length = memory_sink_length;
+  printf(
+    "Compressed configuration data from %u to %u bytes\n\n",
+    (unsigned int)sizeof(configuration_bin), (unsigned int)configuration_compressed_length
+  );
+
+  memory_sink = sink;
+  memory_sink_size = sink_size;
+  memory_sink_length = sink_length;
+
+}
+#endif
+
+// S->C Known Packs, Registry Data, Update Tags and Finish Configuration
+// These are framed ahead of time into one buffer by build_registries.js,
+// which is queued up to be sent without blocking the main loop
+int sc_configuration (int client_fd) {
+
+  printf("Sending Known Packs, Registries and Tags\n");
+  printf("  Finishing configuration\n\n");
 
-  printf("Sending Registries\n\n");
-  send_all(client_fd, registries_bin, sizeof(registries_bin));
+  #ifdef ENABLE_COMPRESSION
+  if (isCompressionEnabled(client_fd)) {
+    if (configuration_compressed_length == 0) compressConfiguration();
+    queueOutput(client_fd, configuration_compressed, configuration_compressed_length);
+    return 0;
+  }
+  #endif
 
-  printf("Sending Tags\n\n");
-  send_all(client_fd, tags_bin, sizeof(tags_bin));
+  queueOutput(client_fd, configuration_bin, sizeof(configuration_bin));
 
   return 0;
 
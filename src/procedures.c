@@ -4,6 +4,9 @@
 #include <errno.h>
 #ifdef _WIN32
 #include <winsock2.h>
+#define SHUT_RDWR SD_BOTH
+#else
+#include <sys/socket.h>
 #endif
 
 #include "globals.h"
@@ -15,39 +18,82 @@
 #include "structures.h"
 #include "serialize.h"
 #include "procedures.h"
-
-int client_states[MAX_PLAYERS * 2];
+#include "stats.h"
+#include "trace.h"
 
 void setClientState (int client_fd, int new_state) {
-  // Look for a client state with a matching file descriptor
-  for (int i = 0; i < MAX_PLAYERS * 2; i += 2) {
-    if (client_states[i] != client_fd) continue;
-    client_states[i + 1] = new_state;
-    return;
-  }
-  // If the above failed, look for an unused client state slot
-  for (int i = 0; i < MAX_PLAYERS * 2; i += 2) {
-    if (client_states[i] != -1) continue;
-    client_states[i] = client_fd;
-    client_states[i + 1] = new_state;
-    return;
-  }
+  Connection *connection = getConnection(client_fd);
+  if (connection != NULL) connection->state = new_state;
 }
 
 int getClientState (int client_fd) {
-  for (int i = 0; i < MAX_PLAYERS * 2; i += 2) {
-    if (client_states[i] != client_fd) continue;
-    return client_states[i + 1];
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL) return STATE_NONE;
+  return connection->state;
+}
+
+StatusRateLimit status_rate_limits[STATUS_RATE_LIMIT_ENTRIES];
+
+// Takes one server list ping from the given address's allowance
+// Returns false if the address has run out of pings for now
+uint8_t takeStatusToken (uint32_t address) {
+
+  int64_t now = get_program_time();
+
+  // Find the address, or the entry that's gone unused the longest
+  StatusRateLimit *entry = NULL, *oldest = &status_rate_limits[0];
+  for (int i = 0; i < STATUS_RATE_LIMIT_ENTRIES; i ++) {
+    StatusRateLimit *candidate = &status_rate_limits[i];
+    if (candidate->refill_time != 0 && candidate->address == address) {
+      entry = candidate;
+      break;
+    }
+    if (candidate->refill_time < oldest->refill_time) oldest = candidate;
   }
-  return STATE_NONE;
+  if (entry == NULL) {
+    entry = oldest;
+    entry->address = address;
+    entry->refill_time = now;
+    entry->tokens = STATUS_RATE_BURST;
+  }
+
+  // Earn back one ping per STATUS_RATE_INTERVAL
+  int64_t earned = (now - entry->refill_time) / STATUS_RATE_INTERVAL;
+  if (earned > 0) {
+    entry->refill_time += earned * STATUS_RATE_INTERVAL;
+    if (entry->tokens + earned >= STATUS_RATE_BURST) {
+      entry->tokens = STATUS_RATE_BURST;
+      entry->refill_time = now;
+    } else entry->tokens += earned;
+  }
+
+  if (entry->tokens == 0) return false;
+  entry->tokens --;
+  return true;
+
 }
 
-int getClientIndex (int client_fd) {
-  for (int i = 0; i < MAX_PLAYERS * 2; i += 2) {
-    if (client_states[i] != client_fd) continue;
-    return i;
+// Decides whether a client that has just sent its handshake gets to stay.
+// Server list pings are limited to STATUS_CONNECTIONS at a time, and rate
+// limited per IP address. Everything else is limited to MAX_PLAYERS.
+uint8_t admitConnection (int client_fd, int intent) {
+
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL) return false;
+
+  uint8_t status = intent == STATE_STATUS;
+  int count = 0;
+  for (int i = 0; i < MAX_CONNECTIONS; i ++) {
+    Connection *other = &connections[i];
+    if (other == connection || other->client_fd == -1) continue;
+    if (other->state == STATE_NONE) continue;
+    if ((other->state == STATE_STATUS) == status) count ++;
   }
-  return -1;
+  if (count >= (status ? STATUS_CONNECTIONS : MAX_PLAYERS)) return false;
+
+  if (status) return takeStatusToken(connection->address);
+  return true;
+
 }
 
 // Restores player data to initial state (fresh spawn)
@@ -70,6 +116,40 @@ void resetPlayerData (PlayerData *player) {
   }
 }
 
+// Starts off a newly connected player at the maximum view distance,
+// until their client tells us otherwise
+void resetViewDistance (int player_index) {
+  player_view[player_index].requested = VIEW_DISTANCE;
+  player_view[player_index].current = VIEW_DISTANCE;
+  player_view[player_index].calm_ticks = 0;
+}
+
+// Adds a player to a dense player list, unless already listed
+void addToPlayerList (PlayerData **list, int *count, PlayerData *player) {
+  for (int i = 0; i < *count; i ++) {
+    if (list[i] == player) return;
+  }
+  list[(*count) ++] = player;
+}
+
+// Removes a player from a dense player list, if listed
+void removeFromPlayerList (PlayerData **list, int *count, PlayerData *player) {
+  for (int i = 0; i < *count; i ++) {
+    if (list[i] != player) continue;
+    list[i] = list[-- (*count)];
+    return;
+  }
+}
+
+// Lists a player as online and loading, see reservePlayerData
+void markPlayerOnline (PlayerData *player) {
+  Connection *connection = getConnection(player->client_fd);
+  if (connection != NULL) connection->player = player;
+  addToPlayerList(online_players, &online_player_count, player);
+  removeFromPlayerList(loaded_players, &loaded_player_count, player);
+  invalidateStatusResponse();
+}
+
 // Assigns the given data to a player_data entry
 int reservePlayerData (int client_fd, uint8_t *uuid, char *name) {
 
@@ -82,11 +162,8 @@ int reservePlayerData (int client_fd, uint8_t *uuid, char *name) {
       // Flag player as loading
       player_data[i].flags |= 0x20;
       player_data[i].flagval_16 = 0;
-      // Reset their recently visited chunk list
-      for (int j = 0; j < VISITED_HISTORY; j ++) {
-        player_data[i].visited_x[j] = 32767;
-        player_data[i].visited_z[j] = 32767;
-      }
+      resetViewDistance(i);
+      markPlayerOnline(&player_data[i]);
       return 0;
     }
     // Search for unallocated player slots
@@ -106,6 +183,8 @@ int reservePlayerData (int client_fd, uint8_t *uuid, char *name) {
       memcpy(player_data[i].uuid, uuid, 16);
       memcpy(player_data[i].name, name, 16);
       resetPlayerData(&player_data[i]);
+      resetViewDistance(i);
+      markPlayerOnline(&player_data[i]);
       player_data_count ++;
       return 0;
     }
@@ -116,44 +195,34 @@ int reservePlayerData (int client_fd, uint8_t *uuid, char *name) {
 }
 
 int getPlayerData (int client_fd, PlayerData **output) {
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    if (player_data[i].client_fd == client_fd) {
-      *output = &player_data[i];
-      return 0;
-    }
-  }
-  return 1;
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL || connection->player == NULL) return 1;
+  // The player may have logged in again on another connection since
+  if (connection->player->client_fd != client_fd) return 1;
+  *output = connection->player;
+  return 0;
 }
 
 // Marks a client as disconnected and cleans up player data
 void handlePlayerDisconnect (int client_fd) {
-  // Search for a corresponding player in the player data array
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    if (player_data[i].client_fd != client_fd) continue;
-    // Mark the player as being offline
-    player_data[i].client_fd = -1;
-    // Prepare leave message for broadcast
-    uint8_t player_name_len = strlen(player_data[i].name);
-    strcpy((char *)recv_buffer, player_data[i].name);
-    strcpy((char *)recv_buffer + player_name_len, " left the game");
-    // Broadcast this player's leave to all other connected clients
-    for (int j = 0; j < MAX_PLAYERS; j ++) {
-      if (player_data[j].client_fd == client_fd) continue;
-      if (player_data[j].flags & 0x20) continue;
-      // Send chat message
-      sc_systemChat(player_data[j].client_fd, (char *)recv_buffer, 14 + player_name_len);
-      // Remove leaving player's entity
-      sc_removeEntity(player_data[j].client_fd, client_fd);
-    }
-    break;
-  }
-  // Find the client state entry and reset it
-  for (int i = 0; i < MAX_PLAYERS * 2; i += 2) {
-    if (client_states[i] == client_fd) {
-      client_states[i] = -1;
-      return;
-    }
-  }
+  PlayerData *player;
+  if (getPlayerData(client_fd, &player)) return;
+  // Mark the player as being offline
+  player->client_fd = -1;
+  removeFromPlayerList(online_players, &online_player_count, player);
+  removeFromPlayerList(loaded_players, &loaded_player_count, player);
+  invalidateStatusResponse();
+  // Prepare leave message for broadcast
+  uint8_t player_name_len = strlen(player->name);
+  strcpy((char *)recv_buffer, player->name);
+  strcpy((char *)recv_buffer + player_name_len, " left the game");
+  // Broadcast this player's leave to all other connected clients
+  beginBroadcast();
+  // Send chat message
+  sc_systemChat(MEMORY_SINK_FD, (char *)recv_buffer, 14 + player_name_len);
+  // Remove leaving player's entity
+  sc_removeEntity(MEMORY_SINK_FD, client_fd);
+  endBroadcast(client_fd, BROADCAST_LOADED, NULL, NULL);
 }
 
 // Marks a client as connected and broadcasts their data to other players
@@ -164,26 +233,43 @@ void handlePlayerJoin (PlayerData* player) {
   strcpy((char *)recv_buffer, player->name);
   strcpy((char *)recv_buffer + player_name_len, " joined the game");
 
-  // Inform other clients (and the joining client) of the player's name and entity
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    sc_systemChat(player_data[i].client_fd, (char *)recv_buffer, 16 + player_name_len);
-    sc_playerInfoUpdateAddPlayer(player_data[i].client_fd, *player);
-    if (player_data[i].client_fd != player->client_fd) {
-      sc_spawnEntityPlayer(player_data[i].client_fd, *player);
-    }
-  }
+  // Inform other clients (and the joining client) of the player's name and entity.
+  // This includes players still loading in, as they only get told about
+  // players that had already joined when they connected.
+  beginBroadcast();
+  sc_systemChat(MEMORY_SINK_FD, (char *)recv_buffer, 16 + player_name_len);
+  sc_playerInfoUpdateAddPlayer(MEMORY_SINK_FD, *player);
+  endBroadcast(-1, BROADCAST_ONLINE, NULL, NULL);
+  beginBroadcast();
+  sc_spawnEntityPlayer(MEMORY_SINK_FD, *player);
+  endBroadcast(player->client_fd, BROADCAST_ONLINE, NULL, NULL);
 
   // Clear "client loading" flag and fallback timer
   player->flags &= ~0x20;
   player->flagval_16 = 0;
+  addToPlayerList(loaded_players, &loaded_player_count, player);
+
+  // Start tracking connection health from this point on
+  player_latency[player - player_data] = 0;
+  player_keepalive_time[player - player_data] = get_program_time();
 
 }
 
 void disconnectClient (int *client_fd, int cause) {
   if (*client_fd == -1) return;
+  // Nothing to do if this connection was already closed further down
+  // the call stack, such as after a network timeout mid-packet
+  if (getConnection(*client_fd) == NULL) {
+    *client_fd = -1;
+    return;
+  }
+  traceDisconnect(*client_fd);
+  discardOutput(*client_fd);
+  dropPendingOutput(*client_fd);
+  disableCompression(*client_fd);
   client_count --;
-  setClientState(*client_fd, STATE_NONE);
   handlePlayerDisconnect(*client_fd);
+  closeConnection(*client_fd);
   #ifdef _WIN32
   closesocket(*client_fd);
   printf("Disconnected client %d, cause: %d, errno: %d\n", *client_fd, cause, WSAGetLastError());
@@ -300,6 +386,125 @@ int givePlayerItem (PlayerData *player, uint16_t item, uint8_t count) {
 
 }
 
+// Offsets of all chunks within VIEW_DISTANCE, sorted nearest first
+ChunkOffset chunk_send_order[CHUNK_VIEW_WIDTH * CHUNK_VIEW_WIDTH];
+int chunk_send_order_count = 0;
+
+// Fills chunk_send_order, done once on first use
+void buildChunkSendOrder () {
+  for (int x = -VIEW_DISTANCE; x <= VIEW_DISTANCE; x ++) {
+    for (int z = -VIEW_DISTANCE; z <= VIEW_DISTANCE; z ++) {
+      // Insertion sort by squared distance from the center
+      int i = chunk_send_order_count ++;
+      for (; i > 0; i --) {
+        ChunkOffset prev = chunk_send_order[i - 1];
+        if (prev.x * prev.x + prev.z * prev.z <= x * x + z * z) break;
+        chunk_send_order[i] = prev;
+      }
+      chunk_send_order[i].x = x;
+      chunk_send_order[i].z = z;
+    }
+  }
+}
+
+// Checks whether a chunk at the given offset from the center is within
+// view distance. Like in vanilla, the area in view is roughly circular.
+uint8_t isChunkInView (int dx, int dz, int distance) {
+  // Measure from the edges of the center chunk, not from its middle
+  if (dx < 0) dx = -dx;
+  if (dz < 0) dz = -dz;
+  if (dx > 0) dx --;
+  if (dz > 0) dz --;
+  return dx * dx + dz * dz < distance * distance;
+}
+
+// Returns the bit that a chunk occupies in PlayerView.loaded_chunks
+int getLoadedChunkBit (short x, short z) {
+  return mod_abs(x, CHUNK_VIEW_WIDTH) + mod_abs(z, CHUNK_VIEW_WIDTH) * CHUNK_VIEW_WIDTH;
+}
+
+// Brings the chunks held by a player's client in line with their view,
+// centered on the given chunk. Chunks out of view get unloaded, and any
+// missing chunks in view get sent, nearest first.
+// Returns the amount of chunks sent.
+int updatePlayerChunks (PlayerData *player, short _x, short _z) {
+
+  PlayerView *view = &player_view[player - player_data];
+  int distance = view->current;
+
+  // Only the area around the previous center can have loaded chunks
+  for (int i = -VIEW_DISTANCE; i <= VIEW_DISTANCE; i ++) {
+    for (int j = -VIEW_DISTANCE; j <= VIEW_DISTANCE; j ++) {
+      short x = view->center_x + i, z = view->center_z + j;
+      int bit = getLoadedChunkBit(x, z);
+      if (!(view->loaded_chunks[bit / 8] & (1 << (bit % 8)))) continue;
+      if (isChunkInView(x - _x, z - _z, distance)) continue;
+      sc_unloadChunk(player->client_fd, x, z);
+      view->loaded_chunks[bit / 8] &= ~(1 << (bit % 8));
+    }
+  }
+
+  if (_x != view->center_x || _z != view->center_z) {
+    sc_setCenterChunk(player->client_fd, _x, _z);
+    view->center_x = _x;
+    view->center_z = _z;
+  }
+
+  if (chunk_send_order_count == 0) buildChunkSendOrder();
+
+  int count = 0;
+  uint8_t bulk = false;
+  view->chunks_held = false;
+  for (int i = 0; i < chunk_send_order_count; i ++) {
+    if (!isChunkInView(chunk_send_order[i].x, chunk_send_order[i].z, distance)) continue;
+    short x = _x + chunk_send_order[i].x, z = _z + chunk_send_order[i].z;
+    int bit = getLoadedChunkBit(x, z);
+    if (view->loaded_chunks[bit / 8] & (1 << (bit % 8))) continue;
+    // Don't pile chunks onto a client that hasn't taken earlier output yet
+    // The rest get sent by resumePlayerChunks once its queue has drained
+    if (isOutputQueued(player->client_fd)) {
+      view->chunks_held = true;
+      break;
+    }
+    // Chunks are bulk data, send them in full-sized segments
+    if (!bulk) beginBulkOutput(player->client_fd);
+    bulk = true;
+    if (sc_chunkDataAndUpdateLight(player->client_fd, x, z) == 1) {
+      view->chunks_held = true;
+      break;
+    }
+    view->loaded_chunks[bit / 8] |= 1 << (bit % 8);
+    count ++;
+  }
+  if (bulk) endBulkOutput(player->client_fd);
+
+  return count;
+
+}
+
+// Sends the chunks that updatePlayerChunks held back for a client, if any,
+// once nothing is queued for it anymore
+void resumePlayerChunks (int client_fd) {
+  if (getClientState(client_fd) != STATE_PLAY) return;
+  PlayerData *player;
+  if (getPlayerData(client_fd, &player)) return;
+  PlayerView *view = &player_view[player - player_data];
+  if (!view->chunks_held || isOutputQueued(client_fd)) return;
+  updatePlayerChunks(player, view->center_x, view->center_z);
+}
+
+// Changes the view distance of an in-game player
+void setPlayerViewDistance (PlayerData *player, uint8_t distance) {
+
+  PlayerView *view = &player_view[player - player_data];
+  if (distance == view->current) return;
+
+  sc_setRenderDistance(player->client_fd, distance);
+  view->current = distance;
+  updatePlayerChunks(player, view->center_x, view->center_z);
+
+}
+
 // Sends the full sequence for spawning the player to the client
 void spawnPlayer (PlayerData *player) {
 
@@ -351,16 +556,16 @@ void spawnPlayer (PlayerData *player) {
   sc_startWaitingForChunks(player->client_fd);
   sc_setCenterChunk(player->client_fd, _x, _z);
 
+  // The client starts out without any chunks
+  PlayerView *view = &player_view[player - player_data];
+  view->center_x = _x;
+  view->center_z = _z;
+  memset(view->loaded_chunks, 0, sizeof(view->loaded_chunks));
+
   task_yield(); // Check task timer between packets
 
-  // Send spawn chunk first
-  sc_chunkDataAndUpdateLight(player->client_fd, _x, _z);
-  for (int i = -VIEW_DISTANCE; i <= VIEW_DISTANCE; i ++) {
-    for (int j = -VIEW_DISTANCE; j <= VIEW_DISTANCE; j ++) {
-      if (i == 0 && j == 0) continue;
-      sc_chunkDataAndUpdateLight(player->client_fd, _x + i, _z + j);
-    }
-  }
+  // Send all chunks in view, starting from the spawn chunk
+  updatePlayerChunks(player, _x, _z);
   // Re-teleport player after all chunks have been sent
   sc_synchronizePlayerPosition(player->client_fd, spawn_x, spawn_y, spawn_z, spawn_yaw, spawn_pitch);
 
@@ -393,30 +598,24 @@ void broadcastPlayerMetadata (PlayerData *player) {
     }
   };
 
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    PlayerData* other_player = &player_data[i];
-    int client_fd = other_player->client_fd;
-
-    if (client_fd == -1) continue;
-    if (client_fd == player->client_fd) continue;
-    if (other_player->flags & 0x20) continue;
-
-    sc_setEntityMetadata(client_fd, player->client_fd, metadata, 2);
-  }
+  beginBroadcast();
+  sc_setEntityMetadata(MEMORY_SINK_FD, player->client_fd, metadata, 2);
+  endBroadcast(player->client_fd, BROADCAST_LOADED, NULL, NULL);
 }
 
 // Sends a mob's entity metadata to the given player.
 // If client_fd is -1, broadcasts to all player
 void broadcastMobMetadata (int client_fd, int entity_id) {
 
-  MobData *mob = &mob_data[-entity_id - 2];
+  int slot = getMobSlot(entity_id);
+  if (slot == -1) return;
 
   EntityData *metadata;
   size_t length;
 
-  switch (mob->type) {
+  switch (mob_type[slot]) {
     case 106: // Sheep
-      if (!((mob->data >> 5) & 1)) // Don't send metadata if sheep isn't sheared
+      if (!((mob_data[slot] >> 5) & 1)) // Don't send metadata if sheep isn't sheared
         return;
 
       metadata = malloc(sizeof *metadata);
@@ -433,15 +632,9 @@ void broadcastMobMetadata (int client_fd, int entity_id) {
   }
 
   if (client_fd == -1) {
-    for (int i = 0; i < MAX_PLAYERS; i ++) {
-      PlayerData* player = &player_data[i];
-      client_fd = player->client_fd;
-
-      if (client_fd == -1) continue;
-      if (player->flags & 0x20) continue;
-
-      sc_setEntityMetadata(client_fd, entity_id, metadata, length);
-    }
+    beginBroadcast();
+    sc_setEntityMetadata(MEMORY_SINK_FD, entity_id, metadata, length);
+    endBroadcast(-1, BROADCAST_LOADED, NULL, NULL);
   } else {
     sc_setEntityMetadata(client_fd, entity_id, metadata, length);
   }
@@ -456,12 +649,16 @@ uint8_t getBlockChange (short x, uint8_t y, short z) {
       block_changes[i].x == x &&
       block_changes[i].y == y &&
       block_changes[i].z == z
-    ) return block_changes[i].block;
+    ) {
+      statsRecordBlockChangeScan(i + 1);
+      return block_changes[i].block;
+    }
     #ifdef ALLOW_CHESTS
       // Skip chest contents
       if (block_changes[i].block == B_chest) i += 14;
     #endif
   }
+  statsRecordBlockChangeScan(block_changes_count);
   return 0xFF;
 }
 
@@ -472,25 +669,24 @@ void failBlockChange (short x, uint8_t y, short z, uint8_t block) {
   uint8_t before = getBlockAt(x, y, z);
 
   // Broadcast a new update to all players
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    if (player_data[i].client_fd == -1) continue;
-    if (player_data[i].flags & 0x20) continue;
-    // Reset the block they tried to change
-    sc_blockUpdate(player_data[i].client_fd, x, y, z, before);
-    // Broadcast a chat message warning about the limit
-    sc_systemChat(player_data[i].client_fd, "Block changes limit exceeded. Restore original terrain to continue.", 67);
-  }
+  beginBroadcast();
+  // Reset the block they tried to change
+  sc_blockUpdate(MEMORY_SINK_FD, x, y, z, before);
+  // Broadcast a chat message warning about the limit
+  sc_systemChat(MEMORY_SINK_FD, "Block changes limit exceeded. Restore original terrain to continue.", 67);
+  endBroadcast(-1, BROADCAST_LOADED, NULL, NULL);
 
 }
 
 uint8_t makeBlockChange (short x, uint8_t y, short z, uint8_t block) {
 
   // Transmit block update to all in-game clients
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    if (player_data[i].client_fd == -1) continue;
-    if (player_data[i].flags & 0x20) continue;
-    sc_blockUpdate(player_data[i].client_fd, x, y, z, block);
-  }
+  beginBroadcast();
+  sc_blockUpdate(MEMORY_SINK_FD, x, y, z, block);
+  endBroadcast(-1, BROADCAST_LOADED, NULL, NULL);
+
+  // Chunk data cached before this change is now outdated
+  invalidateChunkCache(div_floor(x, 16), div_floor(z, 16));
 
   // Calculate terrain at these coordinates and compare it to the input block.
   // Since block changes get overlayed on top of terrain, we don't want to
@@ -634,57 +830,16 @@ uint16_t getMiningResult (uint16_t held_item, uint8_t block) {
       return 0;
       break;
 
-    case B_stone:
-    case B_cobblestone:
-    case B_stone_slab:
-    case B_cobblestone_slab:
-    case B_sandstone:
-    case B_furnace:
-    case B_coal_ore:
-    case B_iron_ore:
-    case B_iron_block:
-    case B_gold_block:
-    case B_diamond_block:
-    case B_redstone_block:
-    case B_coal_block:
-      // Check if player is holding (any) pickaxe
-      if (
-        held_item != I_wooden_pickaxe &&
-        held_item != I_stone_pickaxe &&
-        held_item != I_iron_pickaxe &&
-        held_item != I_golden_pickaxe &&
-        held_item != I_diamond_pickaxe &&
-        held_item != I_netherite_pickaxe
-      ) return 0;
-      break;
-
-    case B_gold_ore:
-    case B_redstone_ore:
-    case B_diamond_ore:
-      // Check if player is holding an iron (or better) pickaxe
-      if (
-        held_item != I_iron_pickaxe &&
-        held_item != I_golden_pickaxe &&
-        held_item != I_diamond_pickaxe &&
-        held_item != I_netherite_pickaxe
-      ) return 0;
-      break;
-
-    case B_snow:
-      // Check if player is holding (any) shovel
-      if (
-        held_item != I_wooden_shovel &&
-        held_item != I_stone_shovel &&
-        held_item != I_iron_shovel &&
-        held_item != I_golden_shovel &&
-        held_item != I_diamond_shovel &&
-        held_item != I_netherite_shovel
-      ) return 0;
-      break;
-
     default: break;
   }
 
+  // Check if the block requires a specific tool to drop anything
+  uint8_t block_flags = block_properties[block];
+  uint8_t item_flags = item_properties[held_item];
+  if ((block_flags & BLOCK_NEEDS_PICKAXE) && !(item_flags & ITEM_PICKAXE)) return 0;
+  if ((block_flags & BLOCK_NEEDS_IRON_PICKAXE) && !(item_flags & ITEM_IRON_PICKAXE)) return 0;
+  if ((block_flags & BLOCK_NEEDS_SHOVEL) && !(item_flags & ITEM_SHOVEL)) return 0;
+
   return B_to_I[block];
 
 }
@@ -743,52 +898,25 @@ uint8_t isInstantlyMined (PlayerData *player, uint8_t block) {
 
 }
 
+// Block properties are looked up in tables generated by build_registries.js
+
 // Checks whether the given block has to have something beneath it
 uint8_t isColumnBlock (uint8_t block) {
-  return (
-    block == B_snow ||
-    block == B_moss_carpet ||
-    block == B_cactus ||
-    block == B_short_grass ||
-    block == B_dead_bush ||
-    block == B_sand ||
-    block == B_torch ||
-    block == B_oak_sapling
-  );
+  return (block_properties[block] & BLOCK_COLUMN) != 0;
 }
 
 // Checks whether the given block is non-solid
 uint8_t isPassableBlock (uint8_t block) {
-  return (
-    block == B_air ||
-    (block >= B_water && block < B_water + 8) ||
-    (block >= B_lava && block < B_lava + 4) ||
-    block == B_snow ||
-    block == B_moss_carpet ||
-    block == B_short_grass ||
-    block == B_dead_bush ||
-    block == B_torch
-  );
+  return (block_properties[block] & BLOCK_PASSABLE) != 0;
 }
 // Checks whether the given block is non-solid and spawnable
 uint8_t isPassableSpawnBlock (uint8_t block) {
-    if ((block >= B_water && block < B_water + 8) ||
-        (block >= B_lava && block < B_lava + 4))
-    {
-        return 0;
-    }
-    return isPassableBlock(block);
+  return (block_properties[block] & (BLOCK_PASSABLE | BLOCK_FLUID)) == BLOCK_PASSABLE;
 }
 
 // Checks whether the given block can be replaced by another block
 uint8_t isReplaceableBlock (uint8_t block) {
-  return (
-    block == B_air ||
-    (block >= B_water && block < B_water + 8) ||
-    (block >= B_lava && block < B_lava + 4) ||
-    block == B_short_grass ||
-    block == B_snow
-  );
+  return (block_properties[block] & BLOCK_REPLACEABLE) != 0;
 }
 
 uint8_t isReplaceableFluid (uint8_t block, uint8_t level, uint8_t fluid) {
@@ -805,74 +933,19 @@ uint32_t isCompostItem (uint16_t item) {
   // Output values calculated using the following formula:
   // P = 2^32 / (7 / compost_chance)
 
-  if ( // Compost chance: 30%
-    item == I_oak_leaves ||
-    item == I_short_grass ||
-    item == I_wheat_seeds ||
-    item == I_oak_sapling ||
-    item == I_moss_carpet
-  ) return 184070026;
-
-  if ( // Compost chance: 50%
-    item == I_cactus ||
-    item == I_sugar_cane
-  ) return 306783378;
-
-  if ( // Compost chance: 65%
-    item == I_apple ||
-    item == I_lily_pad
-  ) return 398818392;
+  uint8_t flags = item_properties[item];
+  if (flags & ITEM_COMPOST_LOW) return 184070026; // Compost chance: 30%
+  if (flags & ITEM_COMPOST_MEDIUM) return 306783378; // Compost chance: 50%
+  if (flags & ITEM_COMPOST_HIGH) return 398818392; // Compost chance: 65%
 
   return 0;
 }
 
 // Returns the maximum stack size of an item
 uint8_t getItemStackSize (uint16_t item) {
-
-  if (
-    // Pickaxes
-    item == I_wooden_pickaxe ||
-    item == I_stone_pickaxe ||
-    item == I_iron_pickaxe ||
-    item == I_golden_pickaxe ||
-    item == I_diamond_pickaxe ||
-    item == I_netherite_pickaxe ||
-    // Axes
-    item == I_wooden_axe ||
-    item == I_stone_axe ||
-    item == I_iron_axe ||
-    item == I_golden_axe ||
-    item == I_diamond_axe ||
-    item == I_netherite_axe ||
-    // Shovels
-    item == I_wooden_shovel ||
-    item == I_stone_shovel ||
-    item == I_iron_shovel ||
-    item == I_golden_shovel ||
-    item == I_diamond_shovel ||
-    item == I_netherite_shovel ||
-    // Swords
-    item == I_wooden_sword ||
-    item == I_stone_sword ||
-    item == I_iron_sword ||
-    item == I_golden_sword ||
-    item == I_diamond_sword ||
-    item == I_netherite_sword ||
-    // Hoes
-    item == I_wooden_hoe ||
-    item == I_stone_hoe ||
-    item == I_iron_hoe ||
-    item == I_golden_hoe ||
-    item == I_diamond_hoe ||
-    item == I_netherite_hoe ||
-    // Shears
-    item == I_shears
-  ) return 1;
-
-  if (
-    item == I_snowball
-  ) return 16;
-
+  uint8_t flags = item_properties[item];
+  if (flags & ITEM_UNSTACKABLE) return 1;
+  if (flags & ITEM_STACKS_TO_16) return 16;
   return 64;
 }
 
@@ -1356,45 +1429,79 @@ void handlePlayerUseItem (PlayerData *player, short x, short y, short z, uint8_t
 
 }
 
+// Returns the slot of the mob with the given entity ID, or -1 if there's
+// no such mob. Entity IDs come from clients, so these are range-checked.
+int getMobSlot (int entity_id) {
+  int id = -entity_id - 2;
+  if (id < 0 || id >= MAX_MOBS) return -1;
+  if (mob_slot[id] == 0xFFFF) return -1;
+  return mob_slot[id];
+}
+
+// Deallocates the mob in the given slot. The last mob is moved into the
+// freed slot to keep the mob arrays dense, which means that loops over
+// mobs which free entries should iterate backwards.
+void freeMob (int slot) {
+
+  int last = mob_count - 1;
+  mob_slot[mob_id[slot]] = 0xFFFF;
+
+  if (slot != last) {
+    mob_type[slot] = mob_type[last];
+    mob_x[slot] = mob_x[last];
+    mob_y[slot] = mob_y[last];
+    mob_z[slot] = mob_z[last];
+    mob_data[slot] = mob_data[last];
+    mob_id[slot] = mob_id[last];
+    mob_slot[mob_id[slot]] = slot;
+  }
+
+  mob_count --;
+
+}
+
 void spawnMob (uint8_t type, short x, uint8_t y, short z, uint8_t health) {
 
-  for (int i = 0; i < MAX_MOBS; i ++) {
-    // Look for type 0 (unallocated)
-    if (mob_data[i].type != 0) continue;
+  if (mob_count == MAX_MOBS) return;
 
-    // Assign it the input parameters
-    mob_data[i].type = type;
-    mob_data[i].x = x;
-    mob_data[i].y = y;
-    mob_data[i].z = z;
-    mob_data[i].data = health & 31;
+  // Look for an unallocated mob ID
+  int id = 0;
+  while (mob_slot[id] != 0xFFFF) id ++;
 
-    // Forge a UUID from a random number and the mob's index
-    uint8_t uuid[16];
-    uint32_t r = fast_rand();
-    memcpy(uuid, &r, 4);
-    memcpy(uuid + 4, &i, 4);
-
-    // Broadcast entity creation to all players
-    for (int j = 0; j < MAX_PLAYERS; j ++) {
-      if (player_data[j].client_fd == -1) continue;
-      sc_spawnEntity(
-        player_data[j].client_fd,
-        -2 - i, // Use negative IDs to avoid conflicts with player IDs
-        uuid, // Use the UUID generated above
-        type, (double)x + 0.5f, y, (double)z + 0.5f,
-        // Face opposite of the player, as if looking at them when spawning
-        (player_data[j].yaw + 127) & 255, 0
-      );
-    }
+  // Append the mob to the end of the dense mob arrays
+  int slot = mob_count ++;
+  mob_id[slot] = id;
+  mob_slot[id] = slot;
 
-    // Freshly spawned mobs currently don't need metadata updates.
-    // If this changes, uncomment this line.
-    // broadcastMobMetadata(-1, i);
+  // Assign it the input parameters
+  mob_type[slot] = type;
+  mob_x[slot] = x;
+  mob_y[slot] = y;
+  mob_z[slot] = z;
+  mob_data[slot] = health & 31;
 
-    break;
+  // Forge a UUID from a random number and the mob's ID
+  uint8_t uuid[16];
+  uint32_t r = fast_rand();
+  memcpy(uuid, &r, 4);
+  memcpy(uuid + 4, &id, 4);
+
+  // Broadcast entity creation to all players
+  FOR_EACH_ONLINE_PLAYER(player) {
+    sc_spawnEntity(
+      player->client_fd,
+      -2 - id, // Use negative IDs to avoid conflicts with player IDs
+      uuid, // Use the UUID generated above
+      type, (double)x + 0.5f, y, (double)z + 0.5f,
+      // Face opposite of the player, as if looking at them when spawning
+      (player->yaw + 127) & 255, 0
+    );
   }
 
+  // Freshly spawned mobs currently don't need metadata updates.
+  // If this changes, uncomment this line.
+  // broadcastMobMetadata(-1, -2 - id);
+
 }
 
 void interactEntity (int entity_id, int interactor_id) {
@@ -1402,36 +1509,31 @@ void interactEntity (int entity_id, int interactor_id) {
   PlayerData *player;
   if (getPlayerData(interactor_id, &player)) return;
 
-  MobData *mob = &mob_data[-entity_id - 2];
+  int slot = getMobSlot(entity_id);
+  if (slot == -1) return;
 
-  switch (mob->type) {
+  switch (mob_type[slot]) {
     case 106: // Sheep
       if (player->inventory_items[player->hotbar] != I_shears)
         return;
 
-      if ((mob->data >> 5) & 1) // Check if sheep has already been sheared
+      if ((mob_data[slot] >> 5) & 1) // Check if sheep has already been sheared
         return;
 
-      mob->data |= 1 << 5; // Set sheared to true
+      mob_data[slot] |= 1 << 5; // Set sheared to true
 
       bumpToolDurability(player);
 
       #ifdef ENABLE_PICKUP_ANIMATION
-      playPickupAnimation(player, I_white_wool, mob->x, mob->y, mob->z);
+      playPickupAnimation(player, I_white_wool, mob_x[slot], mob_y[slot], mob_z[slot]);
       #endif
 
       uint8_t item_count = 1 + (fast_rand() & 1); // 1-2
       givePlayerItem(player, I_white_wool, item_count);
 
-      for (int i = 0; i < MAX_PLAYERS; i ++) {
-        PlayerData* player = &player_data[i];
-        int client_fd = player->client_fd;
-
-        if (client_fd == -1) continue;
-        if (player->flags & 0x20) continue;
-
-        sc_entityAnimation(client_fd, interactor_id, 0);
-      }
+      beginBroadcast();
+      sc_entityAnimation(MEMORY_SINK_FD, interactor_id, 0);
+      endBroadcast(-1, BROADCAST_LOADED, NULL, NULL);
 
       broadcastMobMetadata(-1, entity_id);
 
@@ -1533,27 +1635,28 @@ void hurtEntity (int entity_id, int attacker_id, uint8_t damage_type, uint8_t da
 
   } else { // The attacked entity is a mob
 
-    MobData *mob = &mob_data[-entity_id - 2];
-    uint8_t mob_health = mob->data & 31;
+    int slot = getMobSlot(entity_id);
+    if (slot == -1) return;
+    uint8_t mob_health = mob_data[slot] & 31;
 
     // Don't continue if the mob is already dead
     if (mob_health == 0) return;
 
     // Set the mob's panic timer
-    mob->data |= (3 << 6);
+    mob_data[slot] |= (3 << 6);
 
     // Process health change on the server
     if (mob_health <= damage) {
 
-      mob->data -= mob_health;
-      mob->y = 0;
+      mob_data[slot] -= mob_health;
+      mob_y[slot] = 0;
       entity_died = true;
 
       // Handle mob drops
       if (attacker_id > 0) {
         PlayerData *player;
         if (getPlayerData(attacker_id, &player)) return;
-        switch (mob->type) {
+        switch (mob_type[slot]) {
           case 25: givePlayerItem(player, I_chicken, 1); break;
           case 28: givePlayerItem(player, I_beef, 1 + (fast_rand() % 3)); break;
           case 95: givePlayerItem(player, I_porkchop, 1 + (fast_rand() % 3)); break;
@@ -1563,39 +1666,29 @@ void hurtEntity (int entity_id, int attacker_id, uint8_t damage_type, uint8_t da
         }
       }
 
-    } else mob->data -= damage;
+    } else mob_data[slot] -= damage;
 
   }
 
   // Broadcast damage event to all players
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    int client_fd = player_data[i].client_fd;
-    if (client_fd == -1) continue;
-    sc_damageEvent(client_fd, entity_id, damage_type);
-    // Below this, handle death events
-    if (!entity_died) continue;
-    sc_entityEvent(client_fd, entity_id, 3);
+  beginBroadcast();
+  sc_damageEvent(MEMORY_SINK_FD, entity_id, damage_type);
+  // Below this, handle death events
+  if (entity_died) {
+    sc_entityEvent(MEMORY_SINK_FD, entity_id, 3);
     if (entity_id >= 0) {
       // If a player died, broadcast their death message
-      sc_systemChat(client_fd, (char *)recv_buffer, strlen((char *)recv_buffer));
+      sc_systemChat(MEMORY_SINK_FD, (char *)recv_buffer, strlen((char *)recv_buffer));
     }
   }
+  endBroadcast(-1, BROADCAST_ONLINE, NULL, NULL);
 
 }
 
 // Simulates events scheduled for regular intervals
-// Takes the time since the last tick in microseconds as the only arguemnt
-void handleServerTick (int64_t time_since_last_tick) {
-
-  // Update world time
-  world_time = (world_time + time_since_last_tick / 50000) % 24000;
-  // Increment server tick counter
-  server_ticks ++;
-
-  // Update player events
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    PlayerData *player = &player_data[i];
-    if (player->client_fd == -1) continue; // Skip offline players
+// Runs every tick: player loading, attack cooldowns, eating and movement
+void tickPlayerTimers () {
+  FOR_EACH_ONLINE_PLAYER(player) {
     if (player->flags & 0x20) { // Check "client loading" flag
       // If 3 seconds (60 vanilla ticks) have passed, assume player has loaded
       player->flagval_16 ++;
@@ -1613,7 +1706,7 @@ void handleServerTick (int64_t time_since_last_tick) {
     // Handle eating animation
     if (player->flags & 0x10) {
       if (player->flagval_16 >= (uint16_t)(1.6f * TICKS_PER_SECOND)) {
-        handlePlayerEating(&player_data[i], false);
+        handlePlayerEating(player, false);
         player->flags &= ~0x10;
         player->flagval_16 = 0;
       } else player->flagval_16 ++;
@@ -1623,11 +1716,77 @@ void handleServerTick (int64_t time_since_last_tick) {
     #ifndef BROADCAST_ALL_MOVEMENT
       player->flags &= ~0x40;
     #endif
-    // Below this, process events that happen once per second
-    if (server_ticks % (uint32_t)TICKS_PER_SECOND != 0) continue;
-    // Send Keep Alive and Update Time packets
-    sc_keepAlive(player->client_fd);
+  }
+}
+
+// Sends Keep Alive and Update Time packets to all loaded players
+void tickKeepAlive () {
+  int64_t now = get_program_time();
+  FOR_EACH_LOADED_PLAYER(player) {
+    int i = player - player_data;
+    // If the client hasn't responded in too long, assume it's dead.
+    // We can't disconnect it from here, as that would leave the main
+    // loop with a stale file descriptor. Instead, shut the socket down,
+    // and let the main loop clean up after the failing read.
+    if (now - player_keepalive_time[i] > KEEPALIVE_TIMEOUT) {
+      printf("Client %d timed out (no Keep Alive response)\n", player->client_fd);
+      shutdown(player->client_fd, SHUT_RDWR);
+      continue;
+    }
+    sc_keepAlive(player->client_fd, now);
     sc_updateTime(player->client_fd, world_time);
+  }
+}
+
+// Disconnects clients that have stopped taking what we send them, or that
+// can't keep up even with only essential packets. As in tickKeepAlive,
+// the socket is only shut down here, and the main loop cleans up.
+void tickOutboundQueues () {
+  if (pending_output_count == 0) return;
+  int64_t now = get_program_time();
+  for (int i = 0; i < MAX_CONNECTIONS; i ++) {
+    if (connections[i].client_fd == -1 || !isOutputStalled(&connections[i], now)) continue;
+    printf("Client %d can't keep up with its output\n", connections[i].client_fd);
+    shutdown(connections[i].client_fd, SHUT_RDWR);
+  }
+}
+
+// Tick overrun count as of the last run of tickViewDistance
+uint32_t view_distance_overruns = 0;
+
+// Shrinks player view distances under load and grows them back when idle
+void tickViewDistance () {
+  // A tick that started late means that the whole server is struggling
+  uint8_t overloaded = tick_overruns != view_distance_overruns;
+  view_distance_overruns = tick_overruns;
+  FOR_EACH_LOADED_PLAYER(player) {
+    PlayerView *view = &player_view[player - player_data];
+    // A full socket buffer means the client can't keep up with us
+    if (overloaded || getSendQueueDepth(player->client_fd) > VIEW_DISTANCE_QUEUE_LIMIT) {
+      view->calm_ticks = 0;
+      if (view->current > MIN_VIEW_DISTANCE) setPlayerViewDistance(player, view->current - 1);
+      continue;
+    }
+    if (view->current > view->requested) {
+      setPlayerViewDistance(player, view->requested);
+    } else if (view->current < view->requested) {
+      if (++ view->calm_ticks < VIEW_DISTANCE_RECOVERY_TICKS) continue;
+      view->calm_ticks = 0;
+      setPlayerViewDistance(player, view->current + 1);
+    }
+  }
+}
+
+// Sends the latency of all players to all loaded players (for the tab list)
+void tickPlayerListLatency () {
+  beginBroadcast();
+  sc_playerInfoUpdateLatency(MEMORY_SINK_FD);
+  endBroadcast(-1, BROADCAST_KEEPING_UP, NULL, NULL);
+}
+
+// Deals damage to players standing in lava or next to cacti
+void tickEnvironmentDamage () {
+  FOR_EACH_LOADED_PLAYER(player) {
     // Tick damage from lava
     uint8_t block = getBlockAt(player->x, player->y, player->z);
     if (block >= B_lava && block < B_lava + 4) {
@@ -1642,7 +1801,12 @@ void handleServerTick (int64_t time_since_last_tick) {
       getBlockAt(player->x, player->y, player->z - 1) == B_cactus
     ) hurtEntity(player->client_fd, -1, D_cactus, 4);
     #endif
-    // Heal from saturation if player is able and has enough food
+  }
+}
+
+// Heals players from saturation if they're able and have enough food
+void tickHealing () {
+  FOR_EACH_LOADED_PLAYER(player) {
     if (player->health >= 20 || player->health == 0) continue;
     if (player->hunger < 18) continue;
     if (player->saturation >= 600) {
@@ -1654,10 +1818,11 @@ void handleServerTick (int64_t time_since_last_tick) {
     }
     sc_setHealth(player->client_fd, player->health, player->hunger, player->saturation);
   }
+}
 
-  // Perform regular checks for if it's time to write to disk
-  writeDataToDiskOnInterval();
-
+// Writes player data (and, optionally, block changes) to disk
+void tickDiskSync () {
+  writeDataToDisk();
   /**
    * If the RNG seed ever hits 0, it'll never generate anything
    * else. This is because the fast_rand function uses a simple
@@ -1666,244 +1831,348 @@ void handleServerTick (int64_t time_since_last_tick) {
    * the world seed as a good-enough fallback.
    */
   if (rng_seed == 0) rng_seed = world_seed;
+}
 
-  // Tick mob behavior
-  for (int i = 0; i < MAX_MOBS; i ++) {
-    if (mob_data[i].type == 0) continue;
-    int entity_id = -2 - i;
+// Returns non-zero if the mob in the given slot is a passive mob
+uint8_t isPassiveMob (int slot) {
+  return (
+    mob_type[slot] == 25 || // Chicken
+    mob_type[slot] == 28 || // Cow
+    mob_type[slot] == 95 || // Pig
+    mob_type[slot] == 106 // Sheep
+  );
+}
 
-    // Handle deallocation on mob death
-    if ((mob_data[i].data & 31) == 0) {
-      if (mob_data[i].y < (unsigned int)TICKS_PER_SECOND) {
-        mob_data[i].y ++;
-        continue;
-      }
-      mob_data[i].type = 0;
-      for (int j = 0; j < MAX_PLAYERS; j ++) {
-        if (player_data[j].client_fd == -1) continue;
-        // Spawn death smoke particles
-        sc_entityEvent(player_data[j].client_fd, entity_id, 60);
-        // Remove the entity from the client
-        sc_removeEntity(player_data[j].client_fd, entity_id);
-      }
+// Finds the player closest to the given mob by Manhattan distance
+PlayerData *getClosestPlayer (int slot, uint32_t *distance) {
+  PlayerData* closest_player = &player_data[0];
+  uint32_t closest_dist = 2147483647;
+  FOR_EACH_ONLINE_PLAYER(player) {
+    uint16_t curr_dist = (
+      abs(mob_x[slot] - player->x) +
+      abs(mob_z[slot] - player->z)
+    );
+    if (curr_dist < closest_dist) {
+      closest_dist = curr_dist;
+      closest_player = player;
+    }
+  }
+  *distance = closest_dist;
+  return closest_player;
+}
+
+// Counts down mob death timers, removing dead mobs once they run out
+void tickMobDeaths () {
+  // Iterate backwards, as freeing a mob moves the last one into its slot
+  for (int i = mob_count - 1; i >= 0; i --) {
+    if ((mob_data[i] & 31) != 0) continue;
+    if (mob_y[i] < (unsigned int)TICKS_PER_SECOND) {
+      mob_y[i] ++;
       continue;
     }
+    int entity_id = -2 - mob_id[i];
+    freeMob(i);
+    beginBroadcast();
+    // Spawn death smoke particles
+    sc_entityEvent(MEMORY_SINK_FD, entity_id, 60);
+    // Remove the entity from the client
+    sc_removeEntity(MEMORY_SINK_FD, entity_id);
+    endBroadcast(-1, BROADCAST_ONLINE, NULL, NULL);
+  }
+}
 
-    uint8_t passive = (
-      mob_data[i].type == 25 || // Chicken
-      mob_data[i].type == 28 || // Cow
-      mob_data[i].type == 95 || // Pig
-      mob_data[i].type == 106 // Sheep
-    );
-    // Mob "panic" timer, set to 3 after being hit
-    // Currently has no effect on hostile mobs
-    uint8_t panic = (mob_data[i].data >> 6) & 3;
+// Counts down the "panic" timers of passive mobs, once per second
+void tickMobPanic () {
+  for (int i = 0; i < mob_count; i ++) {
+    if ((mob_data[i] & 31) == 0) continue;
+    if ((mob_data[i] >> 6) & 3) mob_data[i] -= (1 << 6);
+  }
+}
 
-    // Burn hostile mobs if above ground during sunlight
-    if (!passive && (world_time < 13000 || world_time > 23460) && mob_data[i].y > 48) {
-      hurtEntity(entity_id, -1, D_on_fire, 2);
-    }
+// Burns hostile mobs that are above ground during sunlight, every tick
+void tickSunBurn () {
+  if (world_time >= 13000 && world_time <= 23460) return;
+  for (int i = 0; i < mob_count; i ++) {
+    if ((mob_data[i] & 31) == 0) continue;
+    if (isPassiveMob(i) || mob_y[i] <= 48) continue;
+    hurtEntity(-2 - mob_id[i], -1, D_on_fire, 2);
+  }
+}
+
+/**
+ * Attempts to move the mob in the given slot to the given X/Z coordinates,
+ * climbing or dropping by one block if needed. The target is expected to
+ * be at most one block away on each axis. Movement that would end up
+ * inside of a wall or another mob is cancelled or reduced to one axis.
+ */
+void moveMob (int i, short new_x, short new_z, uint8_t yaw, PlayerData *closest_player, uint32_t r) {
+
+  int entity_id = -2 - mob_id[i];
+
+  short old_x = mob_x[i], old_z = mob_z[i];
+  uint8_t old_y = mob_y[i], new_y = old_y;
+
+  // Holds the block that the mob is moving into
+  uint8_t block = getBlockAt(new_x, new_y, new_z);
+  // Holds the block above the target block, i.e. the "head" block
+  uint8_t block_above = getBlockAt(new_x, new_y + 1, new_z);
+
+  if ( // Validate movement on X axis
+    new_x != old_x &&
+    !isPassableBlock(getBlockAt(new_x, new_y + 1, old_z)) ||
+    (
+      !isPassableBlock(getBlockAt(new_x, new_y, old_z)) &&
+      !isPassableBlock(getBlockAt(new_x, new_y + 2, old_z))
+    )
+  ) {
+    new_x = old_x;
+    block = getBlockAt(old_x, new_y, new_z);
+    block_above = getBlockAt(old_x, new_y + 1, new_z);
+  }
+  if ( // Validate movement on Z axis
+    new_z != old_z &&
+    !isPassableBlock(getBlockAt(old_x, new_y + 1, new_z)) ||
+    (
+      !isPassableBlock(getBlockAt(old_x, new_y, new_z)) &&
+      !isPassableBlock(getBlockAt(old_x, new_y + 2, new_z))
+    )
+  ) {
+    new_z = old_z;
+    block = getBlockAt(new_x, new_y, old_z);
+    block_above = getBlockAt(new_x, new_y + 1, old_z);
+  }
+
+  if ( // Validate diagonal movement
+    new_x != old_x && new_z != old_z &&
+    !isPassableBlock(block_above) ||
+    (
+      !isPassableBlock(block) &&
+      !isPassableBlock(getBlockAt(new_x, new_y + 2, new_z))
+    )
+  ) {
+    // We know that movement along just one axis is fine thanks to the
+    // checks above, pick one based on proximity.
+    int dist_x = abs(old_x - closest_player->x);
+    int dist_z = abs(old_z - closest_player->z);
+    if (dist_x < dist_z) new_z = old_z;
+    else new_x = old_x;
+    block = getBlockAt(new_x, new_y, new_z);
+  }
+
+  // Check if we're supposed to climb/drop one block
+  // The checks above already ensure that there's enough space to climb
+  if (!isPassableBlock(block)) new_y += 1;
+  else if (isPassableBlock(getBlockAt(new_x, new_y - 1, new_z))) new_y -= 1;
+
+  // Exit early if all movement was cancelled
+  if (new_x == old_x && new_z == old_z && new_y == old_y) return;
+
+  // Prevent collisions with other mobs
+  for (int j = 0; j < mob_count; j ++) {
+    if (j == i) continue;
+    if (
+      mob_x[j] == new_x &&
+      mob_z[j] == new_z &&
+      abs((int)mob_y[j] - (int)new_y) < 2
+    ) return;
+  }
+
+  if ( // Hurt mobs that stumble into lava
+    (block >= B_lava && block < B_lava + 4) ||
+    (block_above >= B_lava && block_above < B_lava + 4)
+  ) hurtEntity(entity_id, -1, D_lava, 8);
+
+  // Store new mob position
+  mob_x[i] = new_x;
+  mob_y[i] = new_y;
+  mob_z[i] = new_z;
+
+  // Vary the yaw angle to look just a little less robotic
+  yaw += ((r >> 7) & 31) - 16;
+
+  // Broadcast relevant entity movement packets
+  beginBroadcast();
+  sc_teleportEntity (
+    MEMORY_SINK_FD, entity_id,
+    (double)new_x + 0.5, new_y, (double)new_z + 0.5,
+    yaw * 360 / 256, 0
+  );
+  sc_setHeadRotation(MEMORY_SINK_FD, entity_id, yaw);
+  endBroadcast(-1, BROADCAST_KEEPING_UP, NULL, NULL);
+
+}
+
+// Moves passive mobs around randomly, and more often when panicking
+void tickPassiveMobs () {
+  // Iterate backwards, as freeing a mob moves the last one into its slot
+  for (int i = mob_count - 1; i >= 0; i --) {
+    if ((mob_data[i] & 31) == 0) continue; // Skip dead mobs
+    if (!isPassiveMob(i)) continue;
 
     uint32_t r = fast_rand();
 
-    if (passive) {
-      if (panic) {
-        // If panicking, move randomly at up to 4 times per second
-        if (TICKS_PER_SECOND >= 4) {
-          uint32_t ticks_per_panic = (uint32_t)(TICKS_PER_SECOND / 4);
-          if (server_ticks % ticks_per_panic != 0) continue;
-        }
-        // Reset panic state after timer runs out
-        // Each panic timer tick takes one second
-        if (server_ticks % (uint32_t)TICKS_PER_SECOND == 0) {
-          mob_data[i].data -= (1 << 6);
-        }
-      } else {
-        // When not panicking, move idly once per 4 seconds on average
-        if (r % (4 * (unsigned int)TICKS_PER_SECOND) != 0) continue;
+    // Mob "panic" timer, set to 3 after being hit
+    if ((mob_data[i] >> 6) & 3) {
+      // If panicking, move randomly at up to 4 times per second
+      if (TICKS_PER_SECOND >= 4) {
+        uint32_t ticks_per_panic = (uint32_t)(TICKS_PER_SECOND / 4);
+        if (server_ticks % ticks_per_panic != 0) continue;
       }
     } else {
-      // Update hostile mobs once per second
-      if (server_ticks % (uint32_t)TICKS_PER_SECOND != 0) continue;
+      // When not panicking, move idly once per 4 seconds on average
+      if (r % (4 * (unsigned int)TICKS_PER_SECOND) != 0) continue;
     }
 
-    // Find the player closest to this mob
-    PlayerData* closest_player = &player_data[0];
-    uint32_t closest_dist = 2147483647;
-    for (int j = 0; j < MAX_PLAYERS; j ++) {
-      if (player_data[j].client_fd == -1) continue;
-      uint16_t curr_dist = (
-        abs(mob_data[i].x - player_data[j].x) +
-        abs(mob_data[i].z - player_data[j].z)
-      );
-      if (curr_dist < closest_dist) {
-        closest_dist = curr_dist;
-        closest_player = &player_data[j];
-      }
-    }
+    uint32_t closest_dist;
+    PlayerData *closest_player = getClosestPlayer(i, &closest_dist);
 
     // Despawn mobs past a certain distance from nearest player
     if (closest_dist > MOB_DESPAWN_DISTANCE) {
-      mob_data[i].type = 0;
+      freeMob(i);
       continue;
     }
 
-    short old_x = mob_data[i].x, old_z = mob_data[i].z;
-    uint8_t old_y = mob_data[i].y;
+    short new_x = mob_x[i], new_z = mob_z[i];
+    uint8_t yaw;
 
-    short new_x = old_x, new_z = old_z;
-    uint8_t new_y = old_y, yaw = 0;
+    // Move by one block on the X or Z axis
+    // Yaw is set to face in the direction of motion
+    if ((r >> 2) & 1) {
+      if ((r >> 1) & 1) { new_x += 1; yaw = 192; }
+      else { new_x -= 1; yaw = 64; }
+    } else {
+      if ((r >> 1) & 1) { new_z += 1; yaw = 0; }
+      else { new_z -= 1; yaw = 128; }
+    }
 
-    if (passive) { // Passive mob movement handling
+    moveMob(i, new_x, new_z, yaw, closest_player, r);
+  }
+}
 
-      // Move by one block on the X or Z axis
-      // Yaw is set to face in the direction of motion
-      if ((r >> 2) & 1) {
-        if ((r >> 1) & 1) { new_x += 1; yaw = 192; }
-        else { new_x -= 1; yaw = 64; }
-      } else {
-        if ((r >> 1) & 1) { new_z += 1; yaw = 0; }
-        else { new_z -= 1; yaw = 128; }
-      }
+// Moves hostile mobs towards the closest player, attacking when in range
+void tickHostileMobs () {
+  // Iterate backwards, as freeing a mob moves the last one into its slot
+  for (int i = mob_count - 1; i >= 0; i --) {
+    if ((mob_data[i] & 31) == 0) continue; // Skip dead mobs
+    if (isPassiveMob(i)) continue;
 
-    } else { // Hostile mob movement handling
+    int entity_id = -2 - mob_id[i];
 
-      // If we're already next to the player, hurt them and skip movement
-      if (closest_dist < 3 && abs(old_y - closest_player->y) < 2) {
-        hurtEntity(closest_player->client_fd, entity_id, D_generic, 6);
-        continue;
-      }
+    uint32_t r = fast_rand();
 
-      // Move towards the closest player on 8 axis
-      // The condition nesting ensures a correct yaw at 45 degree turns
-      if (closest_player->x < old_x) {
-        new_x -= 1; yaw = 64;
-        if (closest_player->z < old_z) { new_z -= 1; yaw += 32; }
-        else if (closest_player->z > old_z) { new_z += 1; yaw -= 32; }
-      }
-      else if (closest_player->x > old_x) {
-        new_x += 1; yaw = 192;
-        if (closest_player->z < old_z) { new_z -= 1; yaw -= 32; }
-        else if (closest_player->z > old_z) { new_z += 1; yaw += 32; }
-      } else {
-        if (closest_player->z < old_z) { new_z -= 1; yaw = 128; }
-        else if (closest_player->z > old_z) { new_z += 1; yaw = 0; }
-      }
+    uint32_t closest_dist;
+    PlayerData *closest_player = getClosestPlayer(i, &closest_dist);
 
+    // Despawn mobs past a certain distance from nearest player
+    if (closest_dist > MOB_DESPAWN_DISTANCE) {
+      freeMob(i);
+      continue;
     }
 
-    // Holds the block that the mob is moving into
-    uint8_t block = getBlockAt(new_x, new_y, new_z);
-    // Holds the block above the target block, i.e. the "head" block
-    uint8_t block_above = getBlockAt(new_x, new_y + 1, new_z);
-
-    if ( // Validate movement on X axis
-      new_x != old_x &&
-      !isPassableBlock(getBlockAt(new_x, new_y + 1, old_z)) ||
-      (
-        !isPassableBlock(getBlockAt(new_x, new_y, old_z)) &&
-        !isPassableBlock(getBlockAt(new_x, new_y + 2, old_z))
-      )
-    ) {
-      new_x = old_x;
-      block = getBlockAt(old_x, new_y, new_z);
-      block_above = getBlockAt(old_x, new_y + 1, new_z);
-    }
-    if ( // Validate movement on Z axis
-      new_z != old_z &&
-      !isPassableBlock(getBlockAt(old_x, new_y + 1, new_z)) ||
-      (
-        !isPassableBlock(getBlockAt(old_x, new_y, new_z)) &&
-        !isPassableBlock(getBlockAt(old_x, new_y + 2, new_z))
-      )
-    ) {
-      new_z = old_z;
-      block = getBlockAt(new_x, new_y, old_z);
-      block_above = getBlockAt(new_x, new_y + 1, old_z);
-    }
+    short old_x = mob_x[i], old_z = mob_z[i];
+    short new_x = old_x, new_z = old_z;
+    uint8_t yaw = 0;
 
-    if ( // Validate diagonal movement
-      new_x != old_x && new_z != old_z &&
-      !isPassableBlock(block_above) ||
-      (
-        !isPassableBlock(block) &&
-        !isPassableBlock(getBlockAt(new_x, new_y + 2, new_z))
-      )
-    ) {
-      // We know that movement along just one axis is fine thanks to the
-      // checks above, pick one based on proximity.
-      int dist_x = abs(old_x - closest_player->x);
-      int dist_z = abs(old_z - closest_player->z);
-      if (dist_x < dist_z) new_z = old_z;
-      else new_x = old_x;
-      block = getBlockAt(new_x, new_y, new_z);
+    // If we're already next to the player, hurt them and skip movement
+    if (closest_dist < 3 && abs(mob_y[i] - closest_player->y) < 2) {
+      hurtEntity(closest_player->client_fd, entity_id, D_generic, 6);
+      continue;
     }
 
-    // Check if we're supposed to climb/drop one block
-    // The checks above already ensure that there's enough space to climb
-    if (!isPassableBlock(block)) new_y += 1;
-    else if (isPassableBlock(getBlockAt(new_x, new_y - 1, new_z))) new_y -= 1;
-
-    // Exit early if all movement was cancelled
-    if (new_x == mob_data[i].x && new_z == old_z && new_y == old_y) continue;
-
-    // Prevent collisions with other mobs
-    uint8_t colliding = false;
-    for (int j = 0; j < MAX_MOBS; j ++) {
-      if (j == i) continue;
-      if (mob_data[j].type == 0) continue;
-      if (
-        mob_data[j].x == new_x &&
-        mob_data[j].z == new_z &&
-        abs((int)mob_data[j].y - (int)new_y) < 2
-      ) {
-        colliding = true;
-        break;
-      }
+    // Move towards the closest player on 8 axis
+    // The condition nesting ensures a correct yaw at 45 degree turns
+    if (closest_player->x < old_x) {
+      new_x -= 1; yaw = 64;
+      if (closest_player->z < old_z) { new_z -= 1; yaw += 32; }
+      else if (closest_player->z > old_z) { new_z += 1; yaw -= 32; }
     }
-    if (colliding) continue;
-
-    if ( // Hurt mobs that stumble into lava
-      (block >= B_lava && block < B_lava + 4) ||
-      (block_above >= B_lava && block_above < B_lava + 4)
-    ) hurtEntity(entity_id, -1, D_lava, 8);
-
-    // Store new mob position
-    mob_data[i].x = new_x;
-    mob_data[i].y = new_y;
-    mob_data[i].z = new_z;
-
-    // Vary the yaw angle to look just a little less robotic
-    yaw += ((r >> 7) & 31) - 16;
-
-    // Broadcast relevant entity movement packets
-    for (int j = 0; j < MAX_PLAYERS; j ++) {
-      if (player_data[j].client_fd == -1) continue;
-      sc_teleportEntity (
-        player_data[j].client_fd, entity_id,
-        (double)new_x + 0.5, new_y, (double)new_z + 0.5,
-        yaw * 360 / 256, 0
-      );
-      sc_setHeadRotation(player_data[j].client_fd, entity_id, yaw);
+    else if (closest_player->x > old_x) {
+      new_x += 1; yaw = 192;
+      if (closest_player->z < old_z) { new_z -= 1; yaw -= 32; }
+      else if (closest_player->z > old_z) { new_z += 1; yaw += 32; }
+    } else {
+      if (closest_player->z < old_z) { new_z -= 1; yaw = 128; }
+      else if (closest_player->z > old_z) { new_z += 1; yaw = 0; }
     }
 
+    moveMob(i, new_x, new_z, yaw, closest_player, r);
+  }
+}
+
+/**
+ * Table of periodic tasks run by the tick handler. Each task runs on
+ * ticks where (server_ticks % interval == phase), so tasks sharing an
+ * interval can be staggered to avoid landing on the same tick. Note that
+ * phase offsets only take effect when the tickrate is high enough for
+ * them to amount to at least one tick.
+ */
+PeriodicTask periodic_tasks[] = {
+  { "player timers", 1, 0, tickPlayerTimers },
+  { "view distance", 1, 0, tickViewDistance },
+  { "outbound queues", 1, 0, tickOutboundQueues },
+  { "mob deaths", 1, 0, tickMobDeaths },
+  { "sun burn", 1, 0, tickSunBurn },
+  { "passive mobs", 1, 0, tickPassiveMobs },
+  { "keep alive", TASK_TICKS(1), TASK_PHASE(1, 0), tickKeepAlive },
+  { "environment damage", TASK_TICKS(1), TASK_PHASE(1, 0.25f), tickEnvironmentDamage },
+  { "hostile mobs", TASK_TICKS(1), TASK_PHASE(1, 0.5f), tickHostileMobs },
+  { "healing", TASK_TICKS(1), TASK_PHASE(1, 0.75f), tickHealing },
+  { "mob panic", TASK_TICKS(1), TASK_PHASE(1, 0.875f), tickMobPanic },
+  { "player list latency", TASK_TICKS(5), TASK_PHASE(5, 0.5f), tickPlayerListLatency },
+  #ifdef DEV_ENABLE_STATS
+  { "stats dump", TASK_TICKS(STATS_DUMP_INTERVAL), 0, printStats },
+  #endif
+  { "disk sync", TASK_TICKS(DISK_SYNC_INTERVAL / 1000000.0f), TASK_PHASE(DISK_SYNC_INTERVAL / 1000000.0f, 0.5f), tickDiskSync }
+};
+int periodic_task_count = sizeof(periodic_tasks) / sizeof(PeriodicTask);
+
+// Advances the game state by one fixed step of TIME_BETWEEN_TICKS
+void handleServerTick () {
+
+  // Update world time
+  world_time = (world_time + TIME_BETWEEN_TICKS / 50000) % 24000;
+  // Increment server tick counter
+  server_ticks ++;
+
+  // Run all periodic tasks that are due on this tick
+  for (int i = 0; i < periodic_task_count; i ++) {
+    PeriodicTask *task = &periodic_tasks[i];
+    if (server_ticks % task->interval != task->phase) continue;
+    task->run();
   }
 
 }
 
+#ifdef DEV_ENABLE_STATS
+// Handles a chat command sent by a player (without the leading slash)
+// The only command is /stats, so without it, commands aren't handled at all
+void handleChatCommand (PlayerData *player, char *command) {
+
+  if (strcmp(command, "stats") == 0) {
+    sendStats(player->client_fd);
+    return;
+  }
+
+  sc_systemChat(player->client_fd, "Unknown command", 15);
+
+}
+#endif
+
 #ifdef ALLOW_CHESTS
+// Broadcast filter for players that have the chest at `context` open
+uint8_t hasChestOpen (PlayerData *player, void *context) {
+  uint8_t *storage_ptr = context;
+  return memcmp(player->craft_items, &storage_ptr, sizeof(storage_ptr)) == 0;
+}
+
 // Broadcasts a chest slot update to all clients who have that chest open,
 // except for the client who initiated the update.
 void broadcastChestUpdate (int origin_fd, uint8_t *storage_ptr, uint16_t item, uint8_t count, uint8_t slot) {
 
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    if (player_data[i].client_fd == -1) continue;
-    if (player_data[i].flags & 0x20) continue;
-    // Filter for players that have this chest open
-    if (memcmp(player_data[i].craft_items, &storage_ptr, sizeof(storage_ptr)) != 0) continue;
-    // Send slot update packet
-    sc_setContainerSlot(player_data[i].client_fd, 2, slot, count, item);
-  }
+  // Send slot update packet to players that have this chest open
+  beginBroadcast();
+  sc_setContainerSlot(MEMORY_SINK_FD, 2, slot, count, item);
+  endBroadcast(-1, BROADCAST_LOADED, hasChestOpen, storage_ptr);
 
   #ifndef DISK_SYNC_BLOCKS_ON_INTERVAL
   writeChestChangesToDisk(storage_ptr, slot);
@@ -13,14 +13,11 @@
 #include "tools.h"
 #include "registries.h"
 #include "serialize.h"
-
-int64_t last_disk_sync_time = 0;
+#include "stats.h"
 
 // Restores world data from disk, or writes world file if it doesn't exist
 int initSerializer () {
 
-  last_disk_sync_time = get_program_time();
-
   #ifdef ESP_PLATFORM
     esp_vfs_littlefs_conf_t conf = {
       .base_path = "/littlefs",
@@ -119,6 +116,10 @@ int initSerializer () {
 // Writes a range of block change entries to disk
 void writeBlockChangesToDisk (int from, int to) {
 
+  #ifdef DEV_ENABLE_STATS
+    int64_t start = get_program_time();
+  #endif
+
   // Try to open the file in rw (without overwriting)
   FILE *file = fopen(FILE_PATH, "r+b");
   if (!file) {
@@ -142,11 +143,19 @@ void writeBlockChangesToDisk (int from, int to) {
   }
 
   fclose(file);
+
+  #ifdef DEV_ENABLE_STATS
+    statsRecordDiskWrite(get_program_time() - start);
+  #endif
 }
 
 // Writes all player data to disk
 void writePlayerDataToDisk () {
 
+  #ifdef DEV_ENABLE_STATS
+    int64_t start = get_program_time();
+  #endif
+
   // Try to open the file in rw (without overwriting)
   FILE *file = fopen(FILE_PATH, "r+b");
   if (!file) {
@@ -168,14 +177,15 @@ void writePlayerDataToDisk () {
   }
 
   fclose(file);
-}
 
-// Writes data queued for interval writes, but only if enough time has passed
-void writeDataToDiskOnInterval () {
+  #ifdef DEV_ENABLE_STATS
+    statsRecordDiskWrite(get_program_time() - start);
+  #endif
+}
 
-  // Skip this write if enough time hasn't passed since the last one
-  if (get_program_time() - last_disk_sync_time < DISK_SYNC_INTERVAL) return;
-  last_disk_sync_time = get_program_time();
+// Writes data queued for interval writes
+// Called periodically by the tick scheduler, see DISK_SYNC_INTERVAL
+void writeDataToDisk () {
 
   // Write full player data and block changes buffers
   writePlayerDataToDisk();
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "globals.h"
+
+#ifdef DEV_ENABLE_STATS
+
+#include "tools.h"
+#include "packets.h"
+#include "stats.h"
+
+ServerStats server_stats;
+
+void statsRecordPacket (int packet_id, int64_t duration) {
+  if (packet_id < 0 || packet_id >= 128) return;
+  server_stats.packet_count[packet_id] ++;
+  server_stats.packet_time[packet_id] += duration;
+}
+
+void statsRecordChunk (int64_t duration) {
+  server_stats.chunk_count ++;
+  server_stats.chunk_time += duration;
+  if (duration > server_stats.chunk_time_max) server_stats.chunk_time_max = duration;
+}
+
+void statsRecordBlockChangeScan (uint32_t length) {
+  server_stats.block_change_lookups ++;
+  server_stats.block_change_scanned += length;
+  if (length > server_stats.block_change_scan_max) server_stats.block_change_scan_max = length;
+}
+
+void statsRecordTick (int64_t duration) {
+  if (server_stats.tick_count == 0 || duration < server_stats.tick_time_min) {
+    server_stats.tick_time_min = duration;
+  }
+  if (duration > server_stats.tick_time_max) server_stats.tick_time_max = duration;
+  server_stats.tick_count ++;
+  server_stats.tick_time += duration;
+}
+
+void statsRecordDiskWrite (int64_t duration) {
+  server_stats.disk_writes ++;
+  server_stats.disk_time += duration;
+  if (duration > server_stats.disk_time_max) server_stats.disk_time_max = duration;
+}
+
+// Returns the average of a total over a count, or 0 if the count is 0
+long long statsAverage (int64_t total, uint64_t count) {
+  if (count == 0) return 0;
+  return total / (int64_t)count;
+}
+
+/**
+ * Formats one line of the stats summary into the output buffer. Lines
+ * are numbered from 0, and the last few lines list the packet IDs with
+ * the highest cumulative handler time. Returns the length of the line,
+ * or 0 if there are no more lines to print.
+ */
+int formatStatsLine (int line, char *output, size_t size) {
+
+  ServerStats *s = &server_stats;
+  int written = 0;
+
+  switch (line) {
+    case 0:
+      written = snprintf(output, size,
+        "Ticks: %u, min/avg/max %lld/%lld/%lld us, %u overruns, %u dropped",
+        s->tick_count, (long long)s->tick_time_min, statsAverage(s->tick_time, s->tick_count),
+        (long long)s->tick_time_max, tick_overruns, ticks_dropped
+      );
+      break;
+    case 1:
+      written = snprintf(output, size,
+        "Chunks: %u, avg %lld us, max %lld us",
+        s->chunk_count, statsAverage(s->chunk_time, s->chunk_count), (long long)s->chunk_time_max
+      );
+      break;
+    case 2:
+      written = snprintf(output, size,
+        "Block changes: %d stored, %u lookups, avg scan %lld, max scan %u",
+        block_changes_count, s->block_change_lookups,
+        statsAverage(s->block_change_scanned, s->block_change_lookups), s->block_change_scan_max
+      );
+      break;
+    case 3:
+      written = snprintf(output, size,
+        "Network: %llu bytes sent, %llu bytes received",
+        (unsigned long long)s->bytes_sent, (unsigned long long)total_bytes_received
+      );
+      break;
+    case 4:
+      written = snprintf(output, size,
+        "Disk: %u writes, avg %lld us, max %lld us",
+        s->disk_writes, statsAverage(s->disk_time, s->disk_writes), (long long)s->disk_time_max
+      );
+      break;
+
+    default: {
+      // Find the packet ID with the Nth highest cumulative time,
+      // where N is the line index past the fixed lines above
+      int rank = line - 5;
+      if (rank >= 5) return 0;
+      uint8_t taken[128] = {0};
+      int best = -1;
+      for (int r = 0; r <= rank; r ++) {
+        best = -1;
+        for (int i = 0; i < 128; i ++) {
+          if (taken[i] || s->packet_count[i] == 0) continue;
+          if (best == -1 || s->packet_time[i] > s->packet_time[best]) best = i;
+        }
+        if (best == -1) return 0;
+        taken[best] = true;
+      }
+      written = snprintf(output, size,
+        "Packet 0x%02X: %u handled, %lld us total, avg %lld us",
+        best, s->packet_count[best], (long long)s->packet_time[best],
+        statsAverage(s->packet_time[best], s->packet_count[best])
+      );
+      break;
+    }
+  }
+
+  if (written < 0) return 0;
+  if ((size_t)written >= size) written = size - 1;
+  return written;
+}
+
+// Prints the stats summary to stdout
+void printStats () {
+  char line[160];
+  printf("Server stats:\n");
+  for (int i = 0; formatStatsLine(i, line, sizeof(line)); i ++) {
+    printf("  %s\n", line);
+  }
+  printf("\n");
+}
+
+// Sends the stats summary to a client as chat messages
+void sendStats (int client_fd) {
+  char line[160];
+  int len;
+  for (int i = 0; (len = formatStatsLine(i, line, sizeof(line))); i ++) {
+    sc_systemChat(client_fd, line, len);
+  }
+}
+
+#endif
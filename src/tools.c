@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
@@ -10,9 +11,13 @@
   #ifdef _WIN32
     #include <winsock2.h>
     #include <ws2tcpip.h>
+    #define SHUT_RDWR SD_BOTH
   #else
     #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <arpa/inet.h>
+    #include <sys/ioctl.h>
   #endif
   #include <unistd.h>
   #include <time.h>
@@ -24,7 +29,12 @@
 #include "globals.h"
 #include "varnum.h"
 #include "procedures.h"
+#include "packets.h"
 #include "tools.h"
+#include "stats.h"
+#include "trace.h"
+#include "compression.h"
+#include "netpoll.h"
 
 #ifndef htonll
   static uint64_t htonll (uint64_t value) {
@@ -41,17 +51,32 @@
 // Helps notice misread packets and clean up after errors
 uint64_t total_bytes_received = 0;
 
+uint8_t *memory_source = NULL;
+size_t memory_source_length = 0;
+size_t memory_source_offset = 0;
+
 ssize_t recv_all (int client_fd, void *buf, size_t n, uint8_t require_first) {
   char *p = buf;
   size_t total = 0;
 
+  // Read from the memory source, if set, as if it were a socket
+  if (memory_source) {
+    size_t available = memory_source_length - memory_source_offset;
+    if (n > available) n = available;
+    memcpy(p, memory_source + memory_source_offset, n);
+    memory_source_offset += n;
+    total_bytes_received += n;
+    traceCapture(p, n);
+    return n;
+  }
+
   // Track time of last meaningful network update
   // Used to handle timeout when client is stalling
   int64_t last_update_time = get_program_time();
 
   // If requested, exit early when first byte not immediately available
   if (require_first) {
-    ssize_t r = recv(client_fd, p, 1, MSG_PEEK);
+    ssize_t r = recvInput(client_fd, p, 1, MSG_PEEK);
     if (r <= 0) {
       if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
         return 0; // no first byte available yet
@@ -62,7 +87,7 @@ ssize_t recv_all (int client_fd, void *buf, size_t n, uint8_t require_first) {
 
   // Busy-wait (with task yielding) until we get exactly n bytes
   while (total < n) {
-    ssize_t r = recv(client_fd, p + total, n - total, 0);
+    ssize_t r = recvInput(client_fd, p + total, n - total, 0);
     if (r < 0) {
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
         // handle network timeout
@@ -70,6 +95,8 @@ ssize_t recv_all (int client_fd, void *buf, size_t n, uint8_t require_first) {
           disconnectClient(&client_fd, -1);
           return -1;
         }
+        // With io_uring, data only arrives while waiting on completions
+        waitForInput();
         task_yield();
         continue;
       } else {
@@ -79,6 +106,7 @@ ssize_t recv_all (int client_fd, void *buf, size_t n, uint8_t require_first) {
     } else if (r == 0) {
       // connection closed before full read
       total_bytes_received += total;
+      traceCapture(p, total);
       return total;
     }
     total += r;
@@ -86,12 +114,160 @@ ssize_t recv_all (int client_fd, void *buf, size_t n, uint8_t require_first) {
   }
 
   total_bytes_received += total;
+  traceCapture(p, total);
   return total; // got exactly n bytes
 }
 
-ssize_t send_all (int client_fd, const void *buf, ssize_t len) {
-  // Treat any input buffer as *uint8_t for simplicity
-  const uint8_t *p = (const uint8_t *)buf;
+uint8_t *memory_sink = NULL;
+size_t memory_sink_size = 0;
+size_t memory_sink_length = 0;
+uint8_t memory_sink_all = false;
+
+Connection connections[MAX_CONNECTIONS];
+// Indices into connections, by file descriptor (-1 if empty)
+// This is a hash table with linear probing.
+int16_t connection_lookup[CONNECTION_LOOKUP_SIZE];
+
+// Returns the first slot of connection_lookup to probe for a descriptor
+uint32_t hashConnection (int client_fd) {
+  return ((uint32_t)client_fd * 2654435761u) % CONNECTION_LOOKUP_SIZE;
+}
+
+// Adds a connection to connection_lookup
+void insertConnectionLookup (int index) {
+  uint32_t slot = hashConnection(connections[index].client_fd);
+  while (connection_lookup[slot] != -1) slot = (slot + 1) % CONNECTION_LOOKUP_SIZE;
+  connection_lookup[slot] = index;
+}
+
+// Marks all connection slots as unused
+void initConnections () {
+  for (int i = 0; i < MAX_CONNECTIONS; i ++) {
+    connections[i].client_fd = -1;
+  }
+  for (int i = 0; i < CONNECTION_LOOKUP_SIZE; i ++) {
+    connection_lookup[i] = -1;
+  }
+}
+
+// Assigns a connection slot to a newly accepted client
+// Returns NULL if all slots are taken, or if out of memory
+Connection *openConnection (int client_fd) {
+  for (int i = 0; i < MAX_CONNECTIONS; i ++) {
+    if (connections[i].client_fd != -1) continue;
+    // Outbound queues are only allocated for as long as they're in use,
+    // as they'd add up to a lot of idle memory on embedded targets
+    uint8_t *queue = malloc(OUTBOUND_QUEUE_SIZE);
+    if (queue == NULL) return NULL;
+    // New clients are checked for data right away, epoll or not
+    connections[i] = (Connection){ .client_fd = client_fd, .state = STATE_NONE, .ready = true };
+    connections[i].pending.queue = queue;
+    insertConnectionLookup(i);
+    return &connections[i];
+  }
+  return NULL;
+}
+
+// Frees the connection slot of a client
+void closeConnection (int client_fd) {
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL) return;
+  // Requests underway may still reference the buffers freed below
+  unwatchConnection(client_fd);
+  connection->client_fd = -1;
+  connection->player = NULL;
+  free(connection->pending.queue);
+  connection->pending.queue = NULL;
+  free(connection->pending.chunk_buffer);
+  connection->pending.chunk_buffer = NULL;
+  // Removing entries from the middle of a probe sequence is tricky, and
+  // clients don't disconnect often, so just rebuild the lookup table
+  for (int i = 0; i < CONNECTION_LOOKUP_SIZE; i ++) {
+    connection_lookup[i] = -1;
+  }
+  for (int i = 0; i < MAX_CONNECTIONS; i ++) {
+    if (connections[i].client_fd != -1) insertConnectionLookup(i);
+  }
+}
+
+// Returns the connection of the given client, or NULL if there is none
+Connection *getConnection (int client_fd) {
+  if (client_fd < 0) return NULL;
+  uint32_t slot = hashConnection(client_fd);
+  while (connection_lookup[slot] != -1) {
+    Connection *connection = &connections[connection_lookup[slot]];
+    if (connection->client_fd == client_fd) return connection;
+    slot = (slot + 1) % CONNECTION_LOOKUP_SIZE;
+  }
+  return NULL;
+}
+
+// Amount of clients with queued output
+int pending_output_count = 0;
+
+// Brings pending_output_count, epoll and the congestion flag in line with
+// the amount of output queued for a connection
+void updateQueueState (Connection *connection) {
+
+  PendingOutput *pending = &connection->pending;
+  size_t queued = pending->remaining + pending->queue_length;
+
+  uint8_t active = queued != 0 || pending->chunk_active;
+  if (active != pending->active) {
+    pending->active = active;
+    pending_output_count += active ? 1 : -1;
+    // Have epoll wake us up once there's room to send more
+    watchConnectionOutput(connection->client_fd, active);
+  }
+
+  if (!pending->congested && queued > OUTBOUND_HIGH_WATERMARK) {
+    pending->congested = true;
+    pending->congested_since = get_program_time();
+  } else if (pending->congested && queued < OUTBOUND_LOW_WATERMARK) {
+    pending->congested = false;
+  }
+
+}
+
+// Copies data to the end of a connection's ring buffer
+// The caller has to make sure that it fits
+void appendToQueue (PendingOutput *pending, const uint8_t *p, size_t len) {
+  size_t end = (pending->queue_start + pending->queue_length) % OUTBOUND_QUEUE_SIZE;
+  size_t first = len < OUTBOUND_QUEUE_SIZE - end ? len : OUTBOUND_QUEUE_SIZE - end;
+  memcpy(pending->queue + end, p, first);
+  memcpy(pending->queue, p + first, len - first);
+  pending->queue_length += len;
+}
+
+// Makes a single attempt at sending data, without waiting on the socket
+// Returns the amount of bytes sent (possibly 0), or -1 on error
+ssize_t sendNonBlocking (int client_fd, const uint8_t *p, size_t len) {
+  #ifdef _WIN32
+    ssize_t n = send(client_fd, p, len, 0);
+  #else
+    ssize_t n = send(client_fd, p, len, MSG_NOSIGNAL);
+  #endif
+  if (n > 0) {
+    statsRecordBytesSent(n);
+    return n;
+  }
+  if (n == 0) { // connection was closed, treat this as an error
+    errno = ECONNRESET;
+    return -1;
+  }
+  #ifdef _WIN32
+    int err = WSAGetLastError();
+    if (err == WSAEWOULDBLOCK || err == WSAEINTR) return 0;
+  #else
+    if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+  #endif
+  return -1;
+}
+
+// Sends data straight to the socket, blocking (with task yielding) until
+// all of it has been sent
+ssize_t sendImmediate (int client_fd, const uint8_t *p, ssize_t len) {
+
   ssize_t sent = 0;
 
   // Track time of last meaningful network update
@@ -123,7 +299,7 @@ ssize_t send_all (int client_fd, const void *buf, ssize_t len) {
     #endif
       // handle network timeout
       if (get_program_time() - last_update_time > NETWORK_TIMEOUT_TIME) {
-        disconnectClient(&client_fd, -2);
+        abortConnection(client_fd);
         return -1;
       }
       task_yield();
@@ -132,7 +308,749 @@ ssize_t send_all (int client_fd, const void *buf, ssize_t len) {
     return -1; // real error
   }
 
+  statsRecordBytesSent(sent);
   return sent;
+
+}
+
+/**
+ * Sends data to a client without waiting on its socket. Whatever the
+ * socket doesn't take right away is added to the client's queue, to be
+ * sent by flushPendingOutput on later iterations of the main loop.
+ *
+ * A client whose queue overflows can't be sent anything else without
+ * corrupting the stream, and gets disconnected. Output larger than the
+ * queue has to be sent by reference instead, see queueOutput and
+ * queueChunk.
+ */
+ssize_t sendOrQueue (int client_fd, const uint8_t *p, size_t len) {
+
+  // Sockets without a connection, such as rejected ones, have no queue
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL) return sendImmediate(client_fd, p, len);
+  if (connection->closing) return -1;
+  PendingOutput *pending = &connection->pending;
+
+  // Only write to the socket directly if nothing is queued ahead of this
+  // With io_uring, everything is queued, and sent on the next wait
+  size_t sent = 0;
+  if (!pending->active && !isUringActive()) {
+    ssize_t n = sendNonBlocking(client_fd, p, len);
+    if (n == -1) return -1;
+    if ((size_t)n == len) return len;
+    sent = n;
+    pending->last_update_time = get_program_time();
+  }
+
+  size_t rest = len - sent;
+  if (rest > OUTBOUND_QUEUE_SIZE - pending->queue_length) {
+    printf("Outbound queue of client %d overflowed\n", client_fd);
+    abortConnection(client_fd);
+    return -1;
+  }
+
+  appendToQueue(pending, p + sent, rest);
+  updateQueueState(connection);
+  return len;
+
+}
+
+// Small writes to one client at a time are collected here, so that a
+// packet written field by field leaves in a single send() instead of one
+// per field. See flushOutput for when this gets sent.
+uint8_t output_buffer[OUTPUT_BUFFER_SIZE];
+size_t output_length = 0;
+int output_fd = -1;
+
+// Sends whatever is in the output buffer
+// Returns -1 on error, in which case the output is lost
+ssize_t flushOutput () {
+  if (output_length == 0) return 0;
+  size_t length = output_length;
+  // Mark the buffer as empty before sending, since a timeout disconnects
+  // the client, which writes leave messages to others through the buffer
+  output_length = 0;
+  return sendOrQueue(output_fd, output_buffer, length);
+}
+
+// Throws away the output buffer if it holds output for the given client,
+// used when disconnecting. The buffer might hold a final message such as
+// a kick reason, so try to get it out first, but without waiting.
+void discardOutput (int client_fd) {
+  #ifdef ENABLE_IO_URING
+  // Output only leaves through the queue, so hand that over to the kernel
+  // before the connection's requests get cancelled, see unwatchUring
+  if (isUringActive()) {
+    if (output_length > 0 && output_fd == client_fd) flushOutput();
+    Connection *connection = getConnection(client_fd);
+    if (connection != NULL && !connection->closing) submitPendingOutput(connection);
+    return;
+  }
+  #endif
+  if (output_length == 0 || output_fd != client_fd) return;
+  size_t length = output_length;
+  output_length = 0;
+  // Anything queued would have to go out first
+  if (isOutputQueued(client_fd)) return;
+  #ifdef _WIN32
+    send(client_fd, output_buffer, length, 0);
+  #else
+    send(client_fd, output_buffer, length, MSG_NOSIGNAL);
+  #endif
+}
+
+// Sends data as-is, without applying packet compression
+ssize_t send_raw (int client_fd, const void *buf, ssize_t len) {
+  // Treat any input buffer as *uint8_t for simplicity
+  const uint8_t *p = (const uint8_t *)buf;
+
+  // Capture writes to the memory sink
+  if (client_fd == MEMORY_SINK_FD || memory_sink_all) {
+    if (memory_sink_length < memory_sink_size) {
+      size_t space = memory_sink_size - memory_sink_length;
+      memcpy(memory_sink + memory_sink_length, p, (size_t)len < space ? (size_t)len : space);
+    }
+    memory_sink_length += len;
+    return len;
+  }
+
+  // Make room in the output buffer, sending out what's in there if it
+  // belongs to another client or if this write doesn't fit. This repeats
+  // in case a failed send disconnected someone, buffering leave messages.
+  while (output_length > 0 && (output_fd != client_fd || output_length + len > OUTPUT_BUFFER_SIZE)) {
+    int flushed_fd = output_fd;
+    if (flushOutput() == -1 && flushed_fd == client_fd) return -1;
+  }
+
+  // Writes too large for the buffer are sent right away
+  if (len >= OUTPUT_BUFFER_SIZE) return sendOrQueue(client_fd, p, len);
+
+  memcpy(output_buffer + output_length, p, len);
+  output_length += len;
+  output_fd = client_fd;
+  return len;
+}
+
+// Marks the start of a burst of output, such as the chunks sent on spawn,
+// during which segments only go out once full. The burst is sent out when
+// endBulkOutput is called as many times as this was. Where the OS can't
+// hold back partial segments, the output buffer still batches writes.
+void beginBulkOutput (int client_fd) {
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL || connection->bulk_depth ++ > 0) return;
+  // With io_uring, a burst is sent out all at once anyway
+  if (isUringActive()) return;
+  #ifdef TCP_CORK
+    int cork = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+  #endif
+}
+
+void endBulkOutput (int client_fd) {
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL || connection->bulk_depth == 0) return;
+  if (-- connection->bulk_depth > 0) return;
+  if (output_fd == client_fd) flushOutput();
+  if (isUringActive()) return;
+  #ifdef TCP_CORK
+    int cork = 0;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+  #endif
+}
+
+#ifdef ENABLE_COMPRESSION
+
+// Amount of clients that have been sent Set Compression
+int compression_client_count = 0;
+
+// The outgoing packet currently being reframed, see sendFramed. Both
+// buffers leave room in front of the data for the new packet header.
+PacketFramer framer = { .active = false };
+uint8_t framer_buffer[FRAME_HEADER_SIZE + COMPRESSION_BUFFER_SIZE];
+uint8_t framer_output[FRAME_HEADER_SIZE + COMPRESSION_BUFFER_SIZE];
+
+// If set, writes to MEMORY_SINK_FD get compressed as well
+uint8_t memory_sink_compressed = false;
+
+// Buffers for compressed packets received from clients
+uint8_t inbound_compressed[COMPRESSION_INBOUND_SIZE];
+uint8_t inbound_packet[COMPRESSION_INBOUND_SIZE];
+
+uint8_t isCompressionEnabled (int client_fd) {
+  Connection *connection = getConnection(client_fd);
+  return connection != NULL && connection->compression;
+}
+
+void enableCompression (int client_fd) {
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL || connection->compression) return;
+  connection->compression = true;
+  compression_client_count ++;
+}
+
+void disableCompression (int client_fd) {
+  Connection *connection = getConnection(client_fd);
+  if (connection != NULL && connection->compression) {
+    connection->compression = false;
+    compression_client_count --;
+  }
+  // Forget any packet left unfinished, the file descriptor may be reused
+  if (framer.active && framer.client_fd == client_fd) framer.active = false;
+}
+
+// Writes a packet header in the compressed format into the bytes right
+// before `data`, returns the size of the header
+int putFramedHeader (uint8_t *data, uint32_t packet_length, uint32_t data_length) {
+  int size = sizeVarInt(packet_length) + sizeVarInt(data_length);
+  uint8_t *p = data - size;
+  p += encodeVarInt(p, packet_length);
+  encodeVarInt(p, data_length);
+  return size;
+}
+
+// Sends one whole packet (without its length prefix) in the compressed
+// format, with a single write. The packet is compressed if it's at least
+// as long as the threshold, and if that actually makes it any smaller.
+// `data` has to be preceded by FRAME_HEADER_SIZE bytes of scratch space.
+ssize_t sendPacketFrame (int client_fd, uint8_t *data, uint32_t length) {
+
+  if (length >= COMPRESSION_THRESHOLD) {
+    // Compressed data only pays off if it's smaller than the uncompressed
+    // data, plus the single byte of its zero data length
+    uint8_t *out = framer_output + FRAME_HEADER_SIZE;
+    size_t compressed = zlibCompress(data, length, out, length + 1 - sizeVarInt(length));
+    if (compressed != 0) {
+      int header = putFramedHeader(out, sizeVarInt(length) + compressed, length);
+      return send_raw(client_fd, out - header, header + compressed);
+    }
+  }
+
+  // Uncompressed packets are marked with a data length of 0
+  int header = putFramedHeader(data, length + 1, 0);
+  return send_raw(client_fd, data - header, header + length);
+
+}
+
+// Packets are written field by field, starting with their length, in the
+// uncompressed format. For clients with compression enabled, this picks
+// out packet boundaries by parsing those lengths, collects each packet
+// into a buffer, and sends it on in the compressed format once complete.
+// Packets too large for the buffer are passed through uncompressed.
+ssize_t sendFramed (int client_fd, const uint8_t *p, ssize_t len) {
+
+  ssize_t result = len;
+  ssize_t offset = 0;
+
+  while (offset < len) {
+
+    // Parse the length prefix of a new packet, one byte at a time
+    if (!framer.active || framer.client_fd != client_fd || framer.in_header) {
+      if (!framer.active || framer.client_fd != client_fd) {
+        framer.active = true;
+        framer.client_fd = client_fd;
+        framer.length = 0;
+        framer.header_shift = 0;
+        framer.in_header = true;
+      }
+      uint8_t byte = p[offset ++];
+      framer.length |= (uint32_t)(byte & SEGMENT_BITS) << framer.header_shift;
+      framer.header_shift += 7;
+      if (byte & CONTINUE_BIT) continue;
+
+      framer.in_header = false;
+      framer.remaining = framer.length;
+      framer.buffering = framer.length <= COMPRESSION_BUFFER_SIZE;
+      if (!framer.buffering) {
+        uint8_t header[FRAME_HEADER_SIZE];
+        int size = putFramedHeader(header + FRAME_HEADER_SIZE, framer.length + 1, 0);
+        if (send_raw(client_fd, header + FRAME_HEADER_SIZE - size, size) == -1) result = -1;
+      }
+      if (framer.remaining == 0) framer.active = false;
+      continue;
+    }
+
+    // Collect or pass through the packet's contents
+    size_t n = (size_t)(len - offset) < framer.remaining ? (size_t)(len - offset) : framer.remaining;
+    if (framer.buffering) {
+      memcpy(framer_buffer + FRAME_HEADER_SIZE + framer.length - framer.remaining, p + offset, n);
+    } else if (send_raw(client_fd, p + offset, n) == -1) {
+      result = -1;
+    }
+    offset += n;
+    framer.remaining -= n;
+
+    if (framer.remaining == 0) {
+      framer.active = false;
+      if (
+        framer.buffering &&
+        sendPacketFrame(client_fd, framer_buffer + FRAME_HEADER_SIZE, framer.length) == -1
+      ) result = -1;
+    }
+
+  }
+
+  // Keep consuming input even after errors, so that the framer doesn't
+  // lose track of packet boundaries
+  return result;
+
+}
+
+// Reframes a buffer of complete packets in the uncompressed format, such
+// as configuration_bin, into the memory sink
+void reframeToMemorySink (const uint8_t *data, size_t length) {
+  int offset = 0;
+  while (offset < (int)length) {
+    uint32_t packet_length = decodeVarInt(data, length, &offset);
+    if (packet_length <= COMPRESSION_BUFFER_SIZE) {
+      memcpy(framer_buffer + FRAME_HEADER_SIZE, data + offset, packet_length);
+      sendPacketFrame(MEMORY_SINK_FD, framer_buffer + FRAME_HEADER_SIZE, packet_length);
+    } else {
+      uint8_t header[FRAME_HEADER_SIZE];
+      int size = putFramedHeader(header + FRAME_HEADER_SIZE, packet_length + 1, 0);
+      send_raw(MEMORY_SINK_FD, header + FRAME_HEADER_SIZE - size, size);
+      send_raw(MEMORY_SINK_FD, data + offset, packet_length);
+    }
+    offset += packet_length;
+  }
+}
+
+// Reads the rest of a compressed packet, decompresses it, and points the
+// memory source at the result, so that the packet can be handled as usual
+// Returns non-zero on failure
+int recvCompressed (int client_fd, int length, int data_length) {
+  if (length <= 0 || length > COMPRESSION_INBOUND_SIZE) return 1;
+  if (data_length <= 0 || data_length > COMPRESSION_INBOUND_SIZE) return 1;
+  if (recv_all(client_fd, inbound_compressed, length, false) != length) return 1;
+  if (zlibDecompress(inbound_compressed, length, inbound_packet, data_length) != data_length) return 1;
+  memory_source = inbound_packet;
+  memory_source_length = data_length;
+  memory_source_offset = 0;
+  return 0;
+}
+
+#endif
+
+ssize_t send_all (int client_fd, const void *buf, ssize_t len) {
+  #ifdef ENABLE_COMPRESSION
+  // Packets to clients with compression enabled have to be reframed
+  if (
+    (client_fd == MEMORY_SINK_FD && memory_sink_compressed) || (
+      compression_client_count > 0 &&
+      ((framer.active && framer.client_fd == client_fd) || isCompressionEnabled(client_fd))
+    )
+  ) return sendFramed(client_fd, buf, len);
+  #endif
+  return send_raw(client_fd, buf, len);
+}
+
+// Starts sending a large buffer without blocking on it. Whatever doesn't
+// fit in the socket buffer right away is sent by flushPendingOutput on
+// later iterations of the main loop. The buffer is not copied, so it has
+// to stay valid until sent - in practice, it's always static data.
+void queueOutput (int client_fd, const uint8_t *buf, size_t len) {
+
+  if (len == 0) return;
+
+  // Writes to the memory sink never block
+  if (client_fd == MEMORY_SINK_FD || memory_sink_all) {
+    send_raw(client_fd, buf, len);
+    return;
+  }
+
+  // Whatever was written before has to go out first
+  if (output_fd == client_fd) flushOutput();
+
+  // If something's already queued for this client, this has to wait its
+  // turn, so take the usual way through the queue. The data is sent as-is
+  // either way, it's already framed for the client.
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL || connection->pending.active) {
+    send_raw(client_fd, buf, len);
+    return;
+  }
+
+  PendingOutput *pending = &connection->pending;
+  pending->data = buf;
+  pending->remaining = len;
+  pending->last_update_time = get_program_time();
+  updateQueueState(connection);
+
+  // Get as much as possible out right away
+  // Errors here surface on the main loop's next read from this client
+  flushPendingOutput(client_fd);
+
+}
+
+/**
+ * Starts sending a Chunk Data packet without blocking on it. Chunks are
+ * too large to queue, but can be built from their coordinates at any time,
+ * so only those are kept, and flushPendingOutput builds and sends the
+ * packet piece by piece as the client's socket takes it. Anything written
+ * to the client in the meantime is queued up behind the chunk. Only one
+ * chunk can be underway per client, and only with nothing else queued, so
+ * returns false (having sent nothing) if anything is, or if there's no
+ * memory for the piece buffer.
+ */
+uint8_t queueChunk (int client_fd, short x, short z, uint8_t framed) {
+
+  // Whatever was written before has to go out first
+  if (output_fd == client_fd) flushOutput();
+
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL || connection->closing || connection->pending.active) return false;
+
+  PendingOutput *pending = &connection->pending;
+  // Only players ever get chunks, so status pings don't need this buffer
+  if (pending->chunk_buffer == NULL) {
+    pending->chunk_buffer = malloc(chunk_piece_size);
+    if (pending->chunk_buffer == NULL) return false;
+  }
+  pending->chunk_active = true;
+  pending->chunk_framed = framed;
+  pending->chunk_piece = 0;
+  pending->chunk_piece_length = 0;
+  pending->chunk_piece_sent = 0;
+  pending->chunk_x = x;
+  pending->chunk_z = z;
+  pending->last_update_time = get_program_time();
+  updateQueueState(connection);
+
+  flushPendingOutput(client_fd);
+  return true;
+
+}
+
+// Returns how much can be written to the given client without overflowing
+// its outbound queue, even if its socket doesn't take any of it
+size_t getOutputRoom (int client_fd) {
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL || memory_sink_all) return SIZE_MAX;
+  size_t room = OUTBOUND_QUEUE_SIZE - connection->pending.queue_length;
+  // The output buffer gets flushed into the queue first
+  if (output_fd == client_fd) room = output_length < room ? room - output_length : 0;
+  return room;
+}
+
+// Sends as much queued output for the given client as the socket accepts
+// Returns 1 if output is still pending, 0 if done, or -1 on error
+int flushPendingOutput (int client_fd) {
+
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL || !connection->pending.active) return 0;
+  PendingOutput *pending = &connection->pending;
+
+  #ifdef ENABLE_IO_URING
+  if (isUringActive()) return submitPendingOutput(connection);
+  #endif
+
+  int result = 0;
+  while (pending->remaining > 0 || pending->chunk_active || pending->queue_length > 0) {
+    // Referenced data goes first, then any chunk, then the ring buffer up
+    // to where it wraps
+    const uint8_t *data;
+    size_t length;
+    if (pending->remaining > 0) {
+      data = pending->data;
+      length = pending->remaining;
+    } else if (pending->chunk_active) {
+      // Pieces are built only once the previous one is out, so that a
+      // stalled socket doesn't cost a chunk section's worth of worldgen
+      // on every pass of the main loop
+      if (pending->chunk_piece_length == 0) {
+        pending->chunk_piece_length = buildChunkPiece(pending->chunk_buffer, pending->chunk_piece, pending->chunk_x, pending->chunk_z, pending->chunk_framed);
+      }
+      data = pending->chunk_buffer + pending->chunk_piece_sent;
+      length = pending->chunk_piece_length - pending->chunk_piece_sent;
+    } else {
+      data = pending->queue + pending->queue_start;
+      length = OUTBOUND_QUEUE_SIZE - pending->queue_start;
+      if (pending->queue_length < length) length = pending->queue_length;
+    }
+
+    ssize_t n = sendNonBlocking(client_fd, data, length);
+    if (n == -1) { // connection closed or real error
+      result = -1;
+      break;
+    }
+    if (n == 0) {
+      // Give up on clients that stop reading altogether
+      result = get_program_time() - pending->last_update_time > NETWORK_TIMEOUT_TIME ? -1 : 1;
+      break;
+    }
+
+    if (pending->remaining > 0) {
+      pending->data += n;
+      pending->remaining -= n;
+    } else if (pending->chunk_active) {
+      pending->chunk_piece_sent += n;
+      if ((size_t)n == length) {
+        pending->chunk_piece_length = 0;
+        pending->chunk_piece_sent = 0;
+        if (++ pending->chunk_piece == CHUNK_PIECE_COUNT) pending->chunk_active = false;
+      }
+    } else {
+      pending->queue_start = (pending->queue_start + n) % OUTBOUND_QUEUE_SIZE;
+      pending->queue_length -= n;
+    }
+    pending->last_update_time = get_program_time();
+  }
+
+  if (result == -1) {
+    pending->remaining = 0;
+    pending->chunk_active = false;
+    pending->queue_length = 0;
+  }
+  updateQueueState(connection);
+  return result;
+
+}
+
+#ifdef ENABLE_IO_URING
+
+/**
+ * Hands a connection's pending output over to io_uring, in the same order
+ * flushPendingOutput sends it. Sends are linked so that each only starts
+ * once the one before it has completed in full. Chunk pieces are sent on
+ * their own, as the next piece can only be built once the last is out.
+ * Only one batch is underway at a time, and whatever gets queued in the
+ * meantime goes out once it has completed, see waitForUring.
+ * Returns 1, as output is always still pending at this point.
+ */
+int submitPendingOutput (Connection *connection) {
+
+  PendingOutput *pending = &connection->pending;
+  if (connection->sends_underway > 0 || connection->closing) return 1;
+
+  // Each of the sends below may be linked to the next
+  reserveSubmissions(3);
+
+  if (pending->remaining > 0) {
+    submitSend(connection, OUTPUT_DATA, pending->data, pending->remaining, !pending->chunk_active && pending->queue_length > 0);
+    if (pending->chunk_active) return 1;
+  } else if (pending->chunk_active) {
+    if (pending->chunk_piece_length == 0) {
+      pending->chunk_piece_length = buildChunkPiece(pending->chunk_buffer, pending->chunk_piece, pending->chunk_x, pending->chunk_z, pending->chunk_framed);
+    }
+    submitSend(connection, OUTPUT_CHUNK, pending->chunk_buffer + pending->chunk_piece_sent, pending->chunk_piece_length - pending->chunk_piece_sent, false);
+    return 1;
+  }
+
+  // The ring buffer takes two sends if it wraps around
+  if (pending->queue_length > 0) {
+    size_t first = OUTBOUND_QUEUE_SIZE - pending->queue_start;
+    if (pending->queue_length <= first) {
+      submitSend(connection, OUTPUT_QUEUE, pending->queue + pending->queue_start, pending->queue_length, false);
+    } else {
+      submitSend(connection, OUTPUT_QUEUE, pending->queue + pending->queue_start, first, true);
+      submitSend(connection, OUTPUT_QUEUE, pending->queue, pending->queue_length - first, false);
+    }
+  }
+
+  return 1;
+
+}
+
+// Accounts for a completed io_uring send of the given part of a
+// connection's pending output. Output dropped while the send was underway
+// is already gone, so progress is clamped to what's left.
+void completeOutput (Connection *connection, int part, int result) {
+
+  PendingOutput *pending = &connection->pending;
+
+  if (result < 0) {
+    // Cancelled sends belong to connections that are being closed, and
+    // sends linked to a failed one are cancelled along with it
+    if (result != -ECANCELED) abortConnection(connection->client_fd);
+    return;
+  }
+
+  size_t n = result;
+  statsRecordBytesSent(n);
+  if (n > 0) pending->last_update_time = get_program_time();
+
+  if (part == OUTPUT_DATA) {
+    if (n > pending->remaining) n = pending->remaining;
+    pending->data += n;
+    pending->remaining -= n;
+  } else if (part == OUTPUT_CHUNK) {
+    if (!pending->chunk_active) return;
+    pending->chunk_piece_sent += n;
+    if (pending->chunk_piece_sent >= pending->chunk_piece_length) {
+      pending->chunk_piece_length = 0;
+      pending->chunk_piece_sent = 0;
+      if (++ pending->chunk_piece == CHUNK_PIECE_COUNT) pending->chunk_active = false;
+    }
+  } else {
+    if (n > pending->queue_length) n = pending->queue_length;
+    pending->queue_start = (pending->queue_start + n) % OUTBOUND_QUEUE_SIZE;
+    pending->queue_length -= n;
+  }
+
+  updateQueueState(connection);
+
+}
+
+#endif
+
+// Discards any queued output for the given client
+void dropPendingOutput (int client_fd) {
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL || !connection->pending.active) return;
+  connection->pending.remaining = 0;
+  connection->pending.chunk_active = false;
+  connection->pending.queue_length = 0;
+  updateQueueState(connection);
+}
+
+/**
+ * Gives up on a client whose output can't be delivered. Disconnecting
+ * right away isn't safe from the output path: the caller may be halfway
+ * through a packet, possibly held in the shared framer buffers, or looping
+ * over players, while a disconnect broadcasts a leave message to everyone.
+ * So, as in tickKeepAlive, the socket is only shut down, and the main loop
+ * disconnects the client once reading from it fails. Until then, any
+ * further output to the client is discarded.
+ */
+void abortConnection (int client_fd) {
+  Connection *connection = getConnection(client_fd);
+  if (connection == NULL || connection->closing) return;
+  connection->closing = true;
+  dropPendingOutput(client_fd);
+  if (output_fd == client_fd) output_length = 0;
+  shutdown(client_fd, SHUT_RDWR);
+}
+
+// Returns whether anything is waiting to be sent to the given client
+uint8_t isOutputQueued (int client_fd) {
+  if (pending_output_count == 0) return false;
+  Connection *connection = getConnection(client_fd);
+  return connection != NULL && connection->pending.active;
+}
+
+// Returns whether the given client has fallen far enough behind on its
+// output that it should be spared anything that isn't essential
+uint8_t isOutputCongested (int client_fd) {
+  if (pending_output_count == 0) return false;
+  Connection *connection = getConnection(client_fd);
+  return connection != NULL && connection->pending.congested;
+}
+
+// Returns whether a connection has stopped taking its queued output, or
+// has stayed congested for too long
+uint8_t isOutputStalled (Connection *connection, int64_t now) {
+  PendingOutput *pending = &connection->pending;
+  if (!pending->active) return false;
+  if (now - pending->last_update_time > NETWORK_TIMEOUT_TIME) return true;
+  return pending->congested && now - pending->congested_since > OUTBOUND_CONGESTION_TIMEOUT;
+}
+
+// Packets being broadcast, see beginBroadcast. Used as a stack, so that a
+// broadcast can begin while another one is being sent out, as happens when
+// a client times out mid-broadcast and its leave message goes out.
+uint8_t broadcast_buffer[BROADCAST_BUFFER_SIZE];
+size_t broadcast_top = 0;
+// Memory sink to restore once the broadcast has been encoded
+uint8_t *broadcast_sink;
+size_t broadcast_sink_size, broadcast_sink_length;
+
+// Starts encoding packets for a broadcast. Until endBroadcast is called,
+// packets have to be written to MEMORY_SINK_FD.
+void beginBroadcast () {
+  broadcast_sink = memory_sink;
+  broadcast_sink_size = memory_sink_size;
+  broadcast_sink_length = memory_sink_length;
+  memory_sink = broadcast_buffer + broadcast_top;
+  memory_sink_size = BROADCAST_BUFFER_SIZE - broadcast_top;
+  memory_sink_length = 0;
+}
+
+// Sends the packets written since beginBroadcast to the given group of
+// players (see BROADCAST_ONLINE), except for `exclude_fd` and those
+// rejected by `filter` (if not NULL). Each recipient gets the same bytes,
+// so packets are only encoded once, and once more in the compressed
+// format if any recipient needs that.
+void endBroadcast (int exclude_fd, uint8_t recipients, BroadcastFilter filter, void *context) {
+
+  uint8_t *data = memory_sink;
+  size_t length = memory_sink_length;
+  memory_sink = broadcast_sink;
+  memory_sink_size = broadcast_sink_size;
+  memory_sink_length = broadcast_sink_length;
+
+  if (length == 0) return;
+  if (length > BROADCAST_BUFFER_SIZE - broadcast_top) {
+    printf("WARNING: Dropped broadcast of %lu bytes, buffer is full\n", (unsigned long)length);
+    return;
+  }
+
+  // Keep nested broadcasts from overwriting this one
+  size_t previous_top = broadcast_top;
+  broadcast_top += length;
+
+  #ifdef ENABLE_COMPRESSION
+  // Compressed copy of the packets, encoded on first use
+  uint8_t *compressed = NULL;
+  size_t compressed_length = 0;
+  #endif
+
+  // Most broadcasts only go to loaded players, which have a list of their own
+  PlayerData **list = recipients == BROADCAST_ONLINE ? online_players : loaded_players;
+  int count = recipients == BROADCAST_ONLINE ? online_player_count : loaded_player_count;
+  // Congestion only needs checking for if anyone's behind
+  uint8_t skip_congested = recipients == BROADCAST_KEEPING_UP && pending_output_count > 0;
+
+  FOR_EACH_PLAYER(player, list, count) {
+    int client_fd = player->client_fd;
+    if (client_fd == exclude_fd) continue;
+    if (skip_congested && isOutputCongested(client_fd)) continue;
+    if (filter != NULL && !filter(player, context)) continue;
+
+    #ifdef ENABLE_COMPRESSION
+    if (compression_client_count > 0 && isCompressionEnabled(client_fd)) {
+      if (compressed == NULL) {
+        // Borrow the memory sink once more, this time on top of the stack
+        compressed = broadcast_buffer + broadcast_top;
+        beginBroadcast();
+        reframeToMemorySink(data, length);
+        compressed_length = memory_sink_length;
+        memory_sink = broadcast_sink;
+        memory_sink_size = broadcast_sink_size;
+        memory_sink_length = broadcast_sink_length;
+        if (compressed_length > BROADCAST_BUFFER_SIZE - broadcast_top) {
+          printf("WARNING: Dropped compressed broadcast of %lu bytes, buffer is full\n", (unsigned long)compressed_length);
+          compressed_length = 0;
+        }
+        broadcast_top += compressed_length;
+      }
+      if (compressed_length != 0) send_raw(client_fd, compressed, compressed_length);
+      continue;
+    }
+    #endif
+
+    send_raw(client_fd, data, length);
+  }
+
+  broadcast_top = previous_top;
+
+}
+
+// Returns the amount of bytes sent to a client that haven't left yet,
+// counting buffered and queued output, and whatever is still in the socket
+// buffer. The latter can only be measured on Linux.
+size_t getSendQueueDepth (int client_fd) {
+  size_t depth = output_fd == client_fd ? output_length : 0;
+  if (pending_output_count > 0) {
+    Connection *connection = getConnection(client_fd);
+    if (connection != NULL) depth += connection->pending.remaining + connection->pending.queue_length;
+  }
+  #ifdef __linux__
+    // Sends through io_uring only complete once the socket buffer has
+    // taken all of their data, so queued output is close enough there
+    if (isUringActive()) return depth;
+    int unsent = 0;
+    if (ioctl(client_fd, TIOCOUTQ, &unsent) == 0 && unsent > 0) depth += unsent;
+  #endif
+  return depth;
 }
 
 ssize_t writeByte (int client_fd, uint8_t byte) {
@@ -239,11 +1157,16 @@ uint64_t splitmix64 (uint64_t state) {
 }
 
 #ifndef ESP_PLATFORM
+// If not negative, get_program_time returns this instead of reading the
+// clock. The replay tool uses this to play back the recorded timeline.
+int64_t program_time_override = -1;
+
 // Returns system time in microseconds.
 // On ESP-IDF, this is available in "esp_timer.h", and returns time *since
 // the start of the program*, and NOT wall clock time. To ensure
 // compatibility, this should only be used to measure time intervals.
 int64_t get_program_time () {
+  if (program_time_override >= 0) return program_time_override;
   struct timespec ts;
   clock_gettime(CLOCK_MONOTONIC, &ts);
   return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
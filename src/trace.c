@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "globals.h"
+
+#ifdef DEV_RECORD_TRACE
+
+#include "tools.h"
+#include "trace.h"
+
+FILE *trace_file = NULL;
+int64_t trace_start_time;
+
+// Packet currently being captured, if any
+uint8_t trace_capturing = false;
+int trace_client_fd, trace_length, trace_packet_id;
+int64_t trace_packet_time;
+uint8_t trace_state;
+uint8_t trace_payload[TRACE_MAX_PAYLOAD];
+uint32_t trace_payload_size;
+
+// Opens the trace file and writes the header, call after hashing the seeds
+int traceOpen () {
+
+  trace_file = fopen(TRACE_FILE_PATH, "wb");
+  if (!trace_file) {
+    perror("Failed to open trace file");
+    return 1;
+  }
+  trace_start_time = get_program_time();
+
+  uint32_t version = TRACE_VERSION;
+  fwrite(TRACE_MAGIC, 1, 4, trace_file);
+  fwrite(&version, sizeof(version), 1, trace_file);
+  fwrite(&world_seed, sizeof(world_seed), 1, trace_file);
+  fwrite(&rng_seed, sizeof(rng_seed), 1, trace_file);
+  fwrite(&trace_start_time, sizeof(trace_start_time), 1, trace_file);
+
+  printf("Recording packet trace to \"%s\"\n\n", TRACE_FILE_PATH);
+  return 0;
+}
+
+void traceEventHeader (uint8_t type, int32_t client_fd, int64_t time) {
+  time -= trace_start_time;
+  fwrite(&type, 1, 1, trace_file);
+  fwrite(&time, sizeof(time), 1, trace_file);
+  fwrite(&client_fd, sizeof(client_fd), 1, trace_file);
+}
+
+void traceConnect (int client_fd) {
+  if (!trace_file) return;
+  traceEventHeader(TRACE_EVENT_CONNECT, client_fd, get_program_time());
+}
+
+void traceDisconnect (int client_fd) {
+  if (!trace_file) return;
+  // If we're disconnecting mid-packet, write the packet out first,
+  // so that the replay doesn't handle it after the disconnect
+  if (trace_capturing && trace_client_fd == client_fd) tracePacketEnd();
+  traceEventHeader(TRACE_EVENT_DISCONNECT, client_fd, get_program_time());
+  fflush(trace_file);
+}
+
+void traceTick () {
+  if (!trace_file) return;
+  traceEventHeader(TRACE_EVENT_TICK, -1, get_program_time());
+  // Flush once per tick, so that traces survive crashes
+  fflush(trace_file);
+}
+
+// Starts capturing the payload of a packet as it's read by recv_all
+void tracePacketBegin (int client_fd, int length, int packet_id, int state) {
+  if (!trace_file) return;
+  trace_capturing = true;
+  // Packets are written out once handled, but stamped with when they came in
+  trace_packet_time = get_program_time();
+  trace_client_fd = client_fd;
+  trace_length = length;
+  trace_packet_id = packet_id;
+  trace_state = state;
+  trace_payload_size = 0;
+}
+
+// Writes out the packet captured since tracePacketBegin
+void tracePacketEnd () {
+  if (!trace_capturing) return;
+  trace_capturing = false;
+  traceEventHeader(TRACE_EVENT_PACKET, trace_client_fd, trace_packet_time);
+  fwrite(&trace_state, 1, 1, trace_file);
+  fwrite(&trace_length, sizeof(trace_length), 1, trace_file);
+  fwrite(&trace_packet_id, sizeof(trace_packet_id), 1, trace_file);
+  fwrite(&trace_payload_size, sizeof(trace_payload_size), 1, trace_file);
+  fwrite(trace_payload, 1, trace_payload_size, trace_file);
+}
+
+// Called by recv_all with every chunk of data it reads
+void traceCapture (const void *data, size_t length) {
+  if (!trace_capturing) return;
+  if (length > TRACE_MAX_PAYLOAD - trace_payload_size) {
+    length = TRACE_MAX_PAYLOAD - trace_payload_size;
+  }
+  memcpy(trace_payload + trace_payload_size, data, length);
+  trace_payload_size += length;
+}
+
+#endif
@@ -10,8 +10,26 @@
 #include "varnum.h"
 #include "globals.h"
 #include "tools.h"
+#include "trace.h"
 
 int32_t readVarInt (int client_fd) {
+
+  // When reading from memory, decode in place, doing the bookkeeping of
+  // recv_all by hand. Malformed VarInts are left to the loop below, to
+  // fail the same way as always.
+  if (memory_source) {
+    int offset = memory_source_offset;
+    int32_t value = decodeVarInt(memory_source, memory_source_length, &offset);
+    if (value != VARNUM_ERROR) {
+      size_t size = offset - memory_source_offset;
+      traceCapture(memory_source + memory_source_offset, size);
+      memory_source_offset = offset;
+      total_bytes_received += size;
+      recv_count = 1; // As left behind by readByte
+      return value;
+    }
+  }
+
   int32_t value = 0;
   int position = 0;
   uint8_t byte;
@@ -31,24 +49,136 @@ int32_t readVarInt (int client_fd) {
   return value;
 }
 
+// Like readVarInt, but decodes from memory, starting at `*offset` and
+// advancing it past the VarInt. Fails if the VarInt runs past `length`.
+int32_t decodeVarInt (const uint8_t *buf, int length, int *offset) {
+  const uint8_t *p = buf + *offset;
+  int available = length - *offset;
+
+  // Nearly all VarInts on the wire are packet lengths, IDs and small
+  // counts, which take 1 or 2 bytes
+  if (available >= 1 && !(p[0] & CONTINUE_BIT)) {
+    *offset += 1;
+    return p[0];
+  }
+  if (available >= 2 && !(p[1] & CONTINUE_BIT)) {
+    *offset += 2;
+    return (p[0] & SEGMENT_BITS) | (p[1] << 7);
+  }
+
+  uint32_t value = 0;
+  for (int i = 0; i < VARINT_MAX_SIZE && i < available; i ++) {
+    value |= (uint32_t)(p[i] & SEGMENT_BITS) << (i * 7);
+    if (p[i] & CONTINUE_BIT) continue;
+    *offset += i + 1;
+    return value;
+  }
+
+  return VARNUM_ERROR;
+}
+
+// Same as decodeVarInt, for VarLongs of up to 10 bytes. As any 64-bit
+// value is valid, failure shows as `*offset` being left unchanged.
+int64_t decodeVarLong (const uint8_t *buf, int length, int *offset) {
+  const uint8_t *p = buf + *offset;
+  int available = length - *offset;
+
+  if (available >= 1 && !(p[0] & CONTINUE_BIT)) {
+    *offset += 1;
+    return p[0];
+  }
+
+  uint64_t value = 0;
+  for (int i = 0; i < VARLONG_MAX_SIZE && i < available; i ++) {
+    value |= (uint64_t)(p[i] & SEGMENT_BITS) << (i * 7);
+    if (p[i] & CONTINUE_BIT) continue;
+    *offset += i + 1;
+    return value;
+  }
+
+  return 0;
+}
+
+// Number of bytes needed to encode `bits` significant bits, 7 per byte
+#define VARNUM_SIZE_FROM_BITS(bits) (((bits) + 6) / 7)
+
+// Negative values, like the `-2 - i` IDs of mobs, have the top bit set,
+// and so always take the full 5 bytes
 int sizeVarInt (uint32_t value) {
-  int size = 1;
-  while ((value & ~SEGMENT_BITS) != 0) {
+  #ifdef __GNUC__
+    // OR-ing in 1 makes 0 count as one significant bit, as clz(0) is undefined
+    return VARNUM_SIZE_FROM_BITS(32 - __builtin_clz(value | 1));
+  #else
+    int size = 1;
+    while ((value & ~SEGMENT_BITS) != 0) {
+      value >>= 7;
+      size ++;
+    }
+    return size;
+  #endif
+}
+
+int sizeVarLong (uint64_t value) {
+  #ifdef __GNUC__
+    return VARNUM_SIZE_FROM_BITS(64 - __builtin_clzll(value | 1));
+  #else
+    int size = 1;
+    while ((value & ~(uint64_t)SEGMENT_BITS) != 0) {
+      value >>= 7;
+      size ++;
+    }
+    return size;
+  #endif
+}
+
+// Encodes a VarInt into `buf`, which needs room for VARINT_MAX_SIZE
+// bytes. Returns the amount of bytes written.
+int encodeVarInt (uint8_t *buf, uint32_t value) {
+  if (value < 0x80) {
+    buf[0] = value;
+    return 1;
+  }
+  if (value < 0x4000) {
+    buf[0] = value | CONTINUE_BIT;
+    buf[1] = value >> 7;
+    return 2;
+  }
+  if (value & 0x80000000) {
+    buf[0] = value | CONTINUE_BIT;
+    buf[1] = (value >> 7) | CONTINUE_BIT;
+    buf[2] = (value >> 14) | CONTINUE_BIT;
+    buf[3] = (value >> 21) | CONTINUE_BIT;
+    buf[4] = value >> 28;
+    return 5;
+  }
+
+  int size = 0;
+  while (value & ~SEGMENT_BITS) {
+    buf[size ++] = (value & SEGMENT_BITS) | CONTINUE_BIT;
     value >>= 7;
-    size ++;
   }
+  buf[size ++] = value;
   return size;
 }
 
-void writeVarInt (int client_fd, uint32_t value) {
-  while (true) {
-    if ((value & ~SEGMENT_BITS) == 0) {
-      writeByte(client_fd, value);
-      return;
-    }
-
-    writeByte(client_fd, (value & SEGMENT_BITS) | CONTINUE_BIT);
+// Same as encodeVarInt, `buf` needs room for VARLONG_MAX_SIZE bytes
+int encodeVarLong (uint8_t *buf, uint64_t value) {
+  if (value < 0x80) {
+    buf[0] = value;
+    return 1;
+  }
 
+  int size = 0;
+  while (value & ~(uint64_t)SEGMENT_BITS) {
+    buf[size ++] = (value & SEGMENT_BITS) | CONTINUE_BIT;
     value >>= 7;
   }
+  buf[size ++] = value;
+  return size;
+}
+
+// Encodes the VarInt in memory first, so that it takes a single write
+void writeVarInt (int client_fd, uint32_t value) {
+  uint8_t buf[VARINT_MAX_SIZE];
+  send_all(client_fd, buf, encodeVarInt(buf, value));
 }